@@ -36,6 +36,17 @@ typedef struct audio_clip_t
 
 } audio_clip_t;
 
+// Clips replay the APU one CPU cycle at a time with a sample per cycle
+static void audio_clip_apu_step(nes_apu* apu)
+{
+    nes_apu_step(apu);
+
+    uint32_t sample_index = apu->sample_count % NES_APU_MAX_SAMPLES;
+    apu->sample_count = sample_index + 1;
+
+    apu->samples[sample_index] = nes_apu_mix(apu);
+}
+
 void audio_clip_init(audio_clip_t* clip)
 {
     memset(clip, 0, sizeof(audio_clip_t));
@@ -130,7 +141,7 @@ int16_t audio_clip_next_sample(audio_clip_t* clip)
     if (clip->apu_current_state.sample_count)
         sample = clip->apu_current_state.samples[clip->apu_current_state.sample_count - 1];
 
-    nes_apu_execute(&clip->apu_current_state);
+    audio_clip_apu_step(&clip->apu_current_state);
 
     if (clip->current_sample < clip->sample_count)
     {
@@ -311,7 +322,7 @@ void audio_clip_record_apu(nes_apu* apu, void* client_data)
     if (sampleA != sampleB)
         printf("Record validation failed at sample: %d\n", clip->sample_count);
 
-    nes_apu_execute(&clip->apu_current_state);
+    audio_clip_apu_step(&clip->apu_current_state);
 #endif
 
     clip->sample_count++;
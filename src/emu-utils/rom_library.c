@@ -0,0 +1,831 @@
+#include "rom_library.h"
+#include "../emu/nes_rom.h"
+#include "../emu/nes_serializer.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if _WIN32
+#include <windows.h>
+#define LIBRARY_SEPARATOR '\\'
+#else
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#define LIBRARY_SEPARATOR '/'
+#endif
+
+#define LIBRARY_INDEX_MAGIC     _NES_SERIALIZER_TAG('N', 'E', 'S', 'L')
+#define LIBRARY_INDEX_VERSION   1
+#define LIBRARY_ENTRY_TAG       _NES_SERIALIZER_TAG('R', 'O', 'M', ' ')
+
+struct rom_library_t
+{
+    char*                   index_path;
+    rom_library_entry_t*    entries;        // sorted by path
+    size_t                  count;
+    size_t                  capacity;
+};
+
+/////////////////////////////////////////////////
+// Threads
+/////////////////////////////////////////////////
+
+#if _WIN32
+typedef HANDLE              library_thread;
+typedef CRITICAL_SECTION    library_mutex;
+typedef CONDITION_VARIABLE  library_cond;
+
+static void library_mutex_init(library_mutex* mutex)                    { InitializeCriticalSection(mutex); }
+static void library_mutex_destroy(library_mutex* mutex)                 { DeleteCriticalSection(mutex); }
+static void library_mutex_lock(library_mutex* mutex)                    { EnterCriticalSection(mutex); }
+static void library_mutex_unlock(library_mutex* mutex)                  { LeaveCriticalSection(mutex); }
+static void library_cond_init(library_cond* cond)                       { InitializeConditionVariable(cond); }
+static void library_cond_destroy(library_cond* cond)                    {}
+static void library_cond_wait(library_cond* cond, library_mutex* mutex) { SleepConditionVariableCS(cond, mutex, INFINITE); }
+static void library_cond_broadcast(library_cond* cond)                  { WakeAllConditionVariable(cond); }
+
+static uint32_t library_core_count()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+#else
+typedef pthread_t           library_thread;
+typedef pthread_mutex_t     library_mutex;
+typedef pthread_cond_t      library_cond;
+
+static void library_mutex_init(library_mutex* mutex)                    { pthread_mutex_init(mutex, 0); }
+static void library_mutex_destroy(library_mutex* mutex)                 { pthread_mutex_destroy(mutex); }
+static void library_mutex_lock(library_mutex* mutex)                    { pthread_mutex_lock(mutex); }
+static void library_mutex_unlock(library_mutex* mutex)                  { pthread_mutex_unlock(mutex); }
+static void library_cond_init(library_cond* cond)                       { pthread_cond_init(cond, 0); }
+static void library_cond_destroy(library_cond* cond)                    { pthread_cond_destroy(cond); }
+static void library_cond_wait(library_cond* cond, library_mutex* mutex) { pthread_cond_wait(cond, mutex); }
+static void library_cond_broadcast(library_cond* cond)                  { pthread_cond_broadcast(cond); }
+
+static uint32_t library_core_count()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+#endif
+
+/////////////////////////////////////////////////
+// Files
+/////////////////////////////////////////////////
+
+static char* library_full_path(const char* path)
+{
+#if _WIN32
+    return _fullpath(0, path, 0);
+#else
+    return realpath(path, 0);
+#endif
+}
+
+static char* library_copy(const char* text)
+{
+    char* copy = (char*)malloc(strlen(text) + 1);
+    if (copy)
+        strcpy(copy, text);
+
+    return copy;
+}
+
+static char* library_join(const char* dir, const char* name)
+{
+    size_t dir_length = strlen(dir);
+    size_t name_length = strlen(name);
+
+    char* path = (char*)malloc(dir_length + name_length + 2);
+    if (!path)
+        return 0;
+
+    memcpy(path, dir, dir_length);
+    path[dir_length] = LIBRARY_SEPARATOR;
+    memcpy(path + dir_length + 1, name, name_length + 1);
+
+    return path;
+}
+
+static int library_is_rom_name(const char* name)
+{
+    size_t length = strlen(name);
+    const char* extension = name + length - 4;
+
+    return length > 4 && extension[0] == '.' &&
+           (extension[1] | 0x20) == 'n' && (extension[2] | 0x20) == 'e' && (extension[3] | 0x20) == 's';
+}
+
+// Symbolic links to directories are not followed, so the walk cannot loop
+static int library_stat(const char* path, uint64_t* size, int64_t* mtime, int* is_dir)
+{
+#if _WIN32
+    struct _stat64 file_stat;
+    if (_stat64(path, &file_stat) != 0)
+        return 0;
+
+    *is_dir = (file_stat.st_mode & _S_IFDIR) != 0 && !(GetFileAttributesA(path) & FILE_ATTRIBUTE_REPARSE_POINT);
+#else
+    struct stat file_stat;
+    if (lstat(path, &file_stat) != 0)
+        return 0;
+
+    *is_dir = S_ISDIR(file_stat.st_mode);
+
+    if (S_ISLNK(file_stat.st_mode) && stat(path, &file_stat) != 0)
+        return 0;
+#endif
+
+    *size = (uint64_t)file_stat.st_size;
+    *mtime = (int64_t)file_stat.st_mtime;
+    return 1;
+}
+
+// Word at a time multiply and xorshift, a 4 MB ROM hashes in well under a millisecond. Words are read in host order
+static uint64_t library_hash(const uint8_t* data, size_t size)
+{
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ size;
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+
+    for (; i < size; ++i)
+        hash = (hash ^ data[i]) * 0x100000001B3ull;
+
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Fills in what the file says about itself, only the header and the ROM it declares are read
+static void library_read_rom(rom_library_entry_t* entry, uint8_t** buffer, size_t* buffer_size)
+{
+    entry->hash = 0;
+    entry->prg_rom_size = 0;
+    entry->chr_rom_size = 0;
+    entry->mapper_id = 0;
+    entry->flags = 0;
+
+    FILE* rom_file = fopen(entry->path, "rb");
+    if (!rom_file)
+        return;
+
+    struct ines_header hdr;
+    size_t prg_offset = 0;
+
+    if (fread(&hdr, sizeof(struct ines_header), 1, rom_file) == 1)
+        prg_offset = nes_rom_ines_prg_offset(&hdr, (size_t)entry->file_size);
+
+    if (prg_offset)
+    {
+        size_t rom_size = hdr.prg_rom_size * 0x4000 + hdr.chr_rom_size * 0x2000;
+
+        if (rom_size > *buffer_size)
+        {
+            uint8_t* grown = (uint8_t*)realloc(*buffer, rom_size);
+            if (grown)
+            {
+                *buffer = grown;
+                *buffer_size = rom_size;
+            }
+        }
+
+        if (rom_size <= *buffer_size && fseek(rom_file, (long)prg_offset, SEEK_SET) == 0 &&
+            fread(*buffer, 1, rom_size, rom_file) == rom_size)
+        {
+            entry->hash = library_hash(*buffer, rom_size);
+            entry->prg_rom_size = (uint32_t)(hdr.prg_rom_size * 0x4000);
+            entry->chr_rom_size = (uint32_t)(hdr.chr_rom_size * 0x2000);
+            entry->mapper_id = (uint16_t)((hdr.flags7.mapper_high << 4) | hdr.flags6.mapper_low);
+
+            entry->flags = ROM_LIBRARY_ROM_VALID;
+            entry->flags |= nes_mapper_is_supported(entry->mapper_id) ? ROM_LIBRARY_ROM_SUPPORTED : 0;
+            entry->flags |= hdr.flags6.mirroring ? ROM_LIBRARY_ROM_VERTICAL_MIRRORING : 0;
+            entry->flags |= hdr.flags6.battery_ram ? ROM_LIBRARY_ROM_BATTERY : 0;
+            entry->flags |= hdr.flags6.has_trainer ? ROM_LIBRARY_ROM_TRAINER : 0;
+        }
+    }
+
+    fclose(rom_file);
+}
+
+/////////////////////////////////////////////////
+// Entries
+/////////////////////////////////////////////////
+
+static int library_compare_entries(const void* a, const void* b)
+{
+    return strcmp(((const rom_library_entry_t*)a)->path, ((const rom_library_entry_t*)b)->path);
+}
+
+static rom_library_entry_t* library_find(rom_library_t* library, const char* full_path)
+{
+    rom_library_entry_t key;
+    key.path = (char*)full_path;
+
+    if (!library->count)
+        return 0;
+
+    return (rom_library_entry_t*)bsearch(&key, library->entries, library->count, sizeof(rom_library_entry_t), &library_compare_entries);
+}
+
+static int library_reserve(rom_library_entry_t** entries, size_t* capacity, size_t count)
+{
+    if (count <= *capacity)
+        return 1;
+
+    size_t new_capacity = *capacity ? *capacity * 2 : 256;
+    while (new_capacity < count)
+        new_capacity *= 2;
+
+    rom_library_entry_t* grown = (rom_library_entry_t*)realloc(*entries, new_capacity * sizeof(rom_library_entry_t));
+    if (!grown)
+        return 0;
+
+    *entries = grown;
+    *capacity = new_capacity;
+    return 1;
+}
+
+// Takes the file's own fields from known when it did not change since, otherwise reads it. Returns 1 when it was read
+static int library_refresh_entry(rom_library_entry_t* entry, const rom_library_entry_t* known, uint8_t** buffer, size_t* buffer_size)
+{
+    if (known)
+        entry->settings = known->settings;
+
+    if (known && known->file_size == entry->file_size && known->mtime == entry->mtime)
+    {
+        entry->hash = known->hash;
+        entry->prg_rom_size = known->prg_rom_size;
+        entry->chr_rom_size = known->chr_rom_size;
+        entry->mapper_id = known->mapper_id;
+        entry->flags = known->flags;
+        return 0;
+    }
+
+    library_read_rom(entry, buffer, buffer_size);
+    return 1;
+}
+
+static int library_serialize_entry(nes_serializer* s, rom_library_entry_t* entry)
+{
+    uint32_t path_length = entry->path ? (uint32_t)strlen(entry->path) : 0;
+    nes_serialize_u32(s, &path_length);
+
+    if (s->loading)
+    {
+        if (s->failed || path_length == 0 || path_length > s->size - s->offset)
+            return 0;
+
+        entry->path = (char*)malloc(path_length + 1);
+        if (!entry->path)
+            return 0;
+
+        entry->path[path_length] = 0;
+    }
+
+    nes_serialize_bytes(s, entry->path, path_length);
+    nes_serialize_u64(s, &entry->file_size);
+    _NES_SERIALIZE_AS(s, 64, entry->mtime);
+    nes_serialize_u64(s, &entry->hash);
+    nes_serialize_u32(s, &entry->prg_rom_size);
+    nes_serialize_u32(s, &entry->chr_rom_size);
+    nes_serialize_u16(s, &entry->mapper_id);
+    nes_serialize_u16(s, &entry->flags);
+    nes_serialize_u32(s, &entry->settings.flags);
+    nes_serialize_u32(s, &entry->settings.rewind_mb);
+    nes_serialize_u32(s, &entry->settings.run_ahead_frames);
+
+    if (s->loading && s->failed)
+    {
+        free(entry->path);
+        return 0;
+    }
+
+    return 1;
+}
+
+static void library_serialize(rom_library_t* library, nes_serializer* s)
+{
+    uint32_t magic = LIBRARY_INDEX_MAGIC;
+    uint32_t version = LIBRARY_INDEX_VERSION;
+
+    nes_serialize_u32(s, &magic);
+    nes_serialize_u32(s, &version);
+
+    for (size_t i = 0; i < library->count; ++i)
+    {
+        size_t payload_offset = nes_serializer_begin_chunk(s, LIBRARY_ENTRY_TAG);
+        library_serialize_entry(s, &library->entries[i]);
+        nes_serializer_end_chunk(s, payload_offset);
+    }
+}
+
+static void library_load(rom_library_t* library, const uint8_t* data, size_t size)
+{
+    nes_serializer s = nes_serializer_create((void*)data, size, 1);
+    uint32_t magic = 0;
+    uint32_t version = 0;
+
+    nes_serialize_u32(&s, &magic);
+    nes_serialize_u32(&s, &version);
+
+    if (s.failed || magic != LIBRARY_INDEX_MAGIC || version != LIBRARY_INDEX_VERSION)
+        return;
+
+    uint32_t tag;
+    nes_serializer payload;
+
+    while (nes_serializer_next_chunk(&s, &tag, &payload))
+    {
+        if (tag != LIBRARY_ENTRY_TAG || !library_reserve(&library->entries, &library->capacity, library->count + 1))
+            continue;
+
+        memset(&library->entries[library->count], 0, sizeof(rom_library_entry_t));
+
+        if (library_serialize_entry(&payload, &library->entries[library->count]))
+            ++library->count;
+    }
+
+    qsort(library->entries, library->count, sizeof(rom_library_entry_t), &library_compare_entries);
+}
+
+/////////////////////////////////////////////////
+// Scan
+/////////////////////////////////////////////////
+
+typedef struct library_scan
+{
+    rom_library_t*          library;        // read only while the workers run
+    library_mutex           lock;
+    library_cond            work_ready;
+    char**                  queue;          // directories and ROM files left to look at
+    size_t                  queue_count;
+    size_t                  queue_capacity;
+    size_t                  pending;        // queued paths plus the ones being looked at
+    rom_library_entry_t*    results;
+    size_t                  result_count;
+    size_t                  result_capacity;
+    uint32_t                parsed;
+    int                     failed;         // out of memory, the library is left as it was
+} library_scan;
+
+static void library_scan_push(library_scan* scan, char* path)
+{
+    library_mutex_lock(&scan->lock);
+
+    if (scan->queue_count == scan->queue_capacity)
+    {
+        size_t new_capacity = scan->queue_capacity ? scan->queue_capacity * 2 : 256;
+        char** grown = (char**)realloc(scan->queue, new_capacity * sizeof(char*));
+
+        if (grown)
+        {
+            scan->queue = grown;
+            scan->queue_capacity = new_capacity;
+        }
+    }
+
+    if (path && scan->queue_count < scan->queue_capacity)
+    {
+        scan->queue[scan->queue_count++] = path;
+        ++scan->pending;
+        library_cond_broadcast(&scan->work_ready);
+    }
+    else
+    {
+        free(path);
+        scan->failed = 1;
+    }
+
+    library_mutex_unlock(&scan->lock);
+}
+
+static void library_scan_dir(library_scan* scan, const char* path)
+{
+#if _WIN32
+    char* pattern = library_join(path, "*");
+    if (!pattern)
+        return;
+
+    WIN32_FIND_DATAA item;
+    HANDLE find = FindFirstFileA(pattern, &item);
+    free(pattern);
+
+    if (find == INVALID_HANDLE_VALUE)
+        return;
+
+    do
+    {
+        const char* name = item.cFileName;
+        int is_dir = (item.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !(item.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
+
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+            continue;
+
+        if (is_dir || library_is_rom_name(name))
+            library_scan_push(scan, library_join(path, name));
+    }
+    while (FindNextFileA(find, &item));
+
+    FindClose(find);
+#else
+    DIR* dir = opendir(path);
+    if (!dir)
+        return;
+
+    struct dirent* item;
+
+    while ((item = readdir(dir)) != 0)
+    {
+        const char* name = item->d_name;
+
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+            continue;
+
+#if defined(DT_DIR)
+        // Anything else is looked at once stat tells what it is
+        if (item->d_type != DT_DIR && item->d_type != DT_UNKNOWN && !library_is_rom_name(name))
+            continue;
+#endif
+
+        library_scan_push(scan, library_join(path, name));
+    }
+
+    closedir(dir);
+#endif
+}
+
+static void library_scan_path(library_scan* scan, char* path, uint8_t** buffer, size_t* buffer_size)
+{
+    rom_library_entry_t entry;
+    int is_dir = 0;
+
+    memset(&entry, 0, sizeof(rom_library_entry_t));
+
+    if (!library_stat(path, &entry.file_size, &entry.mtime, &is_dir) || (!is_dir && !library_is_rom_name(path)))
+    {
+        free(path);
+        return;
+    }
+
+    if (is_dir)
+    {
+        library_scan_dir(scan, path);
+        free(path);
+        return;
+    }
+
+    entry.path = path;
+    int parsed = library_refresh_entry(&entry, library_find(scan->library, path), buffer, buffer_size);
+
+    library_mutex_lock(&scan->lock);
+
+    if (library_reserve(&scan->results, &scan->result_capacity, scan->result_count + 1))
+    {
+        scan->results[scan->result_count++] = entry;
+        scan->parsed += parsed;
+    }
+    else
+    {
+        free(path);
+        scan->failed = 1;
+    }
+
+    library_mutex_unlock(&scan->lock);
+}
+
+static void library_scan_loop(library_scan* scan)
+{
+    uint8_t* buffer = 0;
+    size_t buffer_size = 0;
+
+    library_mutex_lock(&scan->lock);
+
+    for (;;)
+    {
+        while (scan->queue_count == 0 && scan->pending > 0)
+            library_cond_wait(&scan->work_ready, &scan->lock);
+
+        if (scan->queue_count == 0)
+            break;
+
+        char* path = scan->queue[--scan->queue_count];
+
+        library_mutex_unlock(&scan->lock);
+        library_scan_path(scan, path, &buffer, &buffer_size);
+        library_mutex_lock(&scan->lock);
+
+        // The last one out wakes everybody up to leave
+        if (--scan->pending == 0)
+            library_cond_broadcast(&scan->work_ready);
+    }
+
+    library_mutex_unlock(&scan->lock);
+    free(buffer);
+}
+
+#if _WIN32
+static DWORD WINAPI library_scan_main(LPVOID arg)
+{
+    library_scan_loop((library_scan*)arg);
+    return 0;
+}
+
+static int library_thread_start(library_thread* thread, library_scan* scan)
+{
+    *thread = CreateThread(0, 0, &library_scan_main, scan, 0, 0);
+    return *thread != 0;
+}
+
+static void library_thread_join(library_thread* thread)
+{
+    WaitForSingleObject(*thread, INFINITE);
+    CloseHandle(*thread);
+}
+#else
+static void* library_scan_main(void* arg)
+{
+    library_scan_loop((library_scan*)arg);
+    return 0;
+}
+
+static int library_thread_start(library_thread* thread, library_scan* scan)
+{
+    return pthread_create(thread, 0, &library_scan_main, scan) == 0;
+}
+
+static void library_thread_join(library_thread* thread)
+{
+    pthread_join(*thread, 0);
+}
+#endif
+
+static int library_is_under(const char* path, const char* root, size_t root_length)
+{
+    return strncmp(path, root, root_length) == 0 &&
+           (path[root_length] == 0 || path[root_length] == LIBRARY_SEPARATOR || root[root_length - 1] == LIBRARY_SEPARATOR);
+}
+
+/////////////////////////////////////////////////
+// Public
+/////////////////////////////////////////////////
+
+rom_library_t* rom_library_open(const char* index_path)
+{
+    rom_library_t* library = (rom_library_t*)calloc(1, sizeof(rom_library_t));
+    if (!library)
+        return 0;
+
+    library->index_path = library_copy(index_path);
+    if (!library->index_path)
+    {
+        free(library);
+        return 0;
+    }
+
+    FILE* index_file = fopen(index_path, "rb");
+    if (index_file)
+    {
+        fseek(index_file, 0, SEEK_END);
+        long index_size = ftell(index_file);
+        fseek(index_file, 0, SEEK_SET);
+
+        uint8_t* data = index_size > 0 ? (uint8_t*)malloc((size_t)index_size) : 0;
+
+        if (data && fread(data, (size_t)index_size, 1, index_file) == 1)
+            library_load(library, data, (size_t)index_size);
+
+        free(data);
+        fclose(index_file);
+    }
+
+    return library;
+}
+
+void rom_library_destroy(rom_library_t* library)
+{
+    for (size_t i = 0; i < library->count; ++i)
+        free(library->entries[i].path);
+
+    free(library->entries);
+    free(library->index_path);
+    free(library);
+}
+
+// Written next to the index and renamed over it, a crash leaves the previous index
+int rom_library_save(rom_library_t* library)
+{
+    nes_serializer counter = nes_serializer_create(0, 0, 0);
+    library_serialize(library, &counter);
+
+    uint8_t* data = (uint8_t*)malloc(counter.offset);
+    if (!data)
+        return 0;
+
+    nes_serializer s = nes_serializer_create(data, counter.offset, 0);
+    library_serialize(library, &s);
+
+    char* temp_path = (char*)malloc(strlen(library->index_path) + 5);
+    int saved = 0;
+
+    if (temp_path)
+    {
+        strcpy(temp_path, library->index_path);
+        strcat(temp_path, ".tmp");
+
+        FILE* index_file = fopen(temp_path, "wb");
+        if (index_file)
+        {
+            saved = fwrite(data, s.offset, 1, index_file) == 1;
+            saved &= fclose(index_file) == 0;
+        }
+
+#if _WIN32
+        saved = saved && MoveFileExA(temp_path, library->index_path, MOVEFILE_REPLACE_EXISTING);
+#else
+        saved = saved && rename(temp_path, library->index_path) == 0;
+#endif
+
+        if (!saved)
+            remove(temp_path);
+
+        free(temp_path);
+    }
+
+    free(data);
+    return saved;
+}
+
+int rom_library_scan(rom_library_t* library, const char* root, uint32_t thread_count, rom_library_scan_stats_t* stats)
+{
+    char* full_root = library_full_path(root);
+    if (!full_root)
+        return 0;
+
+    library_scan scan;
+    memset(&scan, 0, sizeof(library_scan));
+    scan.library = library;
+
+    library_mutex_init(&scan.lock);
+    library_cond_init(&scan.work_ready);
+
+    // The root may be a single file as well
+    library_scan_push(&scan, library_copy(full_root));
+
+    if (thread_count == 0)
+        thread_count = library_core_count();
+
+    library_thread* threads = (library_thread*)malloc(thread_count * sizeof(library_thread));
+    uint32_t started = 0;
+
+    // The calling thread is one of the workers
+    while (threads && started + 1 < thread_count && library_thread_start(&threads[started], &scan))
+        ++started;
+
+    library_scan_loop(&scan);
+
+    for (uint32_t i = 0; i < started; ++i)
+        library_thread_join(&threads[i]);
+
+    free(threads);
+    free(scan.queue);
+    library_cond_destroy(&scan.work_ready);
+    library_mutex_destroy(&scan.lock);
+
+    qsort(scan.results, scan.result_count, sizeof(rom_library_entry_t), &library_compare_entries);
+
+    // Entries outside the root stay, the ones under it are replaced by what the scan found
+    size_t root_length = strlen(full_root);
+    size_t kept = 0;
+    uint32_t removed = 0;
+
+    for (size_t i = 0; i < library->count; ++i)
+    {
+        rom_library_entry_t* entry = &library->entries[i];
+
+        if (!library_is_under(entry->path, full_root, root_length))
+            ++kept;
+        else if (!scan.result_count || !bsearch(entry, scan.results, scan.result_count, sizeof(rom_library_entry_t), &library_compare_entries))
+            ++removed;
+    }
+
+    if (scan.failed || !library_reserve(&library->entries, &library->capacity, kept + scan.result_count))
+    {
+        for (size_t i = 0; i < scan.result_count; ++i)
+            free(scan.results[i].path);
+
+        free(scan.results);
+        free(full_root);
+        return 0;
+    }
+
+    kept = 0;
+
+    for (size_t i = 0; i < library->count; ++i)
+    {
+        if (library_is_under(library->entries[i].path, full_root, root_length))
+            free(library->entries[i].path);
+        else
+            library->entries[kept++] = library->entries[i];
+    }
+
+    if (scan.result_count)
+        memcpy(library->entries + kept, scan.results, scan.result_count * sizeof(rom_library_entry_t));
+    library->count = kept + scan.result_count;
+    qsort(library->entries, library->count, sizeof(rom_library_entry_t), &library_compare_entries);
+
+    if (stats)
+    {
+        stats->files = (uint32_t)scan.result_count;
+        stats->parsed = scan.parsed;
+        stats->removed = removed;
+    }
+
+    free(scan.results);
+    free(full_root);
+    return 1;
+}
+
+const rom_library_entry_t* rom_library_update(rom_library_t* library, const char* path)
+{
+    char* full_path = library_full_path(path);
+    if (!full_path)
+        return 0;
+
+    rom_library_entry_t entry;
+    int is_dir = 0;
+
+    memset(&entry, 0, sizeof(rom_library_entry_t));
+
+    if (!library_stat(full_path, &entry.file_size, &entry.mtime, &is_dir) || is_dir)
+    {
+        free(full_path);
+        return 0;
+    }
+
+    rom_library_entry_t* known = library_find(library, full_path);
+    uint8_t* buffer = 0;
+    size_t buffer_size = 0;
+
+    entry.path = full_path;
+    library_refresh_entry(&entry, known, &buffer, &buffer_size);
+    free(buffer);
+
+    if (known)
+    {
+        free(known->path);
+        *known = entry;
+        return known;
+    }
+
+    if (!library_reserve(&library->entries, &library->capacity, library->count + 1))
+    {
+        free(full_path);
+        return 0;
+    }
+
+    library->entries[library->count++] = entry;
+    qsort(library->entries, library->count, sizeof(rom_library_entry_t), &library_compare_entries);
+
+    return library_find(library, full_path);
+}
+
+const rom_library_entry_t* rom_library_find(rom_library_t* library, const char* path)
+{
+    char* full_path = library_full_path(path);
+    rom_library_entry_t* entry = library_find(library, full_path ? full_path : path);
+
+    free(full_path);
+    return entry;
+}
+
+size_t rom_library_count(rom_library_t* library)
+{
+    return library->count;
+}
+
+const rom_library_entry_t* rom_library_get(rom_library_t* library, size_t index)
+{
+    return index < library->count ? &library->entries[index] : 0;
+}
+
+int rom_library_set_settings(rom_library_t* library, const char* path, const rom_library_settings_t* settings)
+{
+    rom_library_entry_t* entry = (rom_library_entry_t*)rom_library_find(library, path);
+    if (!entry)
+        return 0;
+
+    entry->settings = *settings;
+    return 1;
+}
@@ -0,0 +1,69 @@
+#ifndef _EMU_UTILS_ROM_LIBRARY_H_
+#define _EMU_UTILS_ROM_LIBRARY_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// On disk index of the .nes files under some directories, so launchers list and start ROMs without opening them.
+// Paths are kept absolute, lookups resolve the path they are given the same way.
+
+#define ROM_LIBRARY_ROM_VALID               (1 << 0)    // an iNES file holding the PRG and CHR ROM its header declares
+#define ROM_LIBRARY_ROM_SUPPORTED           (1 << 1)    // valid and its mapper is implemented
+#define ROM_LIBRARY_ROM_VERTICAL_MIRRORING  (1 << 2)
+#define ROM_LIBRARY_ROM_BATTERY             (1 << 3)
+#define ROM_LIBRARY_ROM_TRAINER             (1 << 4)
+
+#define ROM_LIBRARY_SETTING_REWIND          (1 << 0)
+#define ROM_LIBRARY_SETTING_RUN_AHEAD       (1 << 1)
+
+typedef struct rom_library_settings_t
+{
+    uint32_t    flags;              // ROM_LIBRARY_SETTING_* of the fields set for the ROM, the others take the frontend defaults
+    uint32_t    rewind_mb;
+    uint32_t    run_ahead_frames;
+
+} rom_library_settings_t;
+
+typedef struct rom_library_entry_t
+{
+    char*       path;
+    uint64_t    file_size;
+    int64_t     mtime;              // seconds, the entry is read again once size or mtime change
+    uint64_t    hash;               // PRG and CHR ROM without the header and trainer, equal across header fixes
+    uint32_t    prg_rom_size;
+    uint32_t    chr_rom_size;
+    uint16_t    mapper_id;
+    uint16_t    flags;              // ROM_LIBRARY_ROM_*
+    rom_library_settings_t settings;
+
+} rom_library_entry_t;
+
+typedef struct rom_library_scan_stats_t
+{
+    uint32_t    files;              // .nes files found under the root
+    uint32_t    parsed;             // new or changed since the last scan
+    uint32_t    removed;            // entries under the root whose file is gone
+
+} rom_library_scan_stats_t;
+
+typedef struct rom_library_t rom_library_t;
+
+// Loads the index at index_path, a missing or unreadable one gives an empty library saved there
+rom_library_t*              rom_library_open(const char* index_path);
+void                        rom_library_destroy(rom_library_t* library);
+int                         rom_library_save(rom_library_t* library);
+
+// Brings every entry under root up to date, thread_count workers (0 for one per core) walk it and read what changed.
+// Returns 0 when root cannot be read
+int                         rom_library_scan(rom_library_t* library, const char* root, uint32_t thread_count, rom_library_scan_stats_t* stats);
+
+// Entry of one file, read again only when it changed. Entries stay valid until the library changes
+const rom_library_entry_t*  rom_library_update(rom_library_t* library, const char* path);
+const rom_library_entry_t*  rom_library_find(rom_library_t* library, const char* path);
+size_t                      rom_library_count(rom_library_t* library);
+const rom_library_entry_t*  rom_library_get(rom_library_t* library, size_t index);
+
+// Returns 0 when the path has no entry
+int                         rom_library_set_settings(rom_library_t* library, const char* path, const rom_library_settings_t* settings);
+
+#endif
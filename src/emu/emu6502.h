@@ -226,6 +226,20 @@ enum cpu_status_flags
         state.address = (state.address & 0xFF) | ((uint16_t)state.data << 8);\
 }
 
+#define _CPU_END_INSTRUCTION(cpu, interrupt) \
+    if (interrupt) {\
+        cpu.rw_mode = CPU_RW_MODE_NONE;\
+        cpu.data = 0;\
+        cpu.cycle = 0;\
+        cpu.temp = 0xFE;\
+    }\
+    else {\
+        cpu.rw_mode = CPU_RW_MODE_READ;\
+        cpu.address = cpu.PC++;\
+        cpu.cycle = 0;\
+        cpu.temp = 0;\
+    }
+
 static cpu_state cpu_reset(cpu_state state)
 {
     _CPU_SET_REG_P(state, state.P | CPU_STATUS_FLAG_IRQDISABLE);
@@ -1473,21 +1487,485 @@ static cpu_state cpu_execute(cpu_state state)
         }
     }
 
-    if (nmi_phase1 || irq_phase1)
+    _CPU_END_INSTRUCTION(state, nmi_phase1 || irq_phase1);
+
+    return state;
+}
+
+/*
+    Instruction-granular executor
+
+    Runs a whole instruction per call, with plain straight-line code instead of the per-cycle dispatch of cpu_execute.
+    It produces the same bus accesses, in the same order, as cpu_execute would, but does not interleave them with
+    the rest of the system, so it is only usable while no other device can observe or affect those accesses.
+
+    The bus may refuse any access by returning 0, in which case the instruction is abandoned and has to be run with
+    cpu_execute instead. Stack accesses and the operand bytes at PC are expected to be accepted: JSR reads its last
+    operand byte after pushing the return address, and no other write precedes a refusable access.
+*/
+
+typedef struct cpu_bus
+{
+    void*   context;
+    int     (*read)(void* context, uint16_t address, uint8_t* data);
+    int     (*write)(void* context, uint16_t address, uint8_t data);
+} cpu_bus;
+
+#define _CPU_MAX_INSTRUCTION_CYCLES 8
+
+#define _CPU_BUS_READ(addr)  { state.address = (addr); if (!bus->read(bus->context, state.address, &state.data)) return 0; }
+#define _CPU_BUS_WRITE(addr) { state.address = (addr); if (!bus->write(bus->context, state.address, state.data)) return 0; }
+#define _CPU_FETCH_OPERAND() _CPU_BUS_READ(state.PC++)
+#define _CPU_PUSH(v)         { state.data = (v); _CPU_BUS_WRITE(((uint8_t)state.S--) + 0x0100); }
+#define _CPU_PULL()          _CPU_BUS_READ(((uint8_t)++state.S) + 0x0100)
+
+#define _CPU_ADDR_ZP()          { _CPU_FETCH_OPERAND(); address = state.data; }
+#define _CPU_ADDR_ZP_INDEXED(i) { _CPU_FETCH_OPERAND(); address = (state.data + (i)) & 0xFF; }
+#define _CPU_ADDR_ABS()         { _CPU_FETCH_OPERAND(); state.temp = state.data; _CPU_FETCH_OPERAND(); address = (state.data << 8) | state.temp; }
+
+#define _CPU_ADDR_ABS_INDEXED(i) {\
+    _CPU_FETCH_OPERAND();\
+    state.temp = state.data;\
+    _CPU_FETCH_OPERAND();\
+    address = (state.data << 8) | ((state.temp + (i)) & 0xFF);\
+    page_cross = (state.temp + (i)) >> 8;\
+}
+
+#define _CPU_ADDR_IND_X() {\
+    _CPU_FETCH_OPERAND();\
+    _CPU_BUS_READ((state.data + state.X) & 0xFF);\
+    state.temp = state.data;\
+    _CPU_BUS_READ((state.address + 1) & 0xFF);\
+    address = (state.data << 8) | state.temp;\
+}
+
+#define _CPU_ADDR_IND_Y() {\
+    _CPU_FETCH_OPERAND();\
+    _CPU_BUS_READ(state.data);\
+    state.temp = state.data;\
+    _CPU_BUS_READ((state.address + 1) & 0xFF);\
+    address = (state.data << 8) | ((state.temp + state.Y) & 0xFF);\
+    page_cross = (state.temp + state.Y) >> 8;\
+}
+
+/* Indexed reads re-read the corrected address on page-cross, indexed writes always read the uncorrected one first */
+#define _CPU_READ_PAGE_CROSS()  { _CPU_BUS_READ(address); if (page_cross) { _CPU_BUS_READ(address + 0x0100); cycles++; } }
+#define _CPU_DUMMY_READ()       { _CPU_BUS_READ(address); address += page_cross * 0x0100; }
+#define _CPU_MODIFY(op)         { _CPU_BUS_READ(address); _CPU_BUS_WRITE(address); op; _CPU_BUS_WRITE(address); }
+
+#define _CPU_READ_IMM(op)               { _CPU_FETCH_OPERAND(); op; cycles = 2; }
+#define _CPU_READ_ZP(op)                { _CPU_ADDR_ZP(); _CPU_BUS_READ(address); op; cycles = 3; }
+#define _CPU_READ_ZP_INDEXED(i, op)     { _CPU_ADDR_ZP_INDEXED(i); _CPU_BUS_READ(address); op; cycles = 4; }
+#define _CPU_LOAD_ZP_INDEXED(i, op)     { _CPU_ADDR_ZP_INDEXED(i); _CPU_BUS_READ(address); op; _CPU_BUS_READ(address); cycles = 4; }
+#define _CPU_READ_ABS(op)               { _CPU_ADDR_ABS(); _CPU_BUS_READ(address); op; cycles = 4; }
+#define _CPU_READ_ABS_INDEXED(i, op)    { cycles = 4; _CPU_ADDR_ABS_INDEXED(i); _CPU_READ_PAGE_CROSS(); op; }
+#define _CPU_READ_IND_X(op)             { _CPU_ADDR_IND_X(); _CPU_BUS_READ(address); op; cycles = 6; }
+#define _CPU_READ_IND_Y(op)             { cycles = 5; _CPU_ADDR_IND_Y(); _CPU_READ_PAGE_CROSS(); op; }
+
+#define _CPU_WRITE_ZP(v)                { _CPU_ADDR_ZP(); state.data = (v); _CPU_BUS_WRITE(address); cycles = 3; }
+#define _CPU_WRITE_ZP_INDEXED(i, v)     { _CPU_ADDR_ZP_INDEXED(i); state.data = (v); _CPU_BUS_WRITE(address); cycles = 4; }
+#define _CPU_WRITE_ABS(v)               { _CPU_ADDR_ABS(); state.data = (v); _CPU_BUS_WRITE(address); cycles = 4; }
+#define _CPU_WRITE_ABS_INDEXED(i, v)    { _CPU_ADDR_ABS_INDEXED(i); _CPU_DUMMY_READ(); state.data = (v); _CPU_BUS_WRITE(address); cycles = 5; }
+#define _CPU_WRITE_IND_X(v)             { _CPU_ADDR_IND_X(); state.data = (v); _CPU_BUS_WRITE(address); cycles = 6; }
+#define _CPU_WRITE_IND_Y(v)             { _CPU_ADDR_IND_Y(); _CPU_DUMMY_READ(); state.data = (v); _CPU_BUS_WRITE(address); cycles = 6; }
+
+#define _CPU_MODIFY_ZP(op)              { _CPU_ADDR_ZP(); _CPU_MODIFY(op); cycles = 5; }
+#define _CPU_MODIFY_ZP_INDEXED(i, op)   { _CPU_ADDR_ZP_INDEXED(i); _CPU_MODIFY(op); cycles = 6; }
+#define _CPU_MODIFY_ABS(op)             { _CPU_ADDR_ABS(); _CPU_MODIFY(op); cycles = 6; }
+#define _CPU_MODIFY_ABS_INDEXED(i, op)  { _CPU_ADDR_ABS_INDEXED(i); _CPU_DUMMY_READ(); _CPU_MODIFY(op); cycles = 7; }
+#define _CPU_MODIFY_IND_X(op)           { _CPU_ADDR_IND_X(); _CPU_MODIFY(op); cycles = 8; }
+#define _CPU_MODIFY_IND_Y(op)           { _CPU_ADDR_IND_Y(); _CPU_DUMMY_READ(); _CPU_MODIFY(op); cycles = 8; }
+
+#define _CPU_STORE_HIGH_AND(v, cycle_count) {\
+    _CPU_BUS_READ(address);\
+    state.temp = page_cross;\
+    _CPU_SHAXY(state, (v), 0);\
+    _CPU_BUS_WRITE(state.address);\
+    cycles = cycle_count;\
+}
+
+#define _CPU_BRANCH(cond) {\
+    _CPU_FETCH_OPERAND();\
+    cycles = 2;\
+    if (cond) {\
+        state.address = state.PC + (int8_t)state.data;\
+        cycles = ((state.address & 0xFF00) != (state.PC & 0xFF00)) ? 4 : 3;\
+        state.PC = state.address;\
+    }\
+}
+
+/*
+    Executes the instruction whose opcode was fetched into state->data, stopping right before its final cycle
+    (the next opcode fetch or interrupt check, see cpu_end_instruction). Returns the number of cycles the
+    instruction takes, or 0 if the bus refused an access or the instruction has to go through cpu_execute.
+*/
+static int cpu_execute_instruction(cpu_state* cpu, const cpu_bus* bus)
+{
+    cpu_state state = *cpu;
+    uint8_t  instruction = state.data;
+    uint8_t  cycles = 2;
+    uint8_t  page_cross = 0;
+    uint16_t address = 0;
+
+    switch (instruction)
     {
-        state.rw_mode = CPU_RW_MODE_NONE;
-        state.data = 0;
-        state.cycle = 0;
-        state.temp = 0xFE;
+        case IC_INX: _CPU_SET_REG_X(state, state.X + 1); break;
+        case IC_INY: _CPU_SET_REG_Y(state, state.Y + 1); break;
+        case IC_DEX: _CPU_SET_REG_X(state, state.X - 1); break;
+        case IC_DEY: _CPU_SET_REG_Y(state, state.Y - 1); break;
+        case IC_ROL_ACC: _CPU_ROL(state, state.A); break;
+        case IC_ROR_ACC: _CPU_ROR(state, state.A); break;
+        case IC_ASL_ACC: _CPU_ASL(state, state.A); break;
+        case IC_LSR_ACC: _CPU_LSR(state, state.A); break;
+        case IC_TAX: _CPU_SET_REG_X(state, state.A); break;
+        case IC_TAY: _CPU_SET_REG_Y(state, state.A); break;
+        case IC_TSX: _CPU_SET_REG_X(state, state.S); break;
+        case IC_TXA: _CPU_SET_REG_A(state, state.X); break;
+        case IC_TXS: _CPU_SET_REG_S(state, state.X); break;
+        case IC_TYA: _CPU_SET_REG_A(state, state.Y); break;
+        case IC_CLC: _CPU_SET_REG_P(state, state.P & 0xFE); break;
+        case IC_SEC: _CPU_SET_REG_P(state, state.P | 1); break;
+        case IC_CLI: _CPU_SET_REG_P(state, state.P & 0xFB); break;
+        case IC_SEI: _CPU_SET_REG_P(state, state.P | 0x04); break;
+        case IC_CLV: _CPU_SET_REG_P(state, state.P & 0xBF); break;
+        case IC_CLD: _CPU_SET_REG_P(state, state.P & 0xF7); break;
+        case IC_SED: _CPU_SET_REG_P(state, state.P | 0x08); break;
+        case IC_NOP:
+        case IC_IL_NOP_IMM0: case IC_IL_NOP_IMM1: case IC_IL_NOP_IMM2: case IC_IL_NOP_IMM3: case IC_IL_NOP_IMM4: case IC_IL_NOP_IMM5:
+            break;
+
+        case IC_PHP: _CPU_PUSH(state.P | CPU_STATUS_FLAG_BREAK); cycles = 3; break;
+        case IC_PHA: _CPU_PUSH(state.A); cycles = 3; break;
+
+        case IC_PLP:
+            _CPU_BUS_READ(state.PC); // Dummy read
+            _CPU_PULL();
+            _CPU_SET_REG_P(state, state.data & ~CPU_STATUS_FLAG_BREAK);
+            cycles = 4;
+            break;
+        case IC_PLA:
+            _CPU_BUS_READ(state.PC); // Dummy read
+            _CPU_PULL();
+            _CPU_SET_REG_A(state, state.data);
+            cycles = 4;
+            break;
+
+        case IC_JSR:
+            _CPU_FETCH_OPERAND();
+            state.temp = state.data;
+            _CPU_PUSH(state.PC >> 8);
+            _CPU_PUSH(state.PC & 0xFF);
+            _CPU_BUS_READ(state.PC);
+            state.PC = (state.data << 8) | state.temp;
+            cycles = 6;
+            break;
+        case IC_RTS:
+            _CPU_FETCH_OPERAND(); // Dummy read
+            _CPU_PULL();
+            state.temp = state.data;
+            _CPU_PULL();
+            state.PC = ((state.data << 8) | state.temp) + 1;
+            cycles = 6;
+            break;
+        case IC_RTI:
+            _CPU_FETCH_OPERAND(); // Dummy read
+            _CPU_PULL();
+            _CPU_SET_REG_P(state, state.data & ~CPU_STATUS_FLAG_BREAK);
+            _CPU_PULL();
+            state.temp = state.data;
+            _CPU_PULL();
+            state.PC = (state.data << 8) | state.temp;
+            cycles = 6;
+            break;
+        case IC_JMP:
+            _CPU_FETCH_OPERAND();
+            state.temp = state.data;
+            _CPU_FETCH_OPERAND();
+            state.PC = (state.data << 8) | state.temp;
+            cycles = 3;
+            break;
+        case IC_JMP_IND:
+            _CPU_ADDR_ABS();
+            _CPU_BUS_READ(address);
+            state.temp = state.data;
+            _CPU_BUS_READ((address & 0xFF00) | ((address + 1) & 0x00FF));
+            state.PC = (state.data << 8) | state.temp;
+            cycles = 5;
+            break;
+
+        case IC_BCC: _CPU_BRANCH((state.P & 0x01) == 0); break;
+        case IC_BCS: _CPU_BRANCH((state.P & 0x01)); break;
+        case IC_BNE: _CPU_BRANCH((state.P & 0x02) == 0); break;
+        case IC_BEQ: _CPU_BRANCH((state.P & 0x02)); break;
+        case IC_BVC: _CPU_BRANCH((state.P & 0x40) == 0); break;
+        case IC_BVS: _CPU_BRANCH((state.P & 0x40)); break;
+        case IC_BPL: _CPU_BRANCH((state.P & 0x80) == 0); break;
+        case IC_BMI: _CPU_BRANCH((state.P & 0x80)); break;
+
+        case IC_BIT_ZP:  _CPU_READ_ZP(_CPU_BIT(state)); break;
+        case IC_BIT_ABS: _CPU_READ_ABS(_CPU_BIT(state)); break;
+
+        case IC_LDA_IMM:    _CPU_READ_IMM(_CPU_SET_REG_A(state, state.data)); break;
+        case IC_LDA_ZP:     _CPU_READ_ZP(_CPU_SET_REG_A(state, state.data)); break;
+        case IC_LDA_ZP_X:   _CPU_LOAD_ZP_INDEXED(state.X, _CPU_SET_REG_A(state, state.data)); break;
+        case IC_LDA_ABS:    _CPU_READ_ABS(_CPU_SET_REG_A(state, state.data)); break;
+        case IC_LDA_ABS_X:  _CPU_READ_ABS_INDEXED(state.X, _CPU_SET_REG_A(state, state.data)); break;
+        case IC_LDA_ABS_Y:  _CPU_READ_ABS_INDEXED(state.Y, _CPU_SET_REG_A(state, state.data)); break;
+        case IC_LDA_IND_X:  _CPU_READ_IND_X(_CPU_SET_REG_A(state, state.data)); break;
+        case IC_LDA_IND_Y:  _CPU_READ_IND_Y(_CPU_SET_REG_A(state, state.data)); break;
+
+        case IC_LDX_IMM:    _CPU_READ_IMM(_CPU_SET_REG_X(state, state.data)); break;
+        case IC_LDX_ZP:     _CPU_READ_ZP(_CPU_SET_REG_X(state, state.data)); break;
+        case IC_LDX_ZP_Y:   _CPU_LOAD_ZP_INDEXED(state.Y, _CPU_SET_REG_X(state, state.data)); break;
+        case IC_LDX_ABS:    _CPU_READ_ABS(_CPU_SET_REG_X(state, state.data)); break;
+        case IC_LDX_ABS_Y:  _CPU_READ_ABS_INDEXED(state.Y, _CPU_SET_REG_X(state, state.data)); break;
+
+        case IC_LDY_IMM:    _CPU_READ_IMM(_CPU_SET_REG_Y(state, state.data)); break;
+        case IC_LDY_ZP:     _CPU_READ_ZP(_CPU_SET_REG_Y(state, state.data)); break;
+        case IC_LDY_ZP_X:   _CPU_LOAD_ZP_INDEXED(state.X, _CPU_SET_REG_Y(state, state.data)); break;
+        case IC_LDY_ABS:    _CPU_READ_ABS(_CPU_SET_REG_Y(state, state.data)); break;
+        case IC_LDY_ABS_X:  _CPU_READ_ABS_INDEXED(state.X, _CPU_SET_REG_Y(state, state.data)); break;
+
+        case IC_IL_LAX_IMM:   _CPU_READ_IMM(_CPU_LAX(state)); break;
+        case IC_IL_LAX_ZP:    _CPU_READ_ZP(_CPU_LAX(state)); break;
+        case IC_IL_LAX_ZP_Y:  _CPU_LOAD_ZP_INDEXED(state.Y, _CPU_LAX(state)); break;
+        case IC_IL_LAX_ABS:   _CPU_READ_ABS(_CPU_LAX(state)); break;
+        case IC_IL_LAX_ABS_Y: _CPU_READ_ABS_INDEXED(state.Y, _CPU_LAX(state)); break;
+        case IC_IL_LAX_IND_X: _CPU_READ_IND_X(_CPU_LAX(state)); break;
+        case IC_IL_LAX_IND_Y: _CPU_READ_IND_Y(_CPU_LAX(state)); break;
+
+        case IC_ADC_IMM:    _CPU_READ_IMM(_CPU_ADC(state)); break;
+        case IC_ADC_ZP:     _CPU_READ_ZP(_CPU_ADC(state)); break;
+        case IC_ADC_ZP_X:   _CPU_READ_ZP_INDEXED(state.X, _CPU_ADC(state)); break;
+        case IC_ADC_ABS:    _CPU_READ_ABS(_CPU_ADC(state)); break;
+        case IC_ADC_ABS_X:  _CPU_READ_ABS_INDEXED(state.X, _CPU_ADC(state)); break;
+        case IC_ADC_ABS_Y:  _CPU_READ_ABS_INDEXED(state.Y, _CPU_ADC(state)); break;
+        case IC_ADC_IND_X:  _CPU_READ_IND_X(_CPU_ADC(state)); break;
+        case IC_ADC_IND_Y:  _CPU_READ_IND_Y(_CPU_ADC(state)); break;
+
+        case IC_IL_SBC_IMM:
+        case IC_SBC_IMM:    _CPU_READ_IMM(_CPU_SBC(state)); break;
+        case IC_SBC_ZP:     _CPU_READ_ZP(_CPU_SBC(state)); break;
+        case IC_SBC_ZP_X:   _CPU_READ_ZP_INDEXED(state.X, _CPU_SBC(state)); break;
+        case IC_SBC_ABS:    _CPU_READ_ABS(_CPU_SBC(state)); break;
+        case IC_SBC_ABS_X:  _CPU_READ_ABS_INDEXED(state.X, _CPU_SBC(state)); break;
+        case IC_SBC_ABS_Y:  _CPU_READ_ABS_INDEXED(state.Y, _CPU_SBC(state)); break;
+        case IC_SBC_IND_X:  _CPU_READ_IND_X(_CPU_SBC(state)); break;
+        case IC_SBC_IND_Y:  _CPU_READ_IND_Y(_CPU_SBC(state)); break;
+
+        case IC_CMP_IMM:    _CPU_READ_IMM(_CPU_CMP(state, state.A)); break;
+        case IC_CMP_ZP:     _CPU_READ_ZP(_CPU_CMP(state, state.A)); break;
+        case IC_CMP_ZP_X:   _CPU_READ_ZP_INDEXED(state.X, _CPU_CMP(state, state.A)); break;
+        case IC_CMP_ABS:    _CPU_READ_ABS(_CPU_CMP(state, state.A)); break;
+        case IC_CMP_ABS_X:  _CPU_READ_ABS_INDEXED(state.X, _CPU_CMP(state, state.A)); break;
+        case IC_CMP_ABS_Y:  _CPU_READ_ABS_INDEXED(state.Y, _CPU_CMP(state, state.A)); break;
+        case IC_CMP_IND_X:  _CPU_READ_IND_X(_CPU_CMP(state, state.A)); break;
+        case IC_CMP_IND_Y:  _CPU_READ_IND_Y(_CPU_CMP(state, state.A)); break;
+
+        case IC_CPX_IMM:    _CPU_READ_IMM(_CPU_CMP(state, state.X)); break;
+        case IC_CPX_ZP:     _CPU_READ_ZP(_CPU_CMP(state, state.X)); break;
+        case IC_CPX_ABS:    _CPU_READ_ABS(_CPU_CMP(state, state.X)); break;
+        case IC_CPY_IMM:    _CPU_READ_IMM(_CPU_CMP(state, state.Y)); break;
+        case IC_CPY_ZP:     _CPU_READ_ZP(_CPU_CMP(state, state.Y)); break;
+        case IC_CPY_ABS:    _CPU_READ_ABS(_CPU_CMP(state, state.Y)); break;
+
+        case IC_AND_IMM:    _CPU_READ_IMM(_CPU_SET_REG_A(state, state.A & state.data)); break;
+        case IC_AND_ZP:     _CPU_READ_ZP(_CPU_SET_REG_A(state, state.A & state.data)); break;
+        case IC_AND_ZP_X:   _CPU_READ_ZP_INDEXED(state.X, _CPU_SET_REG_A(state, state.A & state.data)); break;
+        case IC_AND_ABS:    _CPU_READ_ABS(_CPU_SET_REG_A(state, state.A & state.data)); break;
+        case IC_AND_ABS_X:  _CPU_READ_ABS_INDEXED(state.X, _CPU_SET_REG_A(state, state.A & state.data)); break;
+        case IC_AND_ABS_Y:  _CPU_READ_ABS_INDEXED(state.Y, _CPU_SET_REG_A(state, state.A & state.data)); break;
+        case IC_AND_IND_X:  _CPU_READ_IND_X(_CPU_SET_REG_A(state, state.A & state.data)); break;
+        case IC_AND_IND_Y:  _CPU_READ_IND_Y(_CPU_SET_REG_A(state, state.A & state.data)); break;
+
+        case IC_ORA_IMM:    _CPU_READ_IMM(_CPU_SET_REG_A(state, state.A | state.data)); break;
+        case IC_ORA_ZP:     _CPU_READ_ZP(_CPU_SET_REG_A(state, state.A | state.data)); break;
+        case IC_ORA_ZP_X:   _CPU_READ_ZP_INDEXED(state.X, _CPU_SET_REG_A(state, state.A | state.data)); break;
+        case IC_ORA_ABS:    _CPU_READ_ABS(_CPU_SET_REG_A(state, state.A | state.data)); break;
+        case IC_ORA_ABS_X:  _CPU_READ_ABS_INDEXED(state.X, _CPU_SET_REG_A(state, state.A | state.data)); break;
+        case IC_ORA_ABS_Y:  _CPU_READ_ABS_INDEXED(state.Y, _CPU_SET_REG_A(state, state.A | state.data)); break;
+        case IC_ORA_IND_X:  _CPU_READ_IND_X(_CPU_SET_REG_A(state, state.A | state.data)); break;
+        case IC_ORA_IND_Y:  _CPU_READ_IND_Y(_CPU_SET_REG_A(state, state.A | state.data)); break;
+
+        case IC_EOR_IMM:    _CPU_READ_IMM(_CPU_SET_REG_A(state, state.A ^ state.data)); break;
+        case IC_EOR_ZP:     _CPU_READ_ZP(_CPU_SET_REG_A(state, state.A ^ state.data)); break;
+        case IC_EOR_ZP_X:   _CPU_READ_ZP_INDEXED(state.X, _CPU_SET_REG_A(state, state.A ^ state.data)); break;
+        case IC_EOR_ABS:    _CPU_READ_ABS(_CPU_SET_REG_A(state, state.A ^ state.data)); break;
+        case IC_EOR_ABS_X:  _CPU_READ_ABS_INDEXED(state.X, _CPU_SET_REG_A(state, state.A ^ state.data)); break;
+        case IC_EOR_ABS_Y:  _CPU_READ_ABS_INDEXED(state.Y, _CPU_SET_REG_A(state, state.A ^ state.data)); break;
+        case IC_EOR_IND_X:  _CPU_READ_IND_X(_CPU_SET_REG_A(state, state.A ^ state.data)); break;
+        case IC_EOR_IND_Y:  _CPU_READ_IND_Y(_CPU_SET_REG_A(state, state.A ^ state.data)); break;
+
+        case IC_IL_ANC_IMM:
+        case IC_IL_AAC_IMM:   _CPU_READ_IMM(_CPU_ANC(state)); break;
+        case IC_IL_ALR_IMM:   _CPU_READ_IMM(_CPU_ALR(state)); break;
+        case IC_IL_ARR_IMM:   _CPU_READ_IMM(_CPU_ARR(state)); break;
+        case IC_IL_AXS_IMM:   _CPU_READ_IMM(_CPU_AXS(state)); break;
+        case IC_IL_XAA_IMM:   _CPU_READ_IMM(_CPU_XAA(state)); break;
+        case IC_IL_LAS_ABS_Y: _CPU_READ_ABS_INDEXED(state.Y, _CPU_LAS(state)); break;
+
+        case IC_IL_NOP_IMP0: case IC_IL_NOP_IMP1: case IC_IL_NOP_IMP2: case IC_IL_NOP_IMP3: case IC_IL_NOP_IMP4:
+            _CPU_READ_IMM((void)0);
+            break;
+        case IC_IL_NOP_ZP0: case IC_IL_NOP_ZP1: case IC_IL_NOP_ZP2:
+            _CPU_READ_ZP((void)0);
+            break;
+        case IC_IL_NOP_ZP_X0: case IC_IL_NOP_ZP_X1: case IC_IL_NOP_ZP_X2: case IC_IL_NOP_ZP_X3: case IC_IL_NOP_ZP_X4: case IC_IL_NOP_ZP_X5:
+            _CPU_READ_ZP_INDEXED(state.X, (void)0);
+            break;
+        case IC_IL_NOP_ABS:
+            _CPU_READ_ABS((void)0);
+            break;
+        case IC_IL_NOP_ABS_X0: case IC_IL_NOP_ABS_X1: case IC_IL_NOP_ABS_X2: case IC_IL_NOP_ABS_X3: case IC_IL_NOP_ABS_X4: case IC_IL_NOP_ABS_X5:
+            _CPU_READ_ABS_INDEXED(state.X, (void)0);
+            break;
+
+        case IC_STA_ZP:     _CPU_WRITE_ZP(state.A); break;
+        case IC_STA_ZP_X:   _CPU_WRITE_ZP_INDEXED(state.X, state.A); break;
+        case IC_STA_ABS:    _CPU_WRITE_ABS(state.A); break;
+        case IC_STA_ABS_X:  _CPU_WRITE_ABS_INDEXED(state.X, state.A); break;
+        case IC_STA_ABS_Y:  _CPU_WRITE_ABS_INDEXED(state.Y, state.A); break;
+        case IC_STA_IND_X:  _CPU_WRITE_IND_X(state.A); break;
+        case IC_STA_IND_Y:  _CPU_WRITE_IND_Y(state.A); break;
+        case IC_STX_ZP:     _CPU_WRITE_ZP(state.X); break;
+        case IC_STX_ZP_Y:   _CPU_WRITE_ZP_INDEXED(state.Y, state.X); break;
+        case IC_STX_ABS:    _CPU_WRITE_ABS(state.X); break;
+        case IC_STY_ZP:     _CPU_WRITE_ZP(state.Y); break;
+        case IC_STY_ZP_X:   _CPU_WRITE_ZP_INDEXED(state.X, state.Y); break;
+        case IC_STY_ABS:    _CPU_WRITE_ABS(state.Y); break;
+
+        case IC_IL_SAX_ZP:    _CPU_WRITE_ZP(state.A & state.X); break;
+        case IC_IL_SAX_ABS:   _CPU_WRITE_ABS(state.A & state.X); break;
+        case IC_IL_SAX_IND_X: _CPU_WRITE_IND_X(state.A & state.X); break;
+        case IC_IL_SAX_ZP_Y:
+            _CPU_WRITE_ZP_INDEXED(state.Y, state.A & state.X);
+            _CPU_BUS_WRITE(address);
+            break;
+
+        case IC_IL_SHY_ABS_X: _CPU_ADDR_ABS_INDEXED(state.X); _CPU_STORE_HIGH_AND(state.Y, 5); break;
+        case IC_IL_SHX_ABS_Y: _CPU_ADDR_ABS_INDEXED(state.Y); _CPU_STORE_HIGH_AND(state.X, 5); break;
+        case IC_IL_SHA_ABS_Y: _CPU_ADDR_ABS_INDEXED(state.Y); _CPU_STORE_HIGH_AND(state.A & state.X, 5); break;
+        case IC_IL_SHA_IND_Y: _CPU_ADDR_IND_Y(); _CPU_STORE_HIGH_AND(state.A & state.X, 6); break;
+        case IC_IL_TAS_ABS_Y:
+            _CPU_ADDR_ABS_INDEXED(state.Y);
+            state.S = state.A & state.X;
+            _CPU_STORE_HIGH_AND(state.S, 5);
+            break;
+
+        case IC_ROL_ZP:     _CPU_MODIFY_ZP(_CPU_ROL(state, state.data)); break;
+        case IC_ROL_ZP_X:   _CPU_MODIFY_ZP_INDEXED(state.X, _CPU_ROL(state, state.data)); break;
+        case IC_ROL_ABS:    _CPU_MODIFY_ABS(_CPU_ROL(state, state.data)); break;
+        case IC_ROL_ABS_X:  _CPU_MODIFY_ABS_INDEXED(state.X, _CPU_ROL(state, state.data)); break;
+        case IC_ROR_ZP:     _CPU_MODIFY_ZP(_CPU_ROR(state, state.data)); break;
+        case IC_ROR_ZP_X:   _CPU_MODIFY_ZP_INDEXED(state.X, _CPU_ROR(state, state.data)); break;
+        case IC_ROR_ABS:    _CPU_MODIFY_ABS(_CPU_ROR(state, state.data)); break;
+        case IC_ROR_ABS_X:  _CPU_MODIFY_ABS_INDEXED(state.X, _CPU_ROR(state, state.data)); break;
+        case IC_ASL_ZP:     _CPU_MODIFY_ZP(_CPU_ASL(state, state.data)); break;
+        case IC_ASL_ZP_X:   _CPU_MODIFY_ZP_INDEXED(state.X, _CPU_ASL(state, state.data)); break;
+        case IC_ASL_ABS:    _CPU_MODIFY_ABS(_CPU_ASL(state, state.data)); break;
+        case IC_ASL_ABS_X:  _CPU_MODIFY_ABS_INDEXED(state.X, _CPU_ASL(state, state.data)); break;
+        case IC_LSR_ZP:     _CPU_MODIFY_ZP(_CPU_LSR(state, state.data)); break;
+        case IC_LSR_ZP_X:   _CPU_MODIFY_ZP_INDEXED(state.X, _CPU_LSR(state, state.data)); break;
+        case IC_LSR_ABS:    _CPU_MODIFY_ABS(_CPU_LSR(state, state.data)); break;
+        case IC_LSR_ABS_X:  _CPU_MODIFY_ABS_INDEXED(state.X, _CPU_LSR(state, state.data)); break;
+        case IC_DEC_ZP:     _CPU_MODIFY_ZP(_CPU_DEC(state)); break;
+        case IC_DEC_ZP_X:   _CPU_MODIFY_ZP_INDEXED(state.X, _CPU_DEC(state)); break;
+        case IC_DEC_ABS:    _CPU_MODIFY_ABS(_CPU_DEC(state)); break;
+        case IC_DEC_ABS_X:  _CPU_MODIFY_ABS_INDEXED(state.X, _CPU_DEC(state)); break;
+        case IC_INC_ZP:     _CPU_MODIFY_ZP(_CPU_INC(state)); break;
+        case IC_INC_ZP_X:   _CPU_MODIFY_ZP_INDEXED(state.X, _CPU_INC(state)); break;
+        case IC_INC_ABS:    _CPU_MODIFY_ABS(_CPU_INC(state)); break;
+        case IC_INC_ABS_X:  _CPU_MODIFY_ABS_INDEXED(state.X, _CPU_INC(state)); break;
+
+        case IC_IL_DCP_ZP:    _CPU_MODIFY_ZP(_CPU_DCP(state)); break;
+        case IC_IL_DCP_ZP_X:  _CPU_MODIFY_ZP_INDEXED(state.X, _CPU_DCP(state)); break;
+        case IC_IL_DCP_ABS:   _CPU_MODIFY_ABS(_CPU_DCP(state)); break;
+        case IC_IL_DCP_ABS_X: _CPU_MODIFY_ABS_INDEXED(state.X, _CPU_DCP(state)); break;
+        case IC_IL_DCP_ABS_Y: _CPU_MODIFY_ABS_INDEXED(state.Y, _CPU_DCP(state)); break;
+        case IC_IL_DCP_IND_X: _CPU_MODIFY_IND_X(_CPU_DCP(state)); break;
+        case IC_IL_DCP_IND_Y: _CPU_MODIFY_IND_Y(_CPU_DCP(state)); break;
+        case IC_IL_ISB_ZP:    _CPU_MODIFY_ZP(_CPU_ISB(state)); break;
+        case IC_IL_ISB_ZP_X:  _CPU_MODIFY_ZP_INDEXED(state.X, _CPU_ISB(state)); break;
+        case IC_IL_ISB_ABS:   _CPU_MODIFY_ABS(_CPU_ISB(state)); break;
+        case IC_IL_ISB_ABS_X: _CPU_MODIFY_ABS_INDEXED(state.X, _CPU_ISB(state)); break;
+        case IC_IL_ISB_ABS_Y: _CPU_MODIFY_ABS_INDEXED(state.Y, _CPU_ISB(state)); break;
+        case IC_IL_ISB_IND_X: _CPU_MODIFY_IND_X(_CPU_ISB(state)); break;
+        case IC_IL_ISB_IND_Y: _CPU_MODIFY_IND_Y(_CPU_ISB(state)); break;
+        case IC_IL_SLO_ZP:    _CPU_MODIFY_ZP(_CPU_SLO(state)); break;
+        case IC_IL_SLO_ZP_X:  _CPU_MODIFY_ZP_INDEXED(state.X, _CPU_SLO(state)); break;
+        case IC_IL_SLO_ABS:   _CPU_MODIFY_ABS(_CPU_SLO(state)); break;
+        case IC_IL_SLO_ABS_X: _CPU_MODIFY_ABS_INDEXED(state.X, _CPU_SLO(state)); break;
+        case IC_IL_SLO_ABS_Y: _CPU_MODIFY_ABS_INDEXED(state.Y, _CPU_SLO(state)); break;
+        case IC_IL_SLO_IND_X: _CPU_MODIFY_IND_X(_CPU_SLO(state)); break;
+        case IC_IL_SLO_IND_Y: _CPU_MODIFY_IND_Y(_CPU_SLO(state)); break;
+        case IC_IL_RLA_ZP:    _CPU_MODIFY_ZP(_CPU_RLA(state)); break;
+        case IC_IL_RLA_ZP_X:  _CPU_MODIFY_ZP_INDEXED(state.X, _CPU_RLA(state)); break;
+        case IC_IL_RLA_ABS:   _CPU_MODIFY_ABS(_CPU_RLA(state)); break;
+        case IC_IL_RLA_ABS_X: _CPU_MODIFY_ABS_INDEXED(state.X, _CPU_RLA(state)); break;
+        case IC_IL_RLA_ABS_Y: _CPU_MODIFY_ABS_INDEXED(state.Y, _CPU_RLA(state)); break;
+        case IC_IL_RLA_IND_X: _CPU_MODIFY_IND_X(_CPU_RLA(state)); break;
+        case IC_IL_RLA_IND_Y: _CPU_MODIFY_IND_Y(_CPU_RLA(state)); break;
+        case IC_IL_SRE_ZP:    _CPU_MODIFY_ZP(_CPU_SRE(state)); break;
+        case IC_IL_SRE_ZP_X:  _CPU_MODIFY_ZP_INDEXED(state.X, _CPU_SRE(state)); break;
+        case IC_IL_SRE_ABS:   _CPU_MODIFY_ABS(_CPU_SRE(state)); break;
+        case IC_IL_SRE_ABS_X: _CPU_MODIFY_ABS_INDEXED(state.X, _CPU_SRE(state)); break;
+        case IC_IL_SRE_ABS_Y: _CPU_MODIFY_ABS_INDEXED(state.Y, _CPU_SRE(state)); break;
+        case IC_IL_SRE_IND_X: _CPU_MODIFY_IND_X(_CPU_SRE(state)); break;
+        case IC_IL_SRE_IND_Y: _CPU_MODIFY_IND_Y(_CPU_SRE(state)); break;
+        case IC_IL_RRA_ZP:    _CPU_MODIFY_ZP(_CPU_RRA(state)); break;
+        case IC_IL_RRA_ZP_X:  _CPU_MODIFY_ZP_INDEXED(state.X, _CPU_RRA(state)); break;
+        case IC_IL_RRA_ABS:   _CPU_MODIFY_ABS(_CPU_RRA(state)); break;
+        case IC_IL_RRA_ABS_X: _CPU_MODIFY_ABS_INDEXED(state.X, _CPU_RRA(state)); break;
+        case IC_IL_RRA_ABS_Y: _CPU_MODIFY_ABS_INDEXED(state.Y, _CPU_RRA(state)); break;
+        case IC_IL_RRA_IND_X: _CPU_MODIFY_IND_X(_CPU_RRA(state)); break;
+        case IC_IL_RRA_IND_Y: _CPU_MODIFY_IND_Y(_CPU_RRA(state)); break;
+
+        default:
+            // BRK and unknown instructions
+            return 0;
     }
-    else
+
+    state.halted = 0;
+    state.cycle = (instruction << 8) | cycles;
+    *cpu = state;
+
+    return cycles;
+}
+
+/*
+    Completes an instruction run by cpu_execute_instruction: replays the interrupt polling cpu_execute does on every
+    cycle and performs the final cycle, which either fetches the next opcode or starts the interrupt sequence.
+    start_p is the status register before the instruction, bit n of irq_lines/nmi_lines is the input on cycle n.
+*/
+static cpu_state cpu_end_instruction(cpu_state state, uint8_t start_p, uint8_t irq_lines, uint8_t nmi_lines)
+{
+    uint8_t instruction = _CPU_GET_INSTRUCTION(state);
+    int     cycles = _CPU_GET_CYCLE(state);
+
+    // First cycle that polls with the updated interrupt disable flag
+    int p_cycle = (instruction == IC_PLP || instruction == IC_RTI) ? 3 : 1;
+    int branch_taken = ((instruction & 0x1F) == 0x10) && cycles > 2;
+
+    int irq_phase1 = 0;
+    int nmi_phase1 = 0;
+
+    for (int cycle = 0; cycle < cycles; ++cycle)
     {
-        state.rw_mode = CPU_RW_MODE_READ;
-        state.address = state.PC++;
-        state.cycle = 0;
-        state.temp = 0;
+        uint8_t P = (cycle < p_cycle) ? start_p : state.P;
+
+        irq_phase1 = state.irq_phase0;
+        state.irq_phase0 = ((irq_lines >> cycle) & 1) && !(P & CPU_STATUS_FLAG_IRQDISABLE);
+
+        nmi_phase1 = state.nmi_phase0;
+        if (state.nmi_phase0 == 0 && ((nmi_lines >> cycle) & 1))
+            state.nmi_phase0 = 1;
+
+        if (cycle == 1 && branch_taken && state.irq_phase0 && !irq_phase1)
+            state.irq_phase0 = 0;
     }
 
+    _CPU_END_INSTRUCTION(state, nmi_phase1 || irq_phase1);
+
     return state;
 }
 
@@ -283,4 +283,18 @@
 #define IC_IL_SHA_ABS_Y      0x9F
 #define IC_IL_TAS_ABS_Y      0x9B
 
+// Halt the real CPU, executed as 2 cycle NOPs
+#define IC_IL_JAM0           0x02
+#define IC_IL_JAM1           0x12
+#define IC_IL_JAM2           0x22
+#define IC_IL_JAM3           0x32
+#define IC_IL_JAM4           0x42
+#define IC_IL_JAM5           0x52
+#define IC_IL_JAM6           0x62
+#define IC_IL_JAM7           0x72
+#define IC_IL_JAM8           0x92
+#define IC_IL_JAM9           0xB2
+#define IC_IL_JAM10          0xD2
+#define IC_IL_JAM11          0xF2
+
 #endif
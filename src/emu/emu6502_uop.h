@@ -0,0 +1,536 @@
+#ifndef _EMU6502_UOP_H_
+#define _EMU6502_UOP_H_
+
+#include "emu6502.h"
+
+/*
+    Table-driven core
+
+    Same bus behaviour as cpu_execute, one call per CPU cycle, but updates the state in place. Instead of testing the
+    cycle number and switching over the opcode on every call, each opcode is described once by the sequence of micro-ops
+    it performs on cycles 0-7 (addressing steps followed by the operation), and a call runs the single micro-op for the
+    current cycle, touching only the registers that micro-op uses.
+*/
+
+#define _CPU_ALU_LDA    _CPU_SET_REG_A((*cpu), cpu->data)
+#define _CPU_ALU_LDX    _CPU_SET_REG_X((*cpu), cpu->data)
+#define _CPU_ALU_LDY    _CPU_SET_REG_Y((*cpu), cpu->data)
+#define _CPU_ALU_LAX    _CPU_LAX((*cpu))
+#define _CPU_ALU_ADC    _CPU_ADC((*cpu))
+#define _CPU_ALU_SBC    _CPU_SBC((*cpu))
+#define _CPU_ALU_CMP    _CPU_CMP((*cpu), cpu->A)
+#define _CPU_ALU_CPX    _CPU_CMP((*cpu), cpu->X)
+#define _CPU_ALU_CPY    _CPU_CMP((*cpu), cpu->Y)
+#define _CPU_ALU_AND    _CPU_SET_REG_A((*cpu), cpu->A & cpu->data)
+#define _CPU_ALU_ORA    _CPU_SET_REG_A((*cpu), cpu->A | cpu->data)
+#define _CPU_ALU_EOR    _CPU_SET_REG_A((*cpu), cpu->A ^ cpu->data)
+#define _CPU_ALU_BIT    _CPU_BIT((*cpu))
+#define _CPU_ALU_ANC    _CPU_ANC((*cpu))
+#define _CPU_ALU_ALR    _CPU_ALR((*cpu))
+#define _CPU_ALU_ARR    _CPU_ARR((*cpu))
+#define _CPU_ALU_AXS    _CPU_AXS((*cpu))
+#define _CPU_ALU_XAA    _CPU_XAA((*cpu))
+#define _CPU_ALU_LAS    _CPU_LAS((*cpu))
+#define _CPU_ALU_NOP
+
+#define _CPU_RMW_ROL    _CPU_ROL((*cpu), cpu->data)
+#define _CPU_RMW_ROR    _CPU_ROR((*cpu), cpu->data)
+#define _CPU_RMW_DEC    _CPU_DEC((*cpu))
+#define _CPU_RMW_INC    _CPU_INC((*cpu))
+#define _CPU_RMW_ASL    _CPU_ASL((*cpu), cpu->data)
+#define _CPU_RMW_LSR    _CPU_LSR((*cpu), cpu->data)
+#define _CPU_RMW_DCP    _CPU_DCP((*cpu))
+#define _CPU_RMW_ISB    _CPU_ISB((*cpu))
+#define _CPU_RMW_SLO    _CPU_SLO((*cpu))
+#define _CPU_RMW_RLA    _CPU_RLA((*cpu))
+#define _CPU_RMW_SRE    _CPU_SRE((*cpu))
+#define _CPU_RMW_RRA    _CPU_RRA((*cpu))
+
+#define _CPU_ALU_OPS(M, X) \
+    M(X, LDA) M(X, LDX) M(X, LDY) M(X, LAX) M(X, ADC) M(X, SBC) M(X, CMP) M(X, CPX) M(X, CPY) M(X, AND) \
+    M(X, ORA) M(X, EOR) M(X, BIT) M(X, ANC) M(X, ALR) M(X, ARR) M(X, AXS) M(X, XAA) M(X, LAS) M(X, NOP)
+
+#define _CPU_RMW_OPS(M, X) \
+    M(X, ROL) M(X, ROR) M(X, DEC) M(X, INC) M(X, ASL) M(X, LSR) M(X, DCP) M(X, ISB) M(X, SLO) M(X, RLA) \
+    M(X, SRE) M(X, RRA)
+
+// Every ALU op comes as: op and end, page-cross check then op and end, op and keep the bus access, op on an idle cycle
+#define _CPU_UOP_ALU_NAMES(X, op)   X(op##_END) X(op##_PX) X(op##_RET) X(op##_IDLE)
+#define _CPU_UOP_RMW_NAMES(X, op)   X(op)
+
+#define _CPU_UOPS(X) \
+    X(END) X(IDLE) X(NOP) X(FETCH) \
+    X(INX) X(INY) X(DEX) X(DEY) X(ROL_A) X(ROR_A) X(ASL_A) X(LSR_A) X(TAX) X(TAY) X(TSX) X(TXA) X(TXS) X(TYA) \
+    X(CLC) X(SEC) X(CLI) X(SEI) X(CLV) X(CLD) X(SED) \
+    X(PHP) X(PHA) X(PULL_DUMMY) X(PULL) X(PULL_TEMP) X(PLA) X(PLP) X(RTI) X(RTS_PC) X(RTI_PC) \
+    X(BRK0) X(BRK1) X(BRK2) X(BRK3) X(BRK4) X(BRK5) X(BRK6) \
+    X(JSR1) X(JSR2) X(JSR3) X(JSR4) X(JSR5) X(JMP) X(JMP_IND_HI) X(JMP_IND) \
+    X(BRANCH) X(BRANCH_TAKEN) \
+    X(ZP_READ) X(ZPX_READ) X(ZPY_READ) X(ABS_HI) X(ABS_READ) X(ABSX_READ) X(ABSY_READ) X(PTR_HI) X(FIX_READ) \
+    X(DUMMY_WRITE) \
+    X(ST_ZP_A) X(ST_ZP_X) X(ST_ZP_Y) X(ST_ZP_AX) X(ST_ZPX_A) X(ST_ZPX_Y) X(ST_ZPY_X) X(ST_ZPY_AX) \
+    X(ST_ABS_A) X(ST_ABS_X) X(ST_ABS_Y) X(ST_ABS_AX) X(ST_FIX_A) \
+    X(SHY) X(SHX) X(SHA) X(TAS) \
+    _CPU_ALU_OPS(_CPU_UOP_ALU_NAMES, X) \
+    _CPU_RMW_OPS(_CPU_UOP_RMW_NAMES, X)
+
+#define _CPU_UOP_ENUM(name) CPU_UOP_##name,
+
+enum cpu_uop
+{
+    _CPU_UOPS(_CPU_UOP_ENUM)
+    CPU_UOP_COUNT   // Must stay below 256, table entries are bytes
+};
+
+#define _U(name) CPU_UOP_##name
+
+#define _CPU_UOPS_IMPLIED(op)       { _U(op), _U(END) }
+#define _CPU_UOPS_PUSH(op)          { _U(op), _U(IDLE), _U(END) }
+#define _CPU_UOPS_PULL(op)          { _U(PULL_DUMMY), _U(PULL), _U(op), _U(END) }
+#define _CPU_UOPS_BRANCH            { _U(FETCH), _U(BRANCH), _U(BRANCH_TAKEN), _U(END) }
+
+#define _CPU_UOPS_READ_IMM(op)      { _U(FETCH), _U(op##_END) }
+#define _CPU_UOPS_READ_ZP(op)       { _U(FETCH), _U(ZP_READ), _U(op##_END) }
+#define _CPU_UOPS_READ_ZP_X(op)     { _U(FETCH), _U(ZPX_READ), _U(IDLE), _U(op##_END) }
+#define _CPU_UOPS_LOAD_ZP_X(op)     { _U(FETCH), _U(ZPX_READ), _U(op##_RET), _U(END) }
+#define _CPU_UOPS_LOAD_ZP_Y(op)     { _U(FETCH), _U(ZPY_READ), _U(op##_RET), _U(END) }
+#define _CPU_UOPS_READ_ABS(op)      { _U(FETCH), _U(ABS_HI), _U(ABS_READ), _U(op##_END) }
+#define _CPU_UOPS_READ_ABS_X(op)    { _U(FETCH), _U(ABS_HI), _U(ABSX_READ), _U(op##_PX), _U(op##_END) }
+#define _CPU_UOPS_READ_ABS_Y(op)    { _U(FETCH), _U(ABS_HI), _U(ABSY_READ), _U(op##_PX), _U(op##_END) }
+#define _CPU_UOPS_READ_IND_X(op)    { _U(FETCH), _U(ZPX_READ), _U(PTR_HI), _U(ABS_READ), _U(op##_IDLE), _U(END) }
+#define _CPU_UOPS_READ_IND_Y(op)    { _U(FETCH), _U(ZP_READ), _U(PTR_HI), _U(ABSY_READ), _U(op##_PX), _U(op##_END) }
+
+#define _CPU_UOPS_WRITE_ZP(v)       { _U(FETCH), _U(ST_ZP_##v), _U(END) }
+#define _CPU_UOPS_WRITE_ZP_X(v)     { _U(FETCH), _U(ST_ZPX_##v), _U(IDLE), _U(END) }
+#define _CPU_UOPS_WRITE_ZP_Y(v)     { _U(FETCH), _U(ST_ZPY_##v), _U(IDLE), _U(END) }
+#define _CPU_UOPS_WRITE_ABS(v)      { _U(FETCH), _U(ABS_HI), _U(ST_ABS_##v), _U(END) }
+#define _CPU_UOPS_WRITE_ABS_X(op)   { _U(FETCH), _U(ABS_HI), _U(ABSX_READ), _U(op), _U(END) }
+#define _CPU_UOPS_WRITE_ABS_Y(op)   { _U(FETCH), _U(ABS_HI), _U(ABSY_READ), _U(op), _U(END) }
+#define _CPU_UOPS_WRITE_IND_X(v)    { _U(FETCH), _U(ZPX_READ), _U(PTR_HI), _U(ST_ABS_##v), _U(IDLE), _U(END) }
+#define _CPU_UOPS_WRITE_IND_Y(op)   { _U(FETCH), _U(ZP_READ), _U(PTR_HI), _U(ABSY_READ), _U(op), _U(END) }
+
+#define _CPU_UOPS_MODIFY_ZP(op)     { _U(FETCH), _U(ZP_READ), _U(DUMMY_WRITE), _U(op), _U(END) }
+#define _CPU_UOPS_MODIFY_ZP_X(op)   { _U(FETCH), _U(ZPX_READ), _U(DUMMY_WRITE), _U(op), _U(IDLE), _U(END) }
+#define _CPU_UOPS_MODIFY_ABS(op)    { _U(FETCH), _U(ABS_HI), _U(ABS_READ), _U(DUMMY_WRITE), _U(op), _U(END) }
+#define _CPU_UOPS_MODIFY_ABS_X(op)  { _U(FETCH), _U(ABS_HI), _U(ABSX_READ), _U(FIX_READ), _U(DUMMY_WRITE), _U(op), _U(END) }
+#define _CPU_UOPS_MODIFY_ABS_Y(op)  { _U(FETCH), _U(ABS_HI), _U(ABSY_READ), _U(FIX_READ), _U(DUMMY_WRITE), _U(op), _U(END) }
+#define _CPU_UOPS_MODIFY_IND_X(op)  { _U(FETCH), _U(ZPX_READ), _U(PTR_HI), _U(ABS_READ), _U(IDLE), _U(DUMMY_WRITE), _U(op), _U(END) }
+#define _CPU_UOPS_MODIFY_IND_Y(op)  { _U(FETCH), _U(ZP_READ), _U(PTR_HI), _U(ABSY_READ), _U(FIX_READ), _U(DUMMY_WRITE), _U(op), _U(END) }
+
+static const uint8_t cpu_uop_table[256][8] =
+{
+    [IC_BRK]        = { _U(BRK0), _U(BRK1), _U(BRK2), _U(BRK3), _U(BRK4), _U(BRK5), _U(BRK6) },
+    [IC_JSR]        = { _U(FETCH), _U(JSR1), _U(JSR2), _U(JSR3), _U(JSR4), _U(JSR5) },
+    [IC_RTS]        = { _U(FETCH), _U(PULL), _U(IDLE), _U(PULL_TEMP), _U(RTS_PC), _U(END) },
+    [IC_RTI]        = { _U(FETCH), _U(PULL), _U(RTI), _U(PULL_TEMP), _U(RTI_PC), _U(END) },
+    [IC_JMP]        = { _U(FETCH), _U(ABS_HI), _U(JMP) },
+    [IC_JMP_IND]    = { _U(FETCH), _U(ABS_HI), _U(ABS_READ), _U(JMP_IND_HI), _U(JMP_IND) },
+
+    [IC_PHP] = _CPU_UOPS_PUSH(PHP),
+    [IC_PHA] = _CPU_UOPS_PUSH(PHA),
+    [IC_PLP] = _CPU_UOPS_PULL(PLP),
+    [IC_PLA] = _CPU_UOPS_PULL(PLA),
+
+    [IC_INX] = _CPU_UOPS_IMPLIED(INX),
+    [IC_INY] = _CPU_UOPS_IMPLIED(INY),
+    [IC_DEX] = _CPU_UOPS_IMPLIED(DEX),
+    [IC_DEY] = _CPU_UOPS_IMPLIED(DEY),
+    [IC_ROL_ACC] = _CPU_UOPS_IMPLIED(ROL_A),
+    [IC_ROR_ACC] = _CPU_UOPS_IMPLIED(ROR_A),
+    [IC_ASL_ACC] = _CPU_UOPS_IMPLIED(ASL_A),
+    [IC_LSR_ACC] = _CPU_UOPS_IMPLIED(LSR_A),
+    [IC_TAX] = _CPU_UOPS_IMPLIED(TAX),
+    [IC_TAY] = _CPU_UOPS_IMPLIED(TAY),
+    [IC_TSX] = _CPU_UOPS_IMPLIED(TSX),
+    [IC_TXA] = _CPU_UOPS_IMPLIED(TXA),
+    [IC_TXS] = _CPU_UOPS_IMPLIED(TXS),
+    [IC_TYA] = _CPU_UOPS_IMPLIED(TYA),
+    [IC_CLC] = _CPU_UOPS_IMPLIED(CLC),
+    [IC_SEC] = _CPU_UOPS_IMPLIED(SEC),
+    [IC_CLI] = _CPU_UOPS_IMPLIED(CLI),
+    [IC_SEI] = _CPU_UOPS_IMPLIED(SEI),
+    [IC_CLV] = _CPU_UOPS_IMPLIED(CLV),
+    [IC_CLD] = _CPU_UOPS_IMPLIED(CLD),
+    [IC_SED] = _CPU_UOPS_IMPLIED(SED),
+    [IC_NOP] = _CPU_UOPS_IMPLIED(NOP),
+    [IC_IL_NOP_IMM0] = _CPU_UOPS_IMPLIED(NOP), [IC_IL_NOP_IMM1] = _CPU_UOPS_IMPLIED(NOP), [IC_IL_NOP_IMM2] = _CPU_UOPS_IMPLIED(NOP),
+    [IC_IL_NOP_IMM3] = _CPU_UOPS_IMPLIED(NOP), [IC_IL_NOP_IMM4] = _CPU_UOPS_IMPLIED(NOP), [IC_IL_NOP_IMM5] = _CPU_UOPS_IMPLIED(NOP),
+    [IC_IL_JAM0] = _CPU_UOPS_IMPLIED(NOP), [IC_IL_JAM1] = _CPU_UOPS_IMPLIED(NOP), [IC_IL_JAM2] = _CPU_UOPS_IMPLIED(NOP),
+    [IC_IL_JAM3] = _CPU_UOPS_IMPLIED(NOP), [IC_IL_JAM4] = _CPU_UOPS_IMPLIED(NOP), [IC_IL_JAM5] = _CPU_UOPS_IMPLIED(NOP),
+    [IC_IL_JAM6] = _CPU_UOPS_IMPLIED(NOP), [IC_IL_JAM7] = _CPU_UOPS_IMPLIED(NOP), [IC_IL_JAM8] = _CPU_UOPS_IMPLIED(NOP),
+    [IC_IL_JAM9] = _CPU_UOPS_IMPLIED(NOP), [IC_IL_JAM10] = _CPU_UOPS_IMPLIED(NOP), [IC_IL_JAM11] = _CPU_UOPS_IMPLIED(NOP),
+
+    [IC_BCC] = _CPU_UOPS_BRANCH, [IC_BCS] = _CPU_UOPS_BRANCH, [IC_BNE] = _CPU_UOPS_BRANCH, [IC_BEQ] = _CPU_UOPS_BRANCH,
+    [IC_BVC] = _CPU_UOPS_BRANCH, [IC_BVS] = _CPU_UOPS_BRANCH, [IC_BPL] = _CPU_UOPS_BRANCH, [IC_BMI] = _CPU_UOPS_BRANCH,
+
+    [IC_BIT_ZP] = _CPU_UOPS_READ_ZP(BIT), [IC_BIT_ABS] = _CPU_UOPS_READ_ABS(BIT),
+
+    [IC_LDA_IMM] = _CPU_UOPS_READ_IMM(LDA), [IC_LDA_ZP] = _CPU_UOPS_READ_ZP(LDA), [IC_LDA_ZP_X] = _CPU_UOPS_LOAD_ZP_X(LDA),
+    [IC_LDA_ABS] = _CPU_UOPS_READ_ABS(LDA), [IC_LDA_ABS_X] = _CPU_UOPS_READ_ABS_X(LDA), [IC_LDA_ABS_Y] = _CPU_UOPS_READ_ABS_Y(LDA),
+    [IC_LDA_IND_X] = _CPU_UOPS_READ_IND_X(LDA), [IC_LDA_IND_Y] = _CPU_UOPS_READ_IND_Y(LDA),
+
+    [IC_LDX_IMM] = _CPU_UOPS_READ_IMM(LDX), [IC_LDX_ZP] = _CPU_UOPS_READ_ZP(LDX), [IC_LDX_ZP_Y] = _CPU_UOPS_LOAD_ZP_Y(LDX),
+    [IC_LDX_ABS] = _CPU_UOPS_READ_ABS(LDX), [IC_LDX_ABS_Y] = _CPU_UOPS_READ_ABS_Y(LDX),
+
+    [IC_LDY_IMM] = _CPU_UOPS_READ_IMM(LDY), [IC_LDY_ZP] = _CPU_UOPS_READ_ZP(LDY), [IC_LDY_ZP_X] = _CPU_UOPS_LOAD_ZP_X(LDY),
+    [IC_LDY_ABS] = _CPU_UOPS_READ_ABS(LDY), [IC_LDY_ABS_X] = _CPU_UOPS_READ_ABS_X(LDY),
+
+    [IC_ADC_IMM] = _CPU_UOPS_READ_IMM(ADC), [IC_ADC_ZP] = _CPU_UOPS_READ_ZP(ADC), [IC_ADC_ZP_X] = _CPU_UOPS_READ_ZP_X(ADC),
+    [IC_ADC_ABS] = _CPU_UOPS_READ_ABS(ADC), [IC_ADC_ABS_X] = _CPU_UOPS_READ_ABS_X(ADC), [IC_ADC_ABS_Y] = _CPU_UOPS_READ_ABS_Y(ADC),
+    [IC_ADC_IND_X] = _CPU_UOPS_READ_IND_X(ADC), [IC_ADC_IND_Y] = _CPU_UOPS_READ_IND_Y(ADC),
+
+    [IC_SBC_IMM] = _CPU_UOPS_READ_IMM(SBC), [IC_SBC_ZP] = _CPU_UOPS_READ_ZP(SBC), [IC_SBC_ZP_X] = _CPU_UOPS_READ_ZP_X(SBC),
+    [IC_SBC_ABS] = _CPU_UOPS_READ_ABS(SBC), [IC_SBC_ABS_X] = _CPU_UOPS_READ_ABS_X(SBC), [IC_SBC_ABS_Y] = _CPU_UOPS_READ_ABS_Y(SBC),
+    [IC_SBC_IND_X] = _CPU_UOPS_READ_IND_X(SBC), [IC_SBC_IND_Y] = _CPU_UOPS_READ_IND_Y(SBC),
+
+    [IC_CMP_IMM] = _CPU_UOPS_READ_IMM(CMP), [IC_CMP_ZP] = _CPU_UOPS_READ_ZP(CMP), [IC_CMP_ZP_X] = _CPU_UOPS_READ_ZP_X(CMP),
+    [IC_CMP_ABS] = _CPU_UOPS_READ_ABS(CMP), [IC_CMP_ABS_X] = _CPU_UOPS_READ_ABS_X(CMP), [IC_CMP_ABS_Y] = _CPU_UOPS_READ_ABS_Y(CMP),
+    [IC_CMP_IND_X] = _CPU_UOPS_READ_IND_X(CMP), [IC_CMP_IND_Y] = _CPU_UOPS_READ_IND_Y(CMP),
+
+    [IC_AND_IMM] = _CPU_UOPS_READ_IMM(AND), [IC_AND_ZP] = _CPU_UOPS_READ_ZP(AND), [IC_AND_ZP_X] = _CPU_UOPS_READ_ZP_X(AND),
+    [IC_AND_ABS] = _CPU_UOPS_READ_ABS(AND), [IC_AND_ABS_X] = _CPU_UOPS_READ_ABS_X(AND), [IC_AND_ABS_Y] = _CPU_UOPS_READ_ABS_Y(AND),
+    [IC_AND_IND_X] = _CPU_UOPS_READ_IND_X(AND), [IC_AND_IND_Y] = _CPU_UOPS_READ_IND_Y(AND),
+
+    [IC_ORA_IMM] = _CPU_UOPS_READ_IMM(ORA), [IC_ORA_ZP] = _CPU_UOPS_READ_ZP(ORA), [IC_ORA_ZP_X] = _CPU_UOPS_READ_ZP_X(ORA),
+    [IC_ORA_ABS] = _CPU_UOPS_READ_ABS(ORA), [IC_ORA_ABS_X] = _CPU_UOPS_READ_ABS_X(ORA), [IC_ORA_ABS_Y] = _CPU_UOPS_READ_ABS_Y(ORA),
+    [IC_ORA_IND_X] = _CPU_UOPS_READ_IND_X(ORA), [IC_ORA_IND_Y] = _CPU_UOPS_READ_IND_Y(ORA),
+
+    [IC_EOR_IMM] = _CPU_UOPS_READ_IMM(EOR), [IC_EOR_ZP] = _CPU_UOPS_READ_ZP(EOR), [IC_EOR_ZP_X] = _CPU_UOPS_READ_ZP_X(EOR),
+    [IC_EOR_ABS] = _CPU_UOPS_READ_ABS(EOR), [IC_EOR_ABS_X] = _CPU_UOPS_READ_ABS_X(EOR), [IC_EOR_ABS_Y] = _CPU_UOPS_READ_ABS_Y(EOR),
+    [IC_EOR_IND_X] = _CPU_UOPS_READ_IND_X(EOR), [IC_EOR_IND_Y] = _CPU_UOPS_READ_IND_Y(EOR),
+
+    [IC_CPX_IMM] = _CPU_UOPS_READ_IMM(CPX), [IC_CPX_ZP] = _CPU_UOPS_READ_ZP(CPX), [IC_CPX_ABS] = _CPU_UOPS_READ_ABS(CPX),
+    [IC_CPY_IMM] = _CPU_UOPS_READ_IMM(CPY), [IC_CPY_ZP] = _CPU_UOPS_READ_ZP(CPY), [IC_CPY_ABS] = _CPU_UOPS_READ_ABS(CPY),
+
+    [IC_STA_ZP] = _CPU_UOPS_WRITE_ZP(A), [IC_STA_ZP_X] = _CPU_UOPS_WRITE_ZP_X(A), [IC_STA_ABS] = _CPU_UOPS_WRITE_ABS(A),
+    [IC_STA_ABS_X] = _CPU_UOPS_WRITE_ABS_X(ST_FIX_A), [IC_STA_ABS_Y] = _CPU_UOPS_WRITE_ABS_Y(ST_FIX_A),
+    [IC_STA_IND_X] = _CPU_UOPS_WRITE_IND_X(A), [IC_STA_IND_Y] = _CPU_UOPS_WRITE_IND_Y(ST_FIX_A),
+    [IC_STX_ZP] = _CPU_UOPS_WRITE_ZP(X), [IC_STX_ZP_Y] = _CPU_UOPS_WRITE_ZP_Y(X), [IC_STX_ABS] = _CPU_UOPS_WRITE_ABS(X),
+    [IC_STY_ZP] = _CPU_UOPS_WRITE_ZP(Y), [IC_STY_ZP_X] = _CPU_UOPS_WRITE_ZP_X(Y), [IC_STY_ABS] = _CPU_UOPS_WRITE_ABS(Y),
+
+    [IC_ROL_ZP] = _CPU_UOPS_MODIFY_ZP(ROL), [IC_ROL_ZP_X] = _CPU_UOPS_MODIFY_ZP_X(ROL),
+    [IC_ROL_ABS] = _CPU_UOPS_MODIFY_ABS(ROL), [IC_ROL_ABS_X] = _CPU_UOPS_MODIFY_ABS_X(ROL),
+    [IC_ROR_ZP] = _CPU_UOPS_MODIFY_ZP(ROR), [IC_ROR_ZP_X] = _CPU_UOPS_MODIFY_ZP_X(ROR),
+    [IC_ROR_ABS] = _CPU_UOPS_MODIFY_ABS(ROR), [IC_ROR_ABS_X] = _CPU_UOPS_MODIFY_ABS_X(ROR),
+    [IC_DEC_ZP] = _CPU_UOPS_MODIFY_ZP(DEC), [IC_DEC_ZP_X] = _CPU_UOPS_MODIFY_ZP_X(DEC),
+    [IC_DEC_ABS] = _CPU_UOPS_MODIFY_ABS(DEC), [IC_DEC_ABS_X] = _CPU_UOPS_MODIFY_ABS_X(DEC),
+    [IC_INC_ZP] = _CPU_UOPS_MODIFY_ZP(INC), [IC_INC_ZP_X] = _CPU_UOPS_MODIFY_ZP_X(INC),
+    [IC_INC_ABS] = _CPU_UOPS_MODIFY_ABS(INC), [IC_INC_ABS_X] = _CPU_UOPS_MODIFY_ABS_X(INC),
+    [IC_ASL_ZP] = _CPU_UOPS_MODIFY_ZP(ASL), [IC_ASL_ZP_X] = _CPU_UOPS_MODIFY_ZP_X(ASL),
+    [IC_ASL_ABS] = _CPU_UOPS_MODIFY_ABS(ASL), [IC_ASL_ABS_X] = _CPU_UOPS_MODIFY_ABS_X(ASL),
+    [IC_LSR_ZP] = _CPU_UOPS_MODIFY_ZP(LSR), [IC_LSR_ZP_X] = _CPU_UOPS_MODIFY_ZP_X(LSR),
+    [IC_LSR_ABS] = _CPU_UOPS_MODIFY_ABS(LSR), [IC_LSR_ABS_X] = _CPU_UOPS_MODIFY_ABS_X(LSR),
+
+    // Illegal opcodes
+
+    [IC_IL_NOP_IMP0] = _CPU_UOPS_READ_IMM(NOP), [IC_IL_NOP_IMP1] = _CPU_UOPS_READ_IMM(NOP), [IC_IL_NOP_IMP2] = _CPU_UOPS_READ_IMM(NOP),
+    [IC_IL_NOP_IMP3] = _CPU_UOPS_READ_IMM(NOP), [IC_IL_NOP_IMP4] = _CPU_UOPS_READ_IMM(NOP),
+    [IC_IL_NOP_ZP0] = _CPU_UOPS_READ_ZP(NOP), [IC_IL_NOP_ZP1] = _CPU_UOPS_READ_ZP(NOP), [IC_IL_NOP_ZP2] = _CPU_UOPS_READ_ZP(NOP),
+    [IC_IL_NOP_ZP_X0] = _CPU_UOPS_READ_ZP_X(NOP), [IC_IL_NOP_ZP_X1] = _CPU_UOPS_READ_ZP_X(NOP), [IC_IL_NOP_ZP_X2] = _CPU_UOPS_READ_ZP_X(NOP),
+    [IC_IL_NOP_ZP_X3] = _CPU_UOPS_READ_ZP_X(NOP), [IC_IL_NOP_ZP_X4] = _CPU_UOPS_READ_ZP_X(NOP), [IC_IL_NOP_ZP_X5] = _CPU_UOPS_READ_ZP_X(NOP),
+    [IC_IL_NOP_ABS] = _CPU_UOPS_READ_ABS(NOP),
+    [IC_IL_NOP_ABS_X0] = _CPU_UOPS_READ_ABS_X(NOP), [IC_IL_NOP_ABS_X1] = _CPU_UOPS_READ_ABS_X(NOP), [IC_IL_NOP_ABS_X2] = _CPU_UOPS_READ_ABS_X(NOP),
+    [IC_IL_NOP_ABS_X3] = _CPU_UOPS_READ_ABS_X(NOP), [IC_IL_NOP_ABS_X4] = _CPU_UOPS_READ_ABS_X(NOP), [IC_IL_NOP_ABS_X5] = _CPU_UOPS_READ_ABS_X(NOP),
+
+    [IC_IL_LAX_IMM] = _CPU_UOPS_READ_IMM(LAX), [IC_IL_LAX_ZP] = _CPU_UOPS_READ_ZP(LAX), [IC_IL_LAX_ZP_Y] = _CPU_UOPS_LOAD_ZP_Y(LAX),
+    [IC_IL_LAX_ABS] = _CPU_UOPS_READ_ABS(LAX), [IC_IL_LAX_ABS_Y] = _CPU_UOPS_READ_ABS_Y(LAX),
+    [IC_IL_LAX_IND_X] = _CPU_UOPS_READ_IND_X(LAX), [IC_IL_LAX_IND_Y] = _CPU_UOPS_READ_IND_Y(LAX),
+
+    [IC_IL_SAX_ZP] = _CPU_UOPS_WRITE_ZP(AX), [IC_IL_SAX_ABS] = _CPU_UOPS_WRITE_ABS(AX), [IC_IL_SAX_IND_X] = _CPU_UOPS_WRITE_IND_X(AX),
+    [IC_IL_SAX_ZP_Y] = { _U(FETCH), _U(ST_ZPY_AX), _U(DUMMY_WRITE), _U(END) },
+
+    [IC_IL_ANC_IMM] = _CPU_UOPS_READ_IMM(ANC), [IC_IL_AAC_IMM] = _CPU_UOPS_READ_IMM(ANC),
+    [IC_IL_ALR_IMM] = _CPU_UOPS_READ_IMM(ALR), [IC_IL_ARR_IMM] = _CPU_UOPS_READ_IMM(ARR),
+    [IC_IL_AXS_IMM] = _CPU_UOPS_READ_IMM(AXS), [IC_IL_XAA_IMM] = _CPU_UOPS_READ_IMM(XAA),
+    [IC_IL_SBC_IMM] = _CPU_UOPS_READ_IMM(SBC), [IC_IL_LAS_ABS_Y] = _CPU_UOPS_READ_ABS_Y(LAS),
+
+    [IC_IL_SHY_ABS_X] = _CPU_UOPS_WRITE_ABS_X(SHY), [IC_IL_SHX_ABS_Y] = _CPU_UOPS_WRITE_ABS_Y(SHX),
+    [IC_IL_SHA_ABS_Y] = _CPU_UOPS_WRITE_ABS_Y(SHA), [IC_IL_TAS_ABS_Y] = _CPU_UOPS_WRITE_ABS_Y(TAS),
+    [IC_IL_SHA_IND_Y] = _CPU_UOPS_WRITE_IND_Y(SHA),
+
+    [IC_IL_DCP_ZP] = _CPU_UOPS_MODIFY_ZP(DCP), [IC_IL_DCP_ZP_X] = _CPU_UOPS_MODIFY_ZP_X(DCP), [IC_IL_DCP_ABS] = _CPU_UOPS_MODIFY_ABS(DCP),
+    [IC_IL_DCP_ABS_X] = _CPU_UOPS_MODIFY_ABS_X(DCP), [IC_IL_DCP_ABS_Y] = _CPU_UOPS_MODIFY_ABS_Y(DCP),
+    [IC_IL_DCP_IND_X] = _CPU_UOPS_MODIFY_IND_X(DCP), [IC_IL_DCP_IND_Y] = _CPU_UOPS_MODIFY_IND_Y(DCP),
+
+    [IC_IL_ISB_ZP] = _CPU_UOPS_MODIFY_ZP(ISB), [IC_IL_ISB_ZP_X] = _CPU_UOPS_MODIFY_ZP_X(ISB), [IC_IL_ISB_ABS] = _CPU_UOPS_MODIFY_ABS(ISB),
+    [IC_IL_ISB_ABS_X] = _CPU_UOPS_MODIFY_ABS_X(ISB), [IC_IL_ISB_ABS_Y] = _CPU_UOPS_MODIFY_ABS_Y(ISB),
+    [IC_IL_ISB_IND_X] = _CPU_UOPS_MODIFY_IND_X(ISB), [IC_IL_ISB_IND_Y] = _CPU_UOPS_MODIFY_IND_Y(ISB),
+
+    [IC_IL_SLO_ZP] = _CPU_UOPS_MODIFY_ZP(SLO), [IC_IL_SLO_ZP_X] = _CPU_UOPS_MODIFY_ZP_X(SLO), [IC_IL_SLO_ABS] = _CPU_UOPS_MODIFY_ABS(SLO),
+    [IC_IL_SLO_ABS_X] = _CPU_UOPS_MODIFY_ABS_X(SLO), [IC_IL_SLO_ABS_Y] = _CPU_UOPS_MODIFY_ABS_Y(SLO),
+    [IC_IL_SLO_IND_X] = _CPU_UOPS_MODIFY_IND_X(SLO), [IC_IL_SLO_IND_Y] = _CPU_UOPS_MODIFY_IND_Y(SLO),
+
+    [IC_IL_RLA_ZP] = _CPU_UOPS_MODIFY_ZP(RLA), [IC_IL_RLA_ZP_X] = _CPU_UOPS_MODIFY_ZP_X(RLA), [IC_IL_RLA_ABS] = _CPU_UOPS_MODIFY_ABS(RLA),
+    [IC_IL_RLA_ABS_X] = _CPU_UOPS_MODIFY_ABS_X(RLA), [IC_IL_RLA_ABS_Y] = _CPU_UOPS_MODIFY_ABS_Y(RLA),
+    [IC_IL_RLA_IND_X] = _CPU_UOPS_MODIFY_IND_X(RLA), [IC_IL_RLA_IND_Y] = _CPU_UOPS_MODIFY_IND_Y(RLA),
+
+    [IC_IL_SRE_ZP] = _CPU_UOPS_MODIFY_ZP(SRE), [IC_IL_SRE_ZP_X] = _CPU_UOPS_MODIFY_ZP_X(SRE), [IC_IL_SRE_ABS] = _CPU_UOPS_MODIFY_ABS(SRE),
+    [IC_IL_SRE_ABS_X] = _CPU_UOPS_MODIFY_ABS_X(SRE), [IC_IL_SRE_ABS_Y] = _CPU_UOPS_MODIFY_ABS_Y(SRE),
+    [IC_IL_SRE_IND_X] = _CPU_UOPS_MODIFY_IND_X(SRE), [IC_IL_SRE_IND_Y] = _CPU_UOPS_MODIFY_IND_Y(SRE),
+
+    [IC_IL_RRA_ZP] = _CPU_UOPS_MODIFY_ZP(RRA), [IC_IL_RRA_ZP_X] = _CPU_UOPS_MODIFY_ZP_X(RRA), [IC_IL_RRA_ABS] = _CPU_UOPS_MODIFY_ABS(RRA),
+    [IC_IL_RRA_ABS_X] = _CPU_UOPS_MODIFY_ABS_X(RRA), [IC_IL_RRA_ABS_Y] = _CPU_UOPS_MODIFY_ABS_Y(RRA),
+    [IC_IL_RRA_IND_X] = _CPU_UOPS_MODIFY_IND_X(RRA), [IC_IL_RRA_IND_Y] = _CPU_UOPS_MODIFY_IND_Y(RRA),
+};
+
+#undef _U
+
+// Flag tested by each branch opcode, selected by its top two bits. Bit 5 of the opcode is the value that branches
+static const uint8_t cpu_branch_flag[4] = { CPU_STATUS_FLAG_NEGATIVE, CPU_STATUS_FLAG_OVERFLOW, CPU_STATUS_FLAG_CARRY, CPU_STATUS_FLAG_ZERO };
+
+#if defined(__GNUC__)
+#define _CPU_UOP_LABEL(name)        &&cpu_uop_##name,
+#define _CPU_UOP(name)              cpu_uop_##name:
+#define _CPU_UOP_DISPATCH(uop)      { static const void* const labels[CPU_UOP_COUNT] = { _CPU_UOPS(_CPU_UOP_LABEL) }; goto *labels[uop]; }
+#define _CPU_UOP_DISPATCH_END
+#else
+#define _CPU_UOP(name)              case CPU_UOP_##name:
+#define _CPU_UOP_DISPATCH(uop)      switch (uop) {
+#define _CPU_UOP_DISPATCH_END       }
+#endif
+
+#define _CPU_UOP_ALU_HANDLERS(X, op) \
+    _CPU_UOP(op##_END)  { _CPU_ALU_##op; goto end_instruction; }\
+    _CPU_UOP(op##_PX)   { _CPU_UOP_CHECK_PAGE_CROSS(); _CPU_ALU_##op; goto end_instruction; }\
+    _CPU_UOP(op##_RET)  { _CPU_ALU_##op; return; }\
+    _CPU_UOP(op##_IDLE) { cpu->rw_mode = CPU_RW_MODE_NONE; _CPU_ALU_##op; return; }
+
+#define _CPU_UOP_RMW_HANDLERS(X, op) \
+    _CPU_UOP(op) { cpu->rw_mode = CPU_RW_MODE_WRITE; _CPU_RMW_##op; return; }
+
+#define _CPU_UOP_CHECK_PAGE_CROSS() \
+    if (cpu->temp) {\
+        cpu->rw_mode = CPU_RW_MODE_READ;\
+        cpu->address += 0x0100;\
+        return;\
+    }
+
+#define _CPU_UOP_SHAXY(value) {\
+    cpu->rw_mode = CPU_RW_MODE_WRITE;\
+    cpu->data = was_halted ? (value) : (value) & ((uint8_t)(cpu->address >> 8) + 1);\
+    if (cpu->temp)\
+        cpu->address = (cpu->address & 0xFF) | ((uint16_t)cpu->data << 8);\
+}
+
+#define _CPU_UOP_STORE(name, addr, v) \
+    _CPU_UOP(name) { cpu->rw_mode = CPU_RW_MODE_WRITE; cpu->address = (addr); cpu->data = (v); return; }
+
+static void cpu_execute_uop(cpu_state* cpu)
+{
+    if (!cpu->rdy && cpu->rw_mode != CPU_RW_MODE_WRITE)
+    {
+        cpu->halted = 1;
+        return;
+    }
+
+    int was_halted = cpu->halted;
+    cpu->halted = 0;
+
+    int irq_phase1 = cpu->irq_phase0;
+    cpu->irq_phase0 = cpu->irq && !(cpu->P & CPU_STATUS_FLAG_IRQDISABLE);
+
+    int nmi_phase1 = cpu->nmi_phase0;
+    if (cpu->nmi_phase0 == 0 && cpu->nmi)
+        cpu->nmi_phase0 = 1;
+
+    uint8_t cycle = _CPU_GET_CYCLE((*cpu));
+
+    if (cycle == 0)
+    {
+        _CPU_SET_INSTRUCTION((*cpu), cpu->data);
+        cpu->rw_mode = CPU_RW_MODE_NONE;
+    }
+
+    uint_fast32_t instruction = _CPU_GET_INSTRUCTION((*cpu));
+
+    _CPU_SET_CYCLE((*cpu), cycle + 1);
+
+    // No instruction runs past cycle 7, the mask only keeps a corrupted state inside the table
+    _CPU_UOP_DISPATCH(cpu_uop_table[instruction][cycle & 7])
+
+    _CPU_UOP(IDLE)          { cpu->rw_mode = CPU_RW_MODE_NONE; return; }
+    _CPU_UOP(NOP)           { return; }
+    _CPU_UOP(FETCH)         { cpu->rw_mode = CPU_RW_MODE_READ; cpu->address = cpu->PC++; return; }
+
+    _CPU_UOP(INX)           { _CPU_SET_REG_X((*cpu), cpu->X + 1); return; }
+    _CPU_UOP(INY)           { _CPU_SET_REG_Y((*cpu), cpu->Y + 1); return; }
+    _CPU_UOP(DEX)           { _CPU_SET_REG_X((*cpu), cpu->X - 1); return; }
+    _CPU_UOP(DEY)           { _CPU_SET_REG_Y((*cpu), cpu->Y - 1); return; }
+    _CPU_UOP(ROL_A)         { _CPU_ROL((*cpu), cpu->A); return; }
+    _CPU_UOP(ROR_A)         { _CPU_ROR((*cpu), cpu->A); return; }
+    _CPU_UOP(ASL_A)         { _CPU_ASL((*cpu), cpu->A); return; }
+    _CPU_UOP(LSR_A)         { _CPU_LSR((*cpu), cpu->A); return; }
+    _CPU_UOP(TAX)           { _CPU_SET_REG_X((*cpu), cpu->A); return; }
+    _CPU_UOP(TAY)           { _CPU_SET_REG_Y((*cpu), cpu->A); return; }
+    _CPU_UOP(TSX)           { _CPU_SET_REG_X((*cpu), cpu->S); return; }
+    _CPU_UOP(TXA)           { _CPU_SET_REG_A((*cpu), cpu->X); return; }
+    _CPU_UOP(TXS)           { _CPU_SET_REG_S((*cpu), cpu->X); return; }
+    _CPU_UOP(TYA)           { _CPU_SET_REG_A((*cpu), cpu->Y); return; }
+    _CPU_UOP(CLC)           { _CPU_SET_REG_P((*cpu), cpu->P & 0xFE); return; }
+    _CPU_UOP(SEC)           { _CPU_SET_REG_P((*cpu), cpu->P | 1); return; }
+    _CPU_UOP(CLI)           { _CPU_SET_REG_P((*cpu), cpu->P & 0xFB); return; }
+    _CPU_UOP(SEI)           { _CPU_SET_REG_P((*cpu), cpu->P | 0x04); return; }
+    _CPU_UOP(CLV)           { _CPU_SET_REG_P((*cpu), cpu->P & 0xBF); return; }
+    _CPU_UOP(CLD)           { _CPU_SET_REG_P((*cpu), cpu->P & 0xF7); return; }
+    _CPU_UOP(SED)           { _CPU_SET_REG_P((*cpu), cpu->P | 0x08); return; }
+
+    _CPU_UOP_STORE(PHP, ((uint8_t)cpu->S--) + 0x0100, cpu->P | CPU_STATUS_FLAG_BREAK)
+    _CPU_UOP_STORE(PHA, ((uint8_t)cpu->S--) + 0x0100, cpu->A)
+
+    _CPU_UOP(PULL_DUMMY)    { cpu->rw_mode = CPU_RW_MODE_READ; cpu->address = cpu->PC; return; }
+    _CPU_UOP(PULL)          { cpu->rw_mode = CPU_RW_MODE_READ; cpu->address = ((uint8_t)++cpu->S) + 0x0100; return; }
+    _CPU_UOP(PULL_TEMP)     { cpu->rw_mode = CPU_RW_MODE_READ; cpu->address = ((uint8_t)++cpu->S) + 0x0100; cpu->temp = cpu->data; return; }
+    _CPU_UOP(PLA)           { cpu->rw_mode = CPU_RW_MODE_NONE; _CPU_SET_REG_A((*cpu), cpu->data); return; }
+    _CPU_UOP(PLP)           { cpu->rw_mode = CPU_RW_MODE_NONE; _CPU_SET_REG_P((*cpu), cpu->data & ~CPU_STATUS_FLAG_BREAK); return; }
+
+    _CPU_UOP(RTI)
+    {
+        cpu->rw_mode = CPU_RW_MODE_READ;
+        _CPU_SET_REG_P((*cpu), cpu->data & ~CPU_STATUS_FLAG_BREAK);
+        cpu->address = ((uint8_t)++cpu->S) + 0x0100;
+        return;
+    }
+    _CPU_UOP(RTS_PC)        { cpu->rw_mode = CPU_RW_MODE_NONE; cpu->PC = ((cpu->data << 8) | cpu->temp) + 1; return; }
+    _CPU_UOP(RTI_PC)        { cpu->rw_mode = CPU_RW_MODE_NONE; cpu->PC = (cpu->data << 8) | cpu->temp; return; }
+
+    _CPU_UOP(BRK0)
+    {
+        // Don't increment PC on hardware interrupt
+        cpu->rw_mode = CPU_RW_MODE_READ;
+        cpu->address = cpu->temp ? cpu->PC : cpu->PC++;
+        return;
+    }
+    _CPU_UOP(BRK1)
+    {
+        cpu->rw_mode = (cpu->temp != 0xFC) ? CPU_RW_MODE_WRITE : CPU_RW_MODE_NONE;
+        cpu->data = cpu->PC >> 8;
+        cpu->address = ((uint8_t)cpu->S--) + 0x0100;
+        return;
+    }
+    _CPU_UOP(BRK2)
+    {
+        cpu->data = (uint8_t)cpu->PC;
+        cpu->address = ((uint8_t)cpu->S--) + 0x0100;
+        return;
+    }
+    _CPU_UOP(BRK3)
+    {
+        cpu->data = cpu->P;
+        if (cpu->temp == 0 || cpu->temp == 0xFC)
+            cpu->data |= CPU_STATUS_FLAG_BREAK;
+
+        if (cpu->nmi_phase0)
+        {
+            cpu->nmi = 0;
+            cpu->nmi_phase0 = 0;
+            cpu->temp = 0xFA;
+        }
+        else if (cpu->irq_phase0 || cpu->temp == 0)
+        {
+            cpu->temp = 0xFE;
+        }
+
+        cpu->address = ((uint8_t)cpu->S--) + 0x0100;
+        return;
+    }
+    _CPU_UOP(BRK4)
+    {
+        cpu->rw_mode = CPU_RW_MODE_READ;
+        cpu->address = 0xFF00 | cpu->temp;
+        _CPU_SET_REG_P((*cpu), cpu->P | CPU_STATUS_FLAG_IRQDISABLE);
+        return;
+    }
+    _CPU_UOP(BRK5)          { cpu->rw_mode = CPU_RW_MODE_READ; cpu->PC = cpu->data; cpu->address += 1; return; }
+    _CPU_UOP(BRK6)          { cpu->PC = (cpu->data << 8) | cpu->PC; nmi_phase1 = 0; goto end_instruction; }
+
+    _CPU_UOP(JSR1)          { cpu->rw_mode = CPU_RW_MODE_NONE; cpu->temp = cpu->data; return; }
+    _CPU_UOP_STORE(JSR2, ((uint8_t)cpu->S--) + 0x0100, cpu->PC >> 8)
+    _CPU_UOP_STORE(JSR3, ((uint8_t)cpu->S--) + 0x0100, cpu->PC & 0xFF)
+    _CPU_UOP(JSR4)          { cpu->rw_mode = CPU_RW_MODE_READ; cpu->address = cpu->PC; return; }
+    _CPU_UOP(JSR5)          { cpu->PC = (cpu->data << 8) | cpu->temp; goto end_instruction; }
+
+    _CPU_UOP(JMP)           { cpu->PC = (cpu->data << 8) | cpu->temp; goto end_instruction; }
+    _CPU_UOP(JMP_IND_HI)
+    {
+        cpu->rw_mode = CPU_RW_MODE_READ;
+        cpu->address = (cpu->address & 0xFF00) | ((cpu->address + 1) & 0x00FF);
+        cpu->temp = cpu->data;
+        return;
+    }
+    _CPU_UOP(JMP_IND)       { cpu->PC = (cpu->data << 8) | cpu->temp; goto end_instruction; }
+
+    _CPU_UOP(BRANCH)
+    {
+        cpu->rw_mode = CPU_RW_MODE_NONE;
+        if (((cpu->P & cpu_branch_flag[instruction >> 6]) != 0) == ((instruction >> 5) & 1))
+        {
+            cpu->address = cpu->PC + (int8_t)cpu->data;
+            if (cpu->irq_phase0 && !irq_phase1)
+                cpu->irq_phase0 = 0;
+            return;
+        }
+        goto end_instruction;
+    }
+    _CPU_UOP(BRANCH_TAKEN)
+    {
+        int page_cross = ((cpu->address & 0xFF00) != (cpu->PC & 0xFF00));
+        cpu->PC = cpu->address;
+        if (page_cross)
+            return;
+        goto end_instruction;
+    }
+
+    _CPU_UOP(ZP_READ)       { cpu->rw_mode = CPU_RW_MODE_READ; cpu->address = cpu->data; return; }
+    _CPU_UOP(ZPX_READ)      { cpu->rw_mode = CPU_RW_MODE_READ; cpu->address = (cpu->data + cpu->X) & 0xFF; return; }
+    _CPU_UOP(ZPY_READ)      { cpu->rw_mode = CPU_RW_MODE_READ; cpu->address = (cpu->data + cpu->Y) & 0xFF; return; }
+    _CPU_UOP(ABS_HI)        { cpu->rw_mode = CPU_RW_MODE_READ; cpu->address = cpu->PC++; cpu->temp = cpu->data; return; }
+    _CPU_UOP(ABS_READ)      { cpu->rw_mode = CPU_RW_MODE_READ; cpu->address = (cpu->data << 8) | cpu->temp; return; }
+    _CPU_UOP(ABSX_READ)
+    {
+        cpu->rw_mode = CPU_RW_MODE_READ;
+        cpu->address = (cpu->data << 8) | ((cpu->temp + cpu->X) & 0xFF);
+        cpu->temp = ((uint16_t)cpu->temp + (uint16_t)cpu->X) >> 8;
+        return;
+    }
+    _CPU_UOP(ABSY_READ)
+    {
+        cpu->rw_mode = CPU_RW_MODE_READ;
+        cpu->address = (cpu->data << 8) | ((cpu->temp + cpu->Y) & 0xFF);
+        cpu->temp = ((uint16_t)cpu->temp + (uint16_t)cpu->Y) >> 8;
+        return;
+    }
+    _CPU_UOP(PTR_HI)        { cpu->rw_mode = CPU_RW_MODE_READ; cpu->address = (cpu->address + 1) & 0xFF; cpu->temp = cpu->data; return; }
+    _CPU_UOP(FIX_READ)      { cpu->rw_mode = CPU_RW_MODE_READ; cpu->address += cpu->temp * 0x0100; return; }
+    _CPU_UOP(DUMMY_WRITE)   { cpu->rw_mode = CPU_RW_MODE_WRITE; return; }
+
+    _CPU_UOP_STORE(ST_ZP_A, cpu->data, cpu->A)
+    _CPU_UOP_STORE(ST_ZP_X, cpu->data, cpu->X)
+    _CPU_UOP_STORE(ST_ZP_Y, cpu->data, cpu->Y)
+    _CPU_UOP_STORE(ST_ZP_AX, cpu->data, cpu->A & cpu->X)
+    _CPU_UOP_STORE(ST_ZPX_A, (cpu->data + cpu->X) & 0xFF, cpu->A)
+    _CPU_UOP_STORE(ST_ZPX_Y, (cpu->data + cpu->X) & 0xFF, cpu->Y)
+    _CPU_UOP_STORE(ST_ZPY_X, (cpu->data + cpu->Y) & 0xFF, cpu->X)
+    _CPU_UOP_STORE(ST_ZPY_AX, (cpu->data + cpu->Y) & 0xFF, cpu->A & cpu->X)
+    _CPU_UOP_STORE(ST_ABS_A, (cpu->data << 8) | cpu->temp, cpu->A)
+    _CPU_UOP_STORE(ST_ABS_X, (cpu->data << 8) | cpu->temp, cpu->X)
+    _CPU_UOP_STORE(ST_ABS_Y, (cpu->data << 8) | cpu->temp, cpu->Y)
+    _CPU_UOP_STORE(ST_ABS_AX, (cpu->data << 8) | cpu->temp, cpu->A & cpu->X)
+    _CPU_UOP_STORE(ST_FIX_A, cpu->address + cpu->temp * 0x0100, cpu->A)
+
+    _CPU_UOP(SHY)           { _CPU_UOP_SHAXY(cpu->Y); return; }
+    _CPU_UOP(SHX)           { _CPU_UOP_SHAXY(cpu->X); return; }
+    _CPU_UOP(SHA)           { _CPU_UOP_SHAXY((cpu->A & cpu->X)); return; }
+    _CPU_UOP(TAS)           { cpu->S = cpu->A & cpu->X; _CPU_UOP_SHAXY(cpu->S); return; }
+
+    _CPU_ALU_OPS(_CPU_UOP_ALU_HANDLERS, 0)
+    _CPU_RMW_OPS(_CPU_UOP_RMW_HANDLERS, 0)
+
+    _CPU_UOP(END)           { goto end_instruction; }
+
+    _CPU_UOP_DISPATCH_END
+
+end_instruction:
+    _CPU_END_INSTRUCTION((*cpu), nmi_phase1 || irq_phase1);
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <memory.h>
+#include "nes_serializer.h"
 
 #define NES_APU_MAX_SAMPLES             4000
 
@@ -173,6 +174,95 @@ static void nes_apu_reset(nes_apu* apu)
     apu->cycle = 1;
 }
 
+// Of the sample buffer only the samples mixed since the last buffer was handed out are kept, the rest of it is padding
+// so the chunk keeps its size. Buffers are still handed out at the same cycles after a load and start with the same samples
+static void nes_apu_serialize(nes_apu* apu, nes_serializer* s)
+{
+    _NES_SERIALIZE_AS(s, 8, apu->reg_rw_mode);
+    nes_serialize_u16(s, &apu->reg_addr);
+    nes_serialize_u8(s, &apu->reg_data);
+    _NES_SERIALIZE_AS(s, 8, apu->sequencer_mode);
+    _NES_SERIALIZE_AS(s, 8, apu->sequencer_reset_req);
+    _NES_SERIALIZE_AS(s, 8, apu->inhibit_interrupt);
+    _NES_SERIALIZE_AS(s, 8, apu->frame_interrupt);
+    nes_serialize_u8(s, &apu->channel_enable.b);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        nes_apu_pulse* pulse = &apu->pulse[i];
+        _NES_SERIALIZE_AS(s, 8, pulse->duty);
+        _NES_SERIALIZE_AS(s, 8, pulse->sequence_output);
+        _NES_SERIALIZE_AS(s, 8, pulse->length_counter_halt);
+        _NES_SERIALIZE_AS(s, 8, pulse->env_start);
+        _NES_SERIALIZE_AS(s, 8, pulse->constant_volume);
+        _NES_SERIALIZE_AS(s, 8, pulse->sweep_enable);
+        _NES_SERIALIZE_AS(s, 8, pulse->sweep_negate);
+        _NES_SERIALIZE_AS(s, 8, pulse->sweep_reload);
+        nes_serialize_u16(s, &pulse->timer);
+        nes_serialize_u16(s, &pulse->t);
+        nes_serialize_u8(s, &pulse->sequencer);
+        nes_serialize_u8(s, &pulse->length_counter);
+        nes_serialize_u8(s, &pulse->sweep_divider);
+        nes_serialize_u8(s, &pulse->sweep_divider_period);
+        nes_serialize_u8(s, &pulse->sweep_shift_count);
+        nes_serialize_u16(s, &pulse->sweep_target_period);
+        nes_serialize_u8(s, &pulse->env_divider);
+        nes_serialize_u8(s, &pulse->env_counter);
+        nes_serialize_u8(s, &pulse->volume);
+        nes_serialize_u16(s, &pulse->output);
+    }
+
+    nes_apu_triangle* triangle = &apu->triangle;
+    _NES_SERIALIZE_AS(s, 8, triangle->control_flag);
+    _NES_SERIALIZE_AS(s, 8, triangle->linear_counter_reload);
+    nes_serialize_u16(s, &triangle->timer);
+    nes_serialize_u16(s, &triangle->t);
+    nes_serialize_u8(s, &triangle->linear_counter);
+    nes_serialize_u8(s, &triangle->linear_counter_reload_value);
+    nes_serialize_u8(s, &triangle->length_counter);
+    nes_serialize_u8(s, &triangle->sequencer);
+    nes_serialize_u16(s, &triangle->output);
+
+    nes_apu_noise* noise = &apu->noise;
+    _NES_SERIALIZE_AS(s, 8, noise->mode);
+    _NES_SERIALIZE_AS(s, 8, noise->length_counter_halt);
+    _NES_SERIALIZE_AS(s, 8, noise->env_start);
+    _NES_SERIALIZE_AS(s, 8, noise->constant_volume);
+    nes_serialize_u16(s, &noise->shift_register);
+    nes_serialize_u16(s, &noise->timer);
+    nes_serialize_u16(s, &noise->t);
+    nes_serialize_u8(s, &noise->length_counter);
+    nes_serialize_u8(s, &noise->env_divider);
+    nes_serialize_u8(s, &noise->env_counter);
+    nes_serialize_u8(s, &noise->volume);
+    nes_serialize_u16(s, &noise->output);
+
+    nes_apu_dmc* dmc = &apu->dmc;
+    _NES_SERIALIZE_AS(s, 8, dmc->irq_enabled);
+    _NES_SERIALIZE_AS(s, 8, dmc->interrupt);
+    _NES_SERIALIZE_AS(s, 8, dmc->loop);
+    _NES_SERIALIZE_AS(s, 8, dmc->silence);
+    _NES_SERIALIZE_AS(s, 8, dmc->sample_buffer_loaded);
+    _NES_SERIALIZE_AS(s, 8, dmc->sample_buffer_load_request);
+    nes_serialize_u16(s, &dmc->timer);
+    nes_serialize_u16(s, &dmc->t);
+    nes_serialize_u16(s, &dmc->sample_address);
+    nes_serialize_u16(s, &dmc->sample_length);
+    nes_serialize_u16(s, &dmc->current_address);
+    nes_serialize_u16(s, &dmc->bytes_remaining);
+    nes_serialize_u8(s, &dmc->sample_buffer);
+    nes_serialize_u8(s, &dmc->shift_register);
+    nes_serialize_u8(s, &dmc->bits_remaining);
+    nes_serialize_u8(s, &dmc->output);
+
+    _NES_SERIALIZE_AS(s, 16, apu->sample_count);
+    nes_serialize_u32(s, &apu->cycle);
+
+    uint32_t pending = apu->sample_count % NES_APU_MAX_SAMPLES;
+    nes_serialize_u16_array(s, (uint16_t*)apu->samples, pending);
+    nes_serialize_padding(s, (NES_APU_MAX_SAMPLES - pending) * sizeof(int16_t));
+}
+
 static void update_sweep_target_period(nes_apu* apu, int i)
 {
     const uint16_t change_amount = apu->pulse[i].timer >> apu->pulse[i].sweep_shift_count;
@@ -182,7 +272,13 @@ static void update_sweep_target_period(nes_apu* apu, int i)
         apu->pulse[i].sweep_target_period = 0;
 }
 
-static void nes_apu_execute(nes_apu* apu)
+static uint8_t nes_apu_pulse_sequence_output(uint8_t duty, uint8_t sequencer)
+{
+    const uint8_t duty_sequences[] = { 0x80, 0xC0, 0xF0, 0x3F };
+    return (duty_sequences[duty] >> sequencer) & 1;
+}
+
+static void nes_apu_step(nes_apu* apu)
 {
     const uint8_t lengths[] = { 10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14, 12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30 };
 
@@ -341,13 +437,7 @@ static void nes_apu_execute(nes_apu* apu)
             if (apu->pulse[i].t-- == 0)
             {
                 apu->pulse[i].t = apu->pulse[i].timer;
-                switch (apu->pulse[i].duty)
-                {
-                    case 0: apu->pulse[i].sequence_output = (0x80 >> apu->pulse[i].sequencer) & 1; break;
-                    case 1: apu->pulse[i].sequence_output = (0xC0 >> apu->pulse[i].sequencer) & 1; break;
-                    case 2: apu->pulse[i].sequence_output = (0xF0 >> apu->pulse[i].sequencer) & 1; break;
-                    case 3: apu->pulse[i].sequence_output = ((~0xC0) >> apu->pulse[i].sequencer) & 1; break;
-                }
+                apu->pulse[i].sequence_output = nes_apu_pulse_sequence_output(apu->pulse[i].duty, apu->pulse[i].sequencer);
                 apu->pulse[i].sequencer = (apu->pulse[i].sequencer - 1) & 7;
             }
 
@@ -598,30 +688,213 @@ static void nes_apu_execute(nes_apu* apu)
         apu->reg_rw_mode = NES_APU_REG_RW_MODE_NONE;
     }
 
-    // Mixing
+    apu->reg_rw_mode = NES_APU_REG_RW_MODE_NONE;
+    apu->cycle++;
+}
+
+/////////////////////////////////////////////////
+// Event stepping
+/////////////////////////////////////////////////
 
-    uint32_t sampleIndex = apu->sample_count % NES_APU_MAX_SAMPLES;
-    apu->sample_count = sampleIndex + 1;
+// Steps until the frame sequencer does anything
+static uint32_t nes_apu_frame_event_cycles(const nes_apu* apu)
+{
+    const uint32_t events[2][6] = {
+        { 7457, 14913, 22371, 29828, 29829, 29830 },
+        { 7457, 14913, 22371, 37281, 37282, 37282 }
+    };
 
-#if 0
+    for (int i = 0; i < 6; ++i)
     {
-        uint64_t pulse_out = (apu->pulse[0].output + apu->pulse[1].output) * 32298154ULL; 
-        uint64_t tnd_out = apu->triangle.output * 36550171ULL + apu->noise.output * 21217138ULL + apu->dmc.output * 14388140ULL;
+        if (events[apu->sequencer_mode][i] >= apu->cycle)
+            return events[apu->sequencer_mode][i] - apu->cycle;
+    }
 
-        // dividing by 42949672ULL results in output in rage 0-100
-        apu->samples[sampleIndex] = (uint16_t)(((pulse_out + tnd_out)/42949672ULL) * 500);
+    return UINT32_MAX;
+}
+
+// Counts a divider down by ticks, returns how many times it reloaded
+static uint32_t nes_apu_timer_advance(uint16_t* t, uint16_t timer, uint32_t ticks)
+{
+    if (ticks <= *t)
+    {
+        *t -= ticks;
+        return 0;
     }
-#else
+
+    ticks -= *t + 1;
+    *t = timer - ticks % (timer + 1);
+
+    return 1 + ticks / (timer + 1);
+}
+
+static uint8_t nes_apu_pulse_gate(const nes_apu* apu, int i)
+{
+    return (apu->channel_enable.b & (i + 1)) && apu->pulse[i].length_counter &&
+           apu->pulse[i].timer >= 8 && apu->pulse[i].sweep_target_period < 0x800;
+}
+
+// Steps that only count the channel timers down and leave every output as it is.
+// Pulse, noise and DMC timers tick on odd cycles, their reloads only matter while they are audible.
+static uint32_t nes_apu_plain_cycles(const nes_apu* apu)
+{
+    if (apu->reg_rw_mode != NES_APU_REG_RW_MODE_NONE || apu->sequencer_reset_req || apu->dmc.sample_buffer_load_request)
+        return 0;
+
+    const uint32_t odd_delay = (apu->cycle & 1) ^ 1;
+    uint32_t cycles = nes_apu_frame_event_cycles(apu);
+
+    for (int i = 0; i < 2; ++i)
     {
-        double square_out = 95.88 / ((8128.0 / (apu->pulse[0].output + apu->pulse[1].output)) + 100.0);
-        double tnd_out = 159.79 / ((1.0 / (apu->triangle.output / 8227.0 + apu->noise.output / 12241.0 + apu->dmc.output / 22638.0)) + 100.0);
+        const nes_apu_pulse* pulse = &apu->pulse[i];
+        uint8_t gate = nes_apu_pulse_gate(apu, i);
+        uint8_t level = pulse->constant_volume ? pulse->volume : pulse->env_counter;
+
+        // A register write or a frame step changed the output, the next odd cycle updates it
+        if (pulse->output != ((gate && pulse->sequence_output) ? level : 0))
+            return 0;
 
-        apu->samples[sampleIndex] = (int16_t)((square_out + tnd_out) * 32767);
+        if (gate && level && 2u * pulse->t + odd_delay < cycles)
+            cycles = 2u * pulse->t + odd_delay;
     }
-#endif
 
-    apu->reg_rw_mode = NES_APU_REG_RW_MODE_NONE;
-    apu->cycle++;
+    {
+        const nes_apu_noise* noise = &apu->noise;
+        uint8_t gate = apu->channel_enable.noise && noise->length_counter;
+        uint8_t level = noise->constant_volume ? noise->volume : noise->env_counter;
+
+        if (noise->output != ((gate && (noise->shift_register & 1)) ? level : 0))
+            return 0;
+
+        if (gate && level && 2u * noise->t + odd_delay < cycles)
+            cycles = 2u * noise->t + odd_delay;
+    }
+
+    {
+        const nes_apu_triangle* triangle = &apu->triangle;
+        uint8_t active = apu->channel_enable.triangle ? (triangle->length_counter && triangle->linear_counter) : (triangle->output != 0);
+
+        if (active && triangle->t < cycles)
+            cycles = triangle->t;
+    }
+
+    {
+        const nes_apu_dmc* dmc = &apu->dmc;
+
+        if (!(dmc->silence && !dmc->sample_buffer_loaded) && 2u * dmc->t + odd_delay < cycles)
+            cycles = 2u * dmc->t + odd_delay;
+    }
+
+    return cycles;
+}
+
+// Runs cycles plain steps at once, see nes_apu_plain_cycles
+static void nes_apu_run_plain(nes_apu* apu, uint32_t cycles)
+{
+    const uint32_t odd_cycles = (cycles + (apu->cycle & 1)) >> 1;
+
+    for (int i = 0; i < 2; ++i)
+    {
+        nes_apu_pulse* pulse = &apu->pulse[i];
+
+        uint32_t reloads = nes_apu_timer_advance(&pulse->t, pulse->timer, odd_cycles);
+        if (reloads)
+        {
+            pulse->sequence_output = nes_apu_pulse_sequence_output(pulse->duty, (pulse->sequencer - (reloads - 1)) & 7);
+            pulse->sequencer = (pulse->sequencer - reloads) & 7;
+        }
+    }
+
+    for (uint32_t reloads = nes_apu_timer_advance(&apu->noise.t, apu->noise.timer, odd_cycles); reloads; --reloads)
+        apu->noise.shift_register = (apu->noise.shift_register >> 1) | ((apu->noise.shift_register ^ (apu->noise.shift_register >> (apu->noise.mode * 5 + 1))) << 14);
+
+    // Silent DMC with an empty buffer, only the output unit keeps cycling
+    uint32_t dmc_reloads = nes_apu_timer_advance(&apu->dmc.t, apu->dmc.timer, odd_cycles);
+    if (dmc_reloads)
+    {
+        apu->dmc.shift_register = dmc_reloads >= 8 ? 0 : apu->dmc.shift_register >> dmc_reloads;
+
+        if (apu->dmc.bits_remaining == 0)
+        {
+            apu->dmc.bits_remaining = 8;
+            --dmc_reloads;
+        }
+
+        apu->dmc.bits_remaining = ((apu->dmc.bits_remaining + 7 - dmc_reloads % 8) % 8) + 1;
+    }
+
+    nes_apu_timer_advance(&apu->triangle.t, apu->triangle.timer, cycles);
+
+    apu->cycle += cycles;
+}
+
+// Runs up to max_cycles steps, returns how many ran. Outputs only change when a single step is returned.
+static uint32_t nes_apu_advance(nes_apu* apu, uint32_t max_cycles)
+{
+    uint32_t cycles = nes_apu_plain_cycles(apu);
+
+    if (cycles == 0)
+    {
+        nes_apu_step(apu);
+        return 1;
+    }
+
+    if (cycles > max_cycles)
+        cycles = max_cycles;
+
+    nes_apu_run_plain(apu, cycles);
+
+    return cycles;
+}
+
+// Steps before the frame interrupt or the DMC DMA request can change
+static uint32_t nes_apu_quiet_cycles(const nes_apu* apu)
+{
+    if (apu->reg_rw_mode != NES_APU_REG_RW_MODE_NONE || apu->sequencer_reset_req || apu->dmc.sample_buffer_load_request)
+        return 0;
+
+    uint32_t cycles = UINT32_MAX;
+
+    if (apu->sequencer_mode == 0 && !apu->inhibit_interrupt && !apu->frame_interrupt && apu->cycle <= 29830)
+        cycles = apu->cycle <= 29828 ? 29828 - apu->cycle : 0;
+
+    if (apu->dmc.bytes_remaining)
+    {
+        if (!apu->dmc.sample_buffer_loaded)
+            return 0;
+
+        // The output unit empties the buffer when its last bit is shifted out
+        uint32_t reloads = apu->dmc.bits_remaining ? apu->dmc.bits_remaining : 1;
+        uint32_t dmc_cycles = 2u * apu->dmc.t + ((apu->cycle & 1) ^ 1) + (reloads - 1) * 2u * (apu->dmc.timer + 1);
+
+        if (dmc_cycles < cycles)
+            cycles = dmc_cycles;
+    }
+
+    return cycles;
+}
+
+// Channel outputs packed in one word, the mix only changes when this does
+static uint32_t nes_apu_output_state(const nes_apu* apu)
+{
+    return apu->pulse[0].output | (apu->pulse[1].output << 4) | (apu->triangle.output << 8) |
+           (apu->noise.output << 12) | ((uint32_t)apu->dmc.output << 16);
+}
+
+static int16_t nes_apu_mix(const nes_apu* apu)
+{
+#if 0
+    uint64_t pulse_out = (apu->pulse[0].output + apu->pulse[1].output) * 32298154ULL; 
+    uint64_t tnd_out = apu->triangle.output * 36550171ULL + apu->noise.output * 21217138ULL + apu->dmc.output * 14388140ULL;
+
+    // dividing by 42949672ULL results in output in rage 0-100
+    return (uint16_t)(((pulse_out + tnd_out)/42949672ULL) * 500);
+#else
+    double square_out = 95.88 / ((8128.0 / (apu->pulse[0].output + apu->pulse[1].output)) + 100.0);
+    double tnd_out = 159.79 / ((1.0 / (apu->triangle.output / 8227.0 + apu->noise.output / 12241.0 + apu->dmc.output / 22638.0)) + 100.0);
+
+    return (int16_t)((square_out + tnd_out) * 32767);
+#endif
 }
 
 #endif
@@ -0,0 +1,480 @@
+#include "nes_batch.h"
+
+#include <string.h>
+#include <time.h>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define BATCH_VIDEO_WIDTH   256
+#define BATCH_VIDEO_HEIGHT  224
+
+/////////////////////////////////////////////////
+// Threads
+/////////////////////////////////////////////////
+
+#if _WIN32
+typedef HANDLE              batch_thread;
+typedef CRITICAL_SECTION    batch_mutex;
+typedef CONDITION_VARIABLE  batch_cond;
+
+static void batch_mutex_init(batch_mutex* mutex)                    { InitializeCriticalSection(mutex); }
+static void batch_mutex_destroy(batch_mutex* mutex)                 { DeleteCriticalSection(mutex); }
+static void batch_mutex_lock(batch_mutex* mutex)                    { EnterCriticalSection(mutex); }
+static void batch_mutex_unlock(batch_mutex* mutex)                  { LeaveCriticalSection(mutex); }
+static void batch_cond_init(batch_cond* cond)                       { InitializeConditionVariable(cond); }
+static void batch_cond_destroy(batch_cond* cond)                    {}
+static void batch_cond_wait(batch_cond* cond, batch_mutex* mutex)   { SleepConditionVariableCS(cond, mutex, INFINITE); }
+static void batch_cond_broadcast(batch_cond* cond)                  { WakeAllConditionVariable(cond); }
+
+static uint32_t batch_core_count()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+#else
+typedef pthread_t           batch_thread;
+typedef pthread_mutex_t     batch_mutex;
+typedef pthread_cond_t      batch_cond;
+
+static void batch_mutex_init(batch_mutex* mutex)                    { pthread_mutex_init(mutex, 0); }
+static void batch_mutex_destroy(batch_mutex* mutex)                 { pthread_mutex_destroy(mutex); }
+static void batch_mutex_lock(batch_mutex* mutex)                    { pthread_mutex_lock(mutex); }
+static void batch_mutex_unlock(batch_mutex* mutex)                  { pthread_mutex_unlock(mutex); }
+static void batch_cond_init(batch_cond* cond)                       { pthread_cond_init(cond, 0); }
+static void batch_cond_destroy(batch_cond* cond)                    { pthread_cond_destroy(cond); }
+static void batch_cond_wait(batch_cond* cond, batch_mutex* mutex)   { pthread_cond_wait(cond, mutex); }
+static void batch_cond_broadcast(batch_cond* cond)                  { pthread_cond_broadcast(cond); }
+
+static uint32_t batch_core_count()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+#endif
+
+static uint64_t batch_time_ns()
+{
+    struct timespec ts;
+#if _WIN32
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/////////////////////////////////////////////////
+// Batch
+/////////////////////////////////////////////////
+
+typedef struct batch_instance
+{
+    nes_system*         system;
+    nes_controller_state (*input_callback)(int controller_id, void* client_data);
+    void*               client_data;
+    nes_batch_output    output;
+    uint32_t            audio_capacity;
+    nes_pixel           framebuffer[BATCH_VIDEO_WIDTH * BATCH_VIDEO_HEIGHT];
+} batch_instance;
+
+// Instances a worker runs this step, the owner pops from the tail and idle workers steal from the head
+typedef struct batch_queue
+{
+    batch_mutex lock;
+    size_t*     tasks;
+    size_t      head;
+    size_t      tail;
+} batch_queue;
+
+typedef struct batch_worker
+{
+    nes_batch*      batch;
+    uint32_t        index;
+    batch_thread    thread;
+    int             started;
+} batch_worker;
+
+struct nes_batch
+{
+    batch_instance* instances;
+    size_t          count;
+    uint32_t        thread_count;   // the caller of nes_batch_step is worker 0, the others have a thread each
+    batch_worker*   workers;
+    batch_queue*    queues;
+    batch_mutex     lock;
+    batch_cond      work_ready;
+    batch_cond      work_done;
+    uint64_t        generation;     // bumped once per step to wake the workers
+    size_t          pending;        // instances left to finish this step
+    uint32_t        frame_count;
+    int             quit;
+    uint64_t        frames;
+    uint64_t        elapsed_ns;
+};
+
+static nes_controller_state batch_on_input(int controller_id, void* client_data)
+{
+    batch_instance* instance = (batch_instance*)client_data;
+    return instance->input_callback(controller_id, instance->client_data);
+}
+
+static void batch_on_video(const nes_video_output* video, void* client_data)
+{
+    batch_instance* instance = (batch_instance*)client_data;
+
+    for (uint32_t y = 0; y < video->height; ++y)
+        memcpy(instance->framebuffer + y * video->width, video->framebuffer + y * NES_FRAMEBUFFER_ROW_STRIDE, video->width * sizeof(nes_pixel));
+
+    instance->output.width = video->width;
+    instance->output.height = video->height;
+    instance->output.frame_count++;
+}
+
+static void batch_on_audio(const nes_audio_output* audio, void* client_data)
+{
+    batch_instance* instance = (batch_instance*)client_data;
+    nes_batch_output* output = &instance->output;
+
+    uint32_t sample_count = output->audio_sample_count + audio->sample_count;
+
+    if (sample_count > instance->audio_capacity)
+    {
+        uint32_t capacity = instance->audio_capacity ? instance->audio_capacity : 4096;
+        while (capacity < sample_count)
+            capacity *= 2;
+
+        int16_t* samples = (int16_t*)realloc(output->audio_samples, capacity * sizeof(int16_t));
+        if (!samples)
+            return;
+
+        output->audio_samples = samples;
+        instance->audio_capacity = capacity;
+    }
+
+    memcpy(output->audio_samples + output->audio_sample_count, audio->samples, audio->sample_count * sizeof(int16_t));
+    output->audio_sample_count = sample_count;
+    output->audio_sample_rate = audio->sample_rate;
+}
+
+static void batch_run_instance(nes_batch* batch, batch_instance* instance)
+{
+    nes_run_conditions conditions = { NES_RUN_FRAME };
+
+    instance->output.frame_count = 0;
+    instance->output.audio_sample_count = 0;
+
+    for (uint32_t i = 0; i < batch->frame_count; ++i)
+        nes_system_run_until(instance->system, &conditions);
+}
+
+static int batch_take_task(nes_batch* batch, uint32_t worker, size_t* index)
+{
+    batch_queue* own = &batch->queues[worker];
+    int found = 0;
+
+    batch_mutex_lock(&own->lock);
+    if (own->tail > own->head)
+    {
+        *index = own->tasks[--own->tail];
+        found = 1;
+    }
+    batch_mutex_unlock(&own->lock);
+
+    // No new tasks appear during a step, once every queue is empty the worker is done
+    for (uint32_t i = 1; i < batch->thread_count && !found; ++i)
+    {
+        batch_queue* victim = &batch->queues[(worker + i) % batch->thread_count];
+
+        batch_mutex_lock(&victim->lock);
+        if (victim->tail > victim->head)
+        {
+            *index = victim->tasks[victim->head++];
+            found = 1;
+        }
+        batch_mutex_unlock(&victim->lock);
+    }
+
+    return found;
+}
+
+static void batch_work(nes_batch* batch, uint32_t worker)
+{
+    size_t index;
+
+    while (batch_take_task(batch, worker, &index))
+    {
+        batch_run_instance(batch, &batch->instances[index]);
+
+        batch_mutex_lock(&batch->lock);
+        if (--batch->pending == 0)
+            batch_cond_broadcast(&batch->work_done);
+        batch_mutex_unlock(&batch->lock);
+    }
+}
+
+static void batch_worker_loop(batch_worker* worker)
+{
+    nes_batch* batch = worker->batch;
+    uint64_t generation = 0;
+
+    for (;;)
+    {
+        batch_mutex_lock(&batch->lock);
+        while (!batch->quit && batch->generation == generation)
+            batch_cond_wait(&batch->work_ready, &batch->lock);
+
+        generation = batch->generation;
+        int quit = batch->quit;
+        batch_mutex_unlock(&batch->lock);
+
+        if (quit)
+            return;
+
+        batch_work(batch, worker->index);
+    }
+}
+
+#if _WIN32
+static DWORD WINAPI batch_worker_main(LPVOID arg)
+{
+    batch_worker_loop((batch_worker*)arg);
+    return 0;
+}
+
+static int batch_thread_start(batch_worker* worker)
+{
+    worker->thread = CreateThread(0, 0, &batch_worker_main, worker, 0, 0);
+    worker->started = worker->thread != 0;
+    return worker->started;
+}
+
+static void batch_thread_join(batch_worker* worker)
+{
+    WaitForSingleObject(worker->thread, INFINITE);
+    CloseHandle(worker->thread);
+}
+#else
+static void* batch_worker_main(void* arg)
+{
+    batch_worker_loop((batch_worker*)arg);
+    return 0;
+}
+
+static int batch_thread_start(batch_worker* worker)
+{
+    worker->started = pthread_create(&worker->thread, 0, &batch_worker_main, worker) == 0;
+    return worker->started;
+}
+
+static void batch_thread_join(batch_worker* worker)
+{
+    pthread_join(worker->thread, 0);
+}
+#endif
+
+/////////////////////////////////////////////////
+// Public
+/////////////////////////////////////////////////
+
+nes_batch* nes_batch_create(nes_config* configs, size_t count, uint32_t thread_count)
+{
+    nes_batch* batch = (nes_batch*)calloc(1, sizeof(nes_batch));
+    if (!batch)
+        return 0;
+
+    if (thread_count == 0)
+        thread_count = batch_core_count();
+
+    if (thread_count > count)
+        thread_count = count ? (uint32_t)count : 1;
+
+    batch->count = count;
+    batch->thread_count = thread_count;
+
+    batch_mutex_init(&batch->lock);
+    batch_cond_init(&batch->work_ready);
+    batch_cond_init(&batch->work_done);
+
+    batch->instances = (batch_instance*)calloc(count ? count : 1, sizeof(batch_instance));
+    batch->queues = (batch_queue*)calloc(thread_count, sizeof(batch_queue));
+    batch->workers = (batch_worker*)calloc(thread_count, sizeof(batch_worker));
+
+    if (!batch->instances || !batch->queues || !batch->workers)
+    {
+        nes_batch_destroy(batch);
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < thread_count; ++i)
+    {
+        batch_mutex_init(&batch->queues[i].lock);
+        batch->workers[i].batch = batch;
+        batch->workers[i].index = i;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        batch_instance* instance = &batch->instances[i];
+        nes_config config = configs[i];
+
+        instance->input_callback = config.input_callback;
+        instance->client_data = config.client_data;
+        instance->output.framebuffer = instance->framebuffer;
+
+        config.client_data = instance;
+        config.input_callback = config.input_callback ? &batch_on_input : 0;
+        config.video_callback = &batch_on_video;
+        config.audio_callback = &batch_on_audio;
+
+        instance->system = nes_system_create(&config);
+        if (!instance->system)
+        {
+            nes_batch_destroy(batch);
+            return 0;
+        }
+    }
+
+    for (uint32_t i = 0; i < thread_count; ++i)
+    {
+        batch->queues[i].tasks = (size_t*)malloc((count ? count : 1) * sizeof(size_t));
+        if (!batch->queues[i].tasks)
+        {
+            nes_batch_destroy(batch);
+            return 0;
+        }
+    }
+
+    // Worker 0 is whoever calls nes_batch_step
+    for (uint32_t i = 1; i < thread_count; ++i)
+    {
+        if (!batch_thread_start(&batch->workers[i]))
+        {
+            nes_batch_destroy(batch);
+            return 0;
+        }
+    }
+
+    return batch;
+}
+
+void nes_batch_destroy(nes_batch* batch)
+{
+    batch_mutex_lock(&batch->lock);
+    batch->quit = 1;
+    batch_cond_broadcast(&batch->work_ready);
+    batch_mutex_unlock(&batch->lock);
+
+    if (batch->workers)
+    {
+        for (uint32_t i = 1; i < batch->thread_count; ++i)
+        {
+            if (batch->workers[i].started)
+                batch_thread_join(&batch->workers[i]);
+        }
+    }
+
+    if (batch->queues)
+    {
+        for (uint32_t i = 0; i < batch->thread_count; ++i)
+        {
+            if (batch->workers && batch->workers[i].batch)
+                batch_mutex_destroy(&batch->queues[i].lock);
+
+            free(batch->queues[i].tasks);
+        }
+    }
+
+    if (batch->instances)
+    {
+        for (size_t i = 0; i < batch->count; ++i)
+        {
+            if (batch->instances[i].system)
+                nes_system_destroy(batch->instances[i].system);
+
+            free(batch->instances[i].output.audio_samples);
+        }
+    }
+
+    batch_cond_destroy(&batch->work_done);
+    batch_cond_destroy(&batch->work_ready);
+    batch_mutex_destroy(&batch->lock);
+
+    free(batch->workers);
+    free(batch->queues);
+    free(batch->instances);
+    free(batch);
+}
+
+size_t nes_batch_get_count(nes_batch* batch)
+{
+    return batch->count;
+}
+
+nes_system* nes_batch_get_system(nes_batch* batch, size_t index)
+{
+    return index < batch->count ? batch->instances[index].system : 0;
+}
+
+void nes_batch_step(nes_batch* batch, uint32_t frame_count)
+{
+    if (!batch->count || !frame_count)
+        return;
+
+    uint64_t begin = batch_time_ns();
+
+    // Set the step up before any task becomes visible, a worker still scanning the queues may pick one up right away
+    batch_mutex_lock(&batch->lock);
+    batch->pending = batch->count;
+    batch->frame_count = frame_count;
+    batch_mutex_unlock(&batch->lock);
+
+    for (uint32_t i = 0; i < batch->thread_count; ++i)
+    {
+        batch_queue* queue = &batch->queues[i];
+
+        batch_mutex_lock(&queue->lock);
+        queue->head = 0;
+        queue->tail = 0;
+
+        for (size_t index = i; index < batch->count; index += batch->thread_count)
+            queue->tasks[queue->tail++] = index;
+
+        batch_mutex_unlock(&queue->lock);
+    }
+
+    batch_mutex_lock(&batch->lock);
+    batch->generation++;
+    batch_cond_broadcast(&batch->work_ready);
+    batch_mutex_unlock(&batch->lock);
+
+    batch_work(batch, 0);
+
+    batch_mutex_lock(&batch->lock);
+    while (batch->pending)
+        batch_cond_wait(&batch->work_done, &batch->lock);
+    batch_mutex_unlock(&batch->lock);
+
+    batch->frames += (uint64_t)batch->count * frame_count;
+    batch->elapsed_ns += batch_time_ns() - begin;
+}
+
+const nes_batch_output* nes_batch_get_output(nes_batch* batch, size_t index)
+{
+    return index < batch->count ? &batch->instances[index].output : 0;
+}
+
+nes_batch_stats nes_batch_get_stats(nes_batch* batch)
+{
+    nes_batch_stats stats;
+    stats.frames = batch->frames;
+    stats.elapsed_ns = batch->elapsed_ns;
+    stats.frames_per_sec = batch->elapsed_ns ? batch->frames * 1e9 / batch->elapsed_ns : 0.0;
+    stats.thread_count = batch->thread_count;
+    return stats;
+}
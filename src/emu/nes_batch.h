@@ -0,0 +1,52 @@
+#ifndef _NES_BATCH_H_
+#define _NES_BATCH_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "nes_system.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Output an instance produced during the last nes_batch_step
+typedef struct nes_batch_output
+{
+    nes_pixel*  framebuffer;        // last video frame, width x height pixels without row padding
+    uint16_t    width;
+    uint16_t    height;
+    uint32_t    frame_count;        // video frames output
+    int16_t*    audio_samples;
+    uint32_t    audio_sample_count;
+    uint32_t    audio_sample_rate;
+} nes_batch_output;
+
+typedef struct nes_batch_stats
+{
+    uint64_t    frames;             // frames run by all instances since the batch was created
+    uint64_t    elapsed_ns;         // wall time spent in nes_batch_step
+    double      frames_per_sec;     // aggregate over all instances
+    uint32_t    thread_count;
+} nes_batch_stats;
+
+typedef struct nes_batch nes_batch;
+
+// Creates one system per config, video and audio are collected by the batch, input_callback is still called.
+// thread_count 0 uses one thread per core. Returns 0 if any system fails to create
+nes_batch*  nes_batch_create(nes_config* configs, size_t count, uint32_t thread_count);
+void        nes_batch_destroy(nes_batch* batch);
+
+size_t      nes_batch_get_count(nes_batch* batch);
+nes_system* nes_batch_get_system(nes_batch* batch, size_t index);
+
+// Runs every system frame_count frames, spread over the worker threads
+void        nes_batch_step(nes_batch* batch, uint32_t frame_count);
+
+const nes_batch_output* nes_batch_get_output(nes_batch* batch, size_t index);
+nes_batch_stats         nes_batch_get_stats(nes_batch* batch);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
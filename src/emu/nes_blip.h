@@ -0,0 +1,103 @@
+#ifndef _NES_BLIP_H_
+#define _NES_BLIP_H_
+
+#include <stdint.h>
+#include <memory.h>
+#include <math.h>
+
+// Band-limited synthesis, amplitude changes are added as windowed sinc impulses at the output rate
+// and integrated when read back, so no sample is computed at the source clock rate.
+
+#define NES_BLIP_PHASE_BITS     6
+#define NES_BLIP_PHASES         (1 << NES_BLIP_PHASE_BITS)
+#define NES_BLIP_WIDTH          16
+#define NES_BLIP_KERNEL_BITS    12
+#define NES_BLIP_MAX_SAMPLES    4096
+
+typedef struct nes_blip
+{
+    uint64_t    factor;     // output samples per clock, 32.32 fixed point
+    uint64_t    offset;     // position of clock 0 in the buffer, 32.32 fixed point
+    int32_t     integrator;
+    int16_t     kernel[NES_BLIP_PHASES][NES_BLIP_WIDTH];
+    int32_t     buffer[NES_BLIP_MAX_SAMPLES + NES_BLIP_WIDTH];
+} nes_blip;
+
+static void nes_blip_init(nes_blip* blip, uint32_t clock_rate, uint32_t sample_rate)
+{
+    const double pi = 3.14159265358979323846;
+    const double cutoff = 0.45; // fraction of the output rate, keeps the transition band below Nyquist
+
+    memset(blip, 0, sizeof(nes_blip));
+    blip->factor = ((uint64_t)sample_rate << 32) / clock_rate;
+
+    for (int phase = 0; phase < NES_BLIP_PHASES; ++phase)
+    {
+        double taps[NES_BLIP_WIDTH];
+        double sum = 0.0;
+
+        for (int i = 0; i < NES_BLIP_WIDTH; ++i)
+        {
+            double t = i - (NES_BLIP_WIDTH / 2 - 1) - (double)phase / NES_BLIP_PHASES;
+            double x = 2.0 * pi * cutoff * t;
+            double window = 0.42 + 0.5 * cos(pi * t / (NES_BLIP_WIDTH / 2)) + 0.08 * cos(2.0 * pi * t / (NES_BLIP_WIDTH / 2));
+
+            taps[i] = (x == 0.0 ? 1.0 : sin(x) / x) * (window > 0.0 ? window : 0.0);
+            sum += taps[i];
+        }
+
+        // Every phase must add exactly one unit step, otherwise the integrator drifts
+        int32_t total = 0;
+        for (int i = 0; i < NES_BLIP_WIDTH; ++i)
+        {
+            blip->kernel[phase][i] = (int16_t)floor(taps[i] / sum * (1 << NES_BLIP_KERNEL_BITS) + 0.5);
+            total += blip->kernel[phase][i];
+        }
+
+        blip->kernel[phase][NES_BLIP_WIDTH / 2 - 1] += (int16_t)((1 << NES_BLIP_KERNEL_BITS) - total);
+    }
+}
+
+// Amplitude change of delta at clock_time, counted from the end of the previous frame
+static void nes_blip_add_delta(nes_blip* blip, uint32_t clock_time, int32_t delta)
+{
+    uint64_t fixed  = clock_time * blip->factor + blip->offset;
+    int32_t* out    = blip->buffer + (fixed >> 32);
+    const int16_t* kernel = blip->kernel[(fixed >> (32 - NES_BLIP_PHASE_BITS)) & (NES_BLIP_PHASES - 1)];
+
+    for (int i = 0; i < NES_BLIP_WIDTH; ++i)
+        out[i] += kernel[i] * delta;
+}
+
+// Close a frame of clock_count clocks, returns the number of samples ready to read
+static uint32_t nes_blip_end_frame(nes_blip* blip, uint32_t clock_count)
+{
+    blip->offset += clock_count * blip->factor;
+    return (uint32_t)(blip->offset >> 32);
+}
+
+static uint32_t nes_blip_read_samples(nes_blip* blip, int16_t* out, uint32_t max_count)
+{
+    uint32_t count = (uint32_t)(blip->offset >> 32);
+    if (count > max_count)
+        count = max_count;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        blip->integrator += blip->buffer[i];
+
+        int32_t sample = blip->integrator >> NES_BLIP_KERNEL_BITS;
+        out[i] = (int16_t)(sample < -32768 ? -32768 : (sample > 32767 ? 32767 : sample));
+    }
+
+    // Shift the pending tail of the impulses to the start of the buffer
+    uint32_t remaining = (uint32_t)(blip->offset >> 32) - count + NES_BLIP_WIDTH;
+    memmove(blip->buffer, blip->buffer + count, remaining * sizeof(int32_t));
+    memset(blip->buffer + remaining, 0, count * sizeof(int32_t));
+
+    blip->offset -= (uint64_t)count << 32;
+
+    return count;
+}
+
+#endif
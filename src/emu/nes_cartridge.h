@@ -14,6 +14,22 @@ typedef enum nes_nametable_mirroring
 
 typedef struct nes_mapper nes_mapper;
 
+// PRG and CHR ROM shared by every cartridge running it, never written once created. See nes_rom_image_create
+typedef struct nes_rom_image
+{
+    uint8_t*    prg_rom;
+    size_t      prg_rom_size;
+    uint8_t*    chr_rom;
+    size_t      chr_rom_size;
+    int         mapper_id;
+    int         alternative_nametable_layout;
+    nes_nametable_mirroring mirroring;
+    volatile long refs;         // cartridges and callers holding the image, see nes_rom_image_release
+    void*       mapping;        // read only mapping the ROM lives in, 0 when it follows the struct in its allocation
+    size_t      mapping_size;
+    int         shared_fd;      // memfd other processes can pass to nes_rom_image_open_shared, -1 when private
+} nes_rom_image;
+
 typedef struct nes_cartridge
 {
     void*       state;
@@ -24,8 +40,17 @@ typedef struct nes_cartridge
     size_t      chr_rom_size;
     uint8_t*    chr_ram;
     size_t      chr_ram_size;
+    uint8_t*    prg_banks[4];   // 8 KB PRG ROM windows at $8000-$FFFF as currently mapped, see nes_mapper.map_banks
+    uint8_t*    prg_ram_read;   // 8 KB PRG RAM window at $6000-$7FFF, 0 when the mapper decodes the access
+    uint8_t*    prg_ram_write;
+    uint8_t*    prg_ram;        // PRG RAM in state whatever the mapper exports, 0 when there is none. Mapper RAM runs from here to the end of state
+    size_t      prg_ram_size;
+    uint8_t*    chr_banks[8];   // 1 KB pattern table windows for PPU reads, 0 when the mapper decodes the access
+    uint8_t*    nametable_banks[4]; // 1 KB nametables at $2000-$2FFF, 0 when the mapper decodes the access
+    uint8_t*    ciram;          // console nametable RAM, attached by the system so the mapper can mirror it into nametable_banks
     nes_mapper*             mapper;
     nes_nametable_mirroring mirroring;
+    nes_rom_image*          rom;    // prg_rom and chr_rom point into it, the cartridge holds a reference
 } nes_cartridge;
 
 #endif
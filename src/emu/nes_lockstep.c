@@ -0,0 +1,639 @@
+#include "nes_lockstep.h"
+#include "nes_system_internal.h"
+
+#include <string.h>
+
+/////////////////////////////////////////////////
+// Group executor
+/////////////////////////////////////////////////
+
+// Addressing of the instructions the group executor runs, LOCKSTEP_MODE_NONE instructions run on every lane on its own
+enum
+{
+    LOCKSTEP_MODE_NONE,
+    LOCKSTEP_MODE_IMP,
+    LOCKSTEP_MODE_IMM,
+    LOCKSTEP_MODE_ZP,
+    LOCKSTEP_MODE_ZP_X,
+    LOCKSTEP_MODE_ZP_Y,
+    LOCKSTEP_MODE_ABS,
+    LOCKSTEP_MODE_ABS_X,
+    LOCKSTEP_MODE_ABS_Y,
+    LOCKSTEP_MODE_IND_Y,
+    LOCKSTEP_MODE_REL,
+    LOCKSTEP_MODE_JMP,
+    LOCKSTEP_MODE_JSR,
+    LOCKSTEP_MODE_RTS,
+    LOCKSTEP_MODE_PUSH,
+    LOCKSTEP_MODE_PULL
+};
+
+enum
+{
+    LOCKSTEP_ACCESS_READ,
+    LOCKSTEP_ACCESS_WRITE,
+    LOCKSTEP_ACCESS_MODIFY
+};
+
+enum
+{
+    LOCKSTEP_OP_NOP,
+    LOCKSTEP_OP_LDA, LOCKSTEP_OP_LDX, LOCKSTEP_OP_LDY,
+    LOCKSTEP_OP_STA, LOCKSTEP_OP_STX, LOCKSTEP_OP_STY,
+    LOCKSTEP_OP_AND, LOCKSTEP_OP_ORA, LOCKSTEP_OP_EOR, LOCKSTEP_OP_ADC, LOCKSTEP_OP_SBC, LOCKSTEP_OP_BIT,
+    LOCKSTEP_OP_CMP, LOCKSTEP_OP_CPX, LOCKSTEP_OP_CPY,
+    LOCKSTEP_OP_INC, LOCKSTEP_OP_DEC, LOCKSTEP_OP_ASL, LOCKSTEP_OP_LSR, LOCKSTEP_OP_ROL, LOCKSTEP_OP_ROR,
+    LOCKSTEP_OP_ASL_A, LOCKSTEP_OP_LSR_A, LOCKSTEP_OP_ROL_A, LOCKSTEP_OP_ROR_A,
+    LOCKSTEP_OP_INX, LOCKSTEP_OP_INY, LOCKSTEP_OP_DEX, LOCKSTEP_OP_DEY,
+    LOCKSTEP_OP_TAX, LOCKSTEP_OP_TAY, LOCKSTEP_OP_TXA, LOCKSTEP_OP_TYA, LOCKSTEP_OP_TSX, LOCKSTEP_OP_TXS,
+    LOCKSTEP_OP_CLC, LOCKSTEP_OP_SEC, LOCKSTEP_OP_CLI, LOCKSTEP_OP_SEI, LOCKSTEP_OP_CLV, LOCKSTEP_OP_CLD, LOCKSTEP_OP_SED,
+    LOCKSTEP_OP_BPL, LOCKSTEP_OP_BMI, LOCKSTEP_OP_BVC, LOCKSTEP_OP_BVS, LOCKSTEP_OP_BCC, LOCKSTEP_OP_BCS, LOCKSTEP_OP_BNE, LOCKSTEP_OP_BEQ
+};
+
+typedef struct lockstep_instruction
+{
+    uint8_t mode;
+    uint8_t access;
+    uint8_t op;
+} lockstep_instruction;
+
+#define _LOCKSTEP_READ(mode, op)    { LOCKSTEP_MODE_##mode, LOCKSTEP_ACCESS_READ, LOCKSTEP_OP_##op }
+#define _LOCKSTEP_WRITE(mode, op)   { LOCKSTEP_MODE_##mode, LOCKSTEP_ACCESS_WRITE, LOCKSTEP_OP_##op }
+#define _LOCKSTEP_MODIFY(mode, op)  { LOCKSTEP_MODE_##mode, LOCKSTEP_ACCESS_MODIFY, LOCKSTEP_OP_##op }
+
+// Official instructions with direct memory operands, the rest goes through nes_system_run_step
+static const lockstep_instruction lockstep_instructions[0x100] =
+{
+    [IC_NOP] = _LOCKSTEP_READ(IMP, NOP),
+    [IC_INX] = _LOCKSTEP_READ(IMP, INX), [IC_INY] = _LOCKSTEP_READ(IMP, INY),
+    [IC_DEX] = _LOCKSTEP_READ(IMP, DEX), [IC_DEY] = _LOCKSTEP_READ(IMP, DEY),
+    [IC_TAX] = _LOCKSTEP_READ(IMP, TAX), [IC_TAY] = _LOCKSTEP_READ(IMP, TAY), [IC_TXA] = _LOCKSTEP_READ(IMP, TXA),
+    [IC_TYA] = _LOCKSTEP_READ(IMP, TYA), [IC_TSX] = _LOCKSTEP_READ(IMP, TSX), [IC_TXS] = _LOCKSTEP_READ(IMP, TXS),
+    [IC_CLC] = _LOCKSTEP_READ(IMP, CLC), [IC_SEC] = _LOCKSTEP_READ(IMP, SEC), [IC_CLI] = _LOCKSTEP_READ(IMP, CLI),
+    [IC_SEI] = _LOCKSTEP_READ(IMP, SEI), [IC_CLV] = _LOCKSTEP_READ(IMP, CLV), [IC_CLD] = _LOCKSTEP_READ(IMP, CLD),
+    [IC_SED] = _LOCKSTEP_READ(IMP, SED),
+    [IC_ASL_ACC] = _LOCKSTEP_READ(IMP, ASL_A), [IC_LSR_ACC] = _LOCKSTEP_READ(IMP, LSR_A),
+    [IC_ROL_ACC] = _LOCKSTEP_READ(IMP, ROL_A), [IC_ROR_ACC] = _LOCKSTEP_READ(IMP, ROR_A),
+
+    [IC_LDA_IMM] = _LOCKSTEP_READ(IMM, LDA), [IC_LDA_ZP] = _LOCKSTEP_READ(ZP, LDA), [IC_LDA_ZP_X] = _LOCKSTEP_READ(ZP_X, LDA),
+    [IC_LDA_ABS] = _LOCKSTEP_READ(ABS, LDA), [IC_LDA_ABS_X] = _LOCKSTEP_READ(ABS_X, LDA), [IC_LDA_ABS_Y] = _LOCKSTEP_READ(ABS_Y, LDA),
+    [IC_LDA_IND_Y] = _LOCKSTEP_READ(IND_Y, LDA),
+    [IC_LDX_IMM] = _LOCKSTEP_READ(IMM, LDX), [IC_LDX_ZP] = _LOCKSTEP_READ(ZP, LDX), [IC_LDX_ZP_Y] = _LOCKSTEP_READ(ZP_Y, LDX),
+    [IC_LDX_ABS] = _LOCKSTEP_READ(ABS, LDX), [IC_LDX_ABS_Y] = _LOCKSTEP_READ(ABS_Y, LDX),
+    [IC_LDY_IMM] = _LOCKSTEP_READ(IMM, LDY), [IC_LDY_ZP] = _LOCKSTEP_READ(ZP, LDY), [IC_LDY_ZP_X] = _LOCKSTEP_READ(ZP_X, LDY),
+    [IC_LDY_ABS] = _LOCKSTEP_READ(ABS, LDY), [IC_LDY_ABS_X] = _LOCKSTEP_READ(ABS_X, LDY),
+
+    [IC_STA_ZP] = _LOCKSTEP_WRITE(ZP, STA), [IC_STA_ZP_X] = _LOCKSTEP_WRITE(ZP_X, STA), [IC_STA_ABS] = _LOCKSTEP_WRITE(ABS, STA),
+    [IC_STA_ABS_X] = _LOCKSTEP_WRITE(ABS_X, STA), [IC_STA_ABS_Y] = _LOCKSTEP_WRITE(ABS_Y, STA), [IC_STA_IND_Y] = _LOCKSTEP_WRITE(IND_Y, STA),
+    [IC_STX_ZP] = _LOCKSTEP_WRITE(ZP, STX), [IC_STX_ZP_Y] = _LOCKSTEP_WRITE(ZP_Y, STX), [IC_STX_ABS] = _LOCKSTEP_WRITE(ABS, STX),
+    [IC_STY_ZP] = _LOCKSTEP_WRITE(ZP, STY), [IC_STY_ZP_X] = _LOCKSTEP_WRITE(ZP_X, STY), [IC_STY_ABS] = _LOCKSTEP_WRITE(ABS, STY),
+
+#define _LOCKSTEP_ALU(name) \
+    [IC_##name##_IMM] = _LOCKSTEP_READ(IMM, name), [IC_##name##_ZP] = _LOCKSTEP_READ(ZP, name), [IC_##name##_ZP_X] = _LOCKSTEP_READ(ZP_X, name),\
+    [IC_##name##_ABS] = _LOCKSTEP_READ(ABS, name), [IC_##name##_ABS_X] = _LOCKSTEP_READ(ABS_X, name), [IC_##name##_ABS_Y] = _LOCKSTEP_READ(ABS_Y, name),\
+    [IC_##name##_IND_Y] = _LOCKSTEP_READ(IND_Y, name)
+
+    _LOCKSTEP_ALU(AND), _LOCKSTEP_ALU(ORA), _LOCKSTEP_ALU(EOR), _LOCKSTEP_ALU(ADC), _LOCKSTEP_ALU(SBC), _LOCKSTEP_ALU(CMP),
+
+#undef _LOCKSTEP_ALU
+
+    [IC_CPX_IMM] = _LOCKSTEP_READ(IMM, CPX), [IC_CPX_ZP] = _LOCKSTEP_READ(ZP, CPX), [IC_CPX_ABS] = _LOCKSTEP_READ(ABS, CPX),
+    [IC_CPY_IMM] = _LOCKSTEP_READ(IMM, CPY), [IC_CPY_ZP] = _LOCKSTEP_READ(ZP, CPY), [IC_CPY_ABS] = _LOCKSTEP_READ(ABS, CPY),
+    [IC_BIT_ZP] = _LOCKSTEP_READ(ZP, BIT), [IC_BIT_ABS] = _LOCKSTEP_READ(ABS, BIT),
+
+#define _LOCKSTEP_RMW(name) \
+    [IC_##name##_ZP] = _LOCKSTEP_MODIFY(ZP, name), [IC_##name##_ZP_X] = _LOCKSTEP_MODIFY(ZP_X, name),\
+    [IC_##name##_ABS] = _LOCKSTEP_MODIFY(ABS, name), [IC_##name##_ABS_X] = _LOCKSTEP_MODIFY(ABS_X, name)
+
+    _LOCKSTEP_RMW(INC), _LOCKSTEP_RMW(DEC), _LOCKSTEP_RMW(ASL), _LOCKSTEP_RMW(LSR), _LOCKSTEP_RMW(ROL), _LOCKSTEP_RMW(ROR),
+
+#undef _LOCKSTEP_RMW
+
+    [IC_BPL] = _LOCKSTEP_READ(REL, BPL), [IC_BMI] = _LOCKSTEP_READ(REL, BMI), [IC_BVC] = _LOCKSTEP_READ(REL, BVC),
+    [IC_BVS] = _LOCKSTEP_READ(REL, BVS), [IC_BCC] = _LOCKSTEP_READ(REL, BCC), [IC_BCS] = _LOCKSTEP_READ(REL, BCS),
+    [IC_BNE] = _LOCKSTEP_READ(REL, BNE), [IC_BEQ] = _LOCKSTEP_READ(REL, BEQ),
+
+    [IC_JMP] = _LOCKSTEP_READ(JMP, NOP),
+    [IC_JSR] = _LOCKSTEP_READ(JSR, NOP),
+    [IC_RTS] = _LOCKSTEP_READ(RTS, NOP),
+    [IC_PHA] = _LOCKSTEP_WRITE(PUSH, STA),
+    [IC_PLA] = _LOCKSTEP_READ(PULL, LDA),
+};
+
+struct nes_lockstep
+{
+    nes_system*         systems[NES_LOCKSTEP_MAX_LANES];
+    size_t              count;
+    nes_lockstep_stats  stats;
+    nes_system*         active[NES_LOCKSTEP_MAX_LANES];     // lanes that have not reached the frame yet
+    nes_system*         candidates[NES_LOCKSTEP_MAX_LANES]; // lanes at an instruction cpu_execute_instruction could run
+
+    // Group being run, the CPU registers of its lanes are kept one array per register so every step of the
+    // instruction is a loop over the lanes
+    nes_system*         group[NES_LOCKSTEP_MAX_LANES];
+    uint16_t            PC[NES_LOCKSTEP_MAX_LANES];
+    uint16_t            address[NES_LOCKSTEP_MAX_LANES];
+    uint8_t             A[NES_LOCKSTEP_MAX_LANES];
+    uint8_t             X[NES_LOCKSTEP_MAX_LANES];
+    uint8_t             Y[NES_LOCKSTEP_MAX_LANES];
+    uint8_t             S[NES_LOCKSTEP_MAX_LANES];
+    uint8_t             P[NES_LOCKSTEP_MAX_LANES];
+    uint8_t             data[NES_LOCKSTEP_MAX_LANES];
+    uint8_t             cycles[NES_LOCKSTEP_MAX_LANES];
+    uint8_t             failed[NES_LOCKSTEP_MAX_LANES];     // an access is not plain memory, the lane runs the instruction on its own
+};
+
+static inline int lockstep_read(nes_system* system, uint16_t address, uint8_t* data)
+{
+    const uint8_t* memory = nes_system_cpu_pages(system)[address >> 8].read;
+
+    if (!memory)
+        return 0;
+
+    *data = memory[address & 0xFF];
+    return 1;
+}
+
+static inline int lockstep_writable(nes_system* system, uint16_t address)
+{
+    return nes_system_cpu_pages(system)[address >> 8].write != 0;
+}
+
+static int lockstep_branch_taken(uint8_t op, uint8_t p)
+{
+    switch (op)
+    {
+        case LOCKSTEP_OP_BPL: return (p & 0x80) == 0;
+        case LOCKSTEP_OP_BMI: return (p & 0x80) != 0;
+        case LOCKSTEP_OP_BVC: return (p & 0x40) == 0;
+        case LOCKSTEP_OP_BVS: return (p & 0x40) != 0;
+        case LOCKSTEP_OP_BCC: return (p & 0x01) == 0;
+        case LOCKSTEP_OP_BCS: return (p & 0x01) != 0;
+        case LOCKSTEP_OP_BNE: return (p & 0x02) == 0;
+        default:              return (p & 0x02) != 0;
+    }
+}
+
+// Bus accesses of one lane, leaves address, data and cycles where cpu_execute_instruction would. Returns 0 when
+// an access is not plain memory, before anything was written
+static int lockstep_lane_access(nes_lockstep* lockstep, size_t lane, const lockstep_instruction* instruction, const uint8_t* operands)
+{
+    nes_system* system = lockstep->group[lane];
+    uint16_t pc = lockstep->PC[lane];
+    uint16_t address = 0;
+    uint16_t base = 0;
+    uint8_t  index = 0;
+    uint8_t  access = instruction->access;
+    int      indexed = 0;
+    int      cycles = 0;
+
+    switch (instruction->mode)
+    {
+        case LOCKSTEP_MODE_IMP:
+            lockstep->cycles[lane] = 2;
+            return 1;
+
+        case LOCKSTEP_MODE_IMM:
+            lockstep->address[lane] = pc;
+            lockstep->data[lane] = operands[0];
+            lockstep->PC[lane] = pc + 1;
+            lockstep->cycles[lane] = 2;
+            return 1;
+
+        case LOCKSTEP_MODE_REL:
+            lockstep->address[lane] = pc;
+            lockstep->data[lane] = operands[0];
+            lockstep->PC[lane] = pc + 1;
+            lockstep->cycles[lane] = 2;
+
+            if (lockstep_branch_taken(instruction->op, lockstep->P[lane]))
+            {
+                address = (uint16_t)(pc + 1 + (int8_t)operands[0]);
+                lockstep->cycles[lane] = ((address & 0xFF00) != ((pc + 1) & 0xFF00)) ? 4 : 3;
+                lockstep->address[lane] = address;
+                lockstep->PC[lane] = address;
+            }
+            return 1;
+
+        case LOCKSTEP_MODE_JMP:
+            lockstep->address[lane] = pc + 1;
+            lockstep->data[lane] = operands[1];
+            lockstep->PC[lane] = operands[0] | (operands[1] << 8);
+            lockstep->cycles[lane] = 3;
+            return 1;
+
+        case LOCKSTEP_MODE_JSR:
+        {
+            uint8_t s = lockstep->S[lane];
+            uint16_t ret = pc + 1;
+
+            if (!lockstep_writable(system, 0x0100 | s) || !lockstep_writable(system, 0x0100 | (uint8_t)(s - 1)))
+                return 0;
+
+            const cpu_page* stack = &nes_system_cpu_pages(system)[0x01];
+            stack->write[s] = ret >> 8;
+            stack->write[(uint8_t)(s - 1)] = ret & 0xFF;
+            *stack->dirty = 1;
+
+            // The high byte is read after the pushes, like the CPU does
+            if (!lockstep_read(system, ret, &lockstep->data[lane]))
+                return 0;
+
+            lockstep->S[lane] = s - 2;
+            lockstep->address[lane] = ret;
+            lockstep->PC[lane] = operands[0] | (lockstep->data[lane] << 8);
+            lockstep->cycles[lane] = 6;
+            return 1;
+        }
+
+        case LOCKSTEP_MODE_RTS:
+        {
+            uint8_t s = lockstep->S[lane];
+            uint8_t low;
+
+            if (!lockstep_read(system, 0x0100 | (uint8_t)(s + 1), &low) || !lockstep_read(system, 0x0100 | (uint8_t)(s + 2), &lockstep->data[lane]))
+                return 0;
+
+            lockstep->S[lane] = s + 2;
+            lockstep->address[lane] = 0x0100 | (uint8_t)(s + 2);
+            lockstep->PC[lane] = ((lockstep->data[lane] << 8) | low) + 1;
+            lockstep->cycles[lane] = 6;
+            return 1;
+        }
+
+        case LOCKSTEP_MODE_PUSH:
+            address = 0x0100 | lockstep->S[lane];
+            if (!lockstep_writable(system, address))
+                return 0;
+
+            lockstep->S[lane]--;
+            lockstep->address[lane] = address;
+            lockstep->cycles[lane] = 3;
+            return 1;
+
+        case LOCKSTEP_MODE_PULL:
+            address = 0x0100 | (uint8_t)(lockstep->S[lane] + 1);
+            if (!lockstep_read(system, address, &lockstep->data[lane]))
+                return 0;
+
+            lockstep->S[lane]++;
+            lockstep->address[lane] = address;
+            lockstep->cycles[lane] = 4;
+            return 1;
+
+        case LOCKSTEP_MODE_ZP:
+            address = operands[0];
+            cycles = 3;
+            lockstep->PC[lane] = pc + 1;
+            break;
+
+        case LOCKSTEP_MODE_ZP_X:
+        case LOCKSTEP_MODE_ZP_Y:
+            address = (operands[0] + (instruction->mode == LOCKSTEP_MODE_ZP_X ? lockstep->X[lane] : lockstep->Y[lane])) & 0xFF;
+            cycles = 4;
+            lockstep->PC[lane] = pc + 1;
+            break;
+
+        case LOCKSTEP_MODE_ABS:
+            address = operands[0] | (operands[1] << 8);
+            cycles = 4;
+            lockstep->PC[lane] = pc + 2;
+            break;
+
+        case LOCKSTEP_MODE_ABS_X:
+        case LOCKSTEP_MODE_ABS_Y:
+            base = operands[0] | (operands[1] << 8);
+            index = instruction->mode == LOCKSTEP_MODE_ABS_X ? lockstep->X[lane] : lockstep->Y[lane];
+            indexed = 1;
+            cycles = 4;
+            lockstep->PC[lane] = pc + 2;
+            break;
+
+        case LOCKSTEP_MODE_IND_Y:
+        {
+            uint8_t low, high;
+
+            if (!lockstep_read(system, operands[0], &low) || !lockstep_read(system, (operands[0] + 1) & 0xFF, &high))
+                return 0;
+
+            base = low | (high << 8);
+            index = lockstep->Y[lane];
+            indexed = 1;
+            cycles = 5;
+            lockstep->PC[lane] = pc + 1;
+            break;
+        }
+    }
+
+    if (indexed)
+    {
+        int page_cross = ((base & 0xFF) + index) >> 8;
+        uint8_t dummy;
+
+        // The uncorrected address is always read first, reads only retry on a page cross
+        address = (base & 0xFF00) | ((base + index) & 0xFF);
+        if (!lockstep_read(system, address, &dummy))
+            return 0;
+
+        address += page_cross * 0x0100;
+
+        if (access == LOCKSTEP_ACCESS_READ)
+            cycles += page_cross;
+        else
+            cycles += 1;
+    }
+
+    if (access != LOCKSTEP_ACCESS_WRITE && !lockstep_read(system, address, &lockstep->data[lane]))
+        return 0;
+
+    if (access != LOCKSTEP_ACCESS_READ && !lockstep_writable(system, address))
+        return 0;
+
+    if (access == LOCKSTEP_ACCESS_MODIFY)
+        cycles += 2;
+
+    lockstep->address[lane] = address;
+    lockstep->cycles[lane] = cycles;
+
+    return 1;
+}
+
+// Runs op on every lane, lane is a cpu_state so the ops are the same macros cpu_execute_instruction uses
+#define _LOCKSTEP_LANES(lockstep, count, op) \
+    for (size_t i = 0; i < (count); ++i)\
+    {\
+        cpu_state lane;\
+        lane.A = (lockstep)->A[i];\
+        lane.X = (lockstep)->X[i];\
+        lane.Y = (lockstep)->Y[i];\
+        lane.S = (lockstep)->S[i];\
+        lane.P = (lockstep)->P[i];\
+        lane.data = (lockstep)->data[i];\
+        op;\
+        (lockstep)->A[i] = lane.A;\
+        (lockstep)->X[i] = lane.X;\
+        (lockstep)->Y[i] = lane.Y;\
+        (lockstep)->S[i] = lane.S;\
+        (lockstep)->P[i] = lane.P;\
+        (lockstep)->data[i] = lane.data;\
+    }
+
+static void lockstep_operate(nes_lockstep* lockstep, size_t count, uint8_t op)
+{
+    switch (op)
+    {
+        case LOCKSTEP_OP_LDA:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_A(lane, lane.data)); break;
+        case LOCKSTEP_OP_LDX:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_X(lane, lane.data)); break;
+        case LOCKSTEP_OP_LDY:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_Y(lane, lane.data)); break;
+        case LOCKSTEP_OP_STA:   _LOCKSTEP_LANES(lockstep, count, lane.data = lane.A); break;
+        case LOCKSTEP_OP_STX:   _LOCKSTEP_LANES(lockstep, count, lane.data = lane.X); break;
+        case LOCKSTEP_OP_STY:   _LOCKSTEP_LANES(lockstep, count, lane.data = lane.Y); break;
+        case LOCKSTEP_OP_AND:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_A(lane, lane.A & lane.data)); break;
+        case LOCKSTEP_OP_ORA:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_A(lane, lane.A | lane.data)); break;
+        case LOCKSTEP_OP_EOR:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_A(lane, lane.A ^ lane.data)); break;
+        case LOCKSTEP_OP_ADC:   _LOCKSTEP_LANES(lockstep, count, _CPU_ADC(lane)); break;
+        case LOCKSTEP_OP_SBC:   _LOCKSTEP_LANES(lockstep, count, _CPU_SBC(lane)); break;
+        case LOCKSTEP_OP_BIT:   _LOCKSTEP_LANES(lockstep, count, _CPU_BIT(lane)); break;
+        case LOCKSTEP_OP_CMP:   _LOCKSTEP_LANES(lockstep, count, _CPU_CMP(lane, lane.A)); break;
+        case LOCKSTEP_OP_CPX:   _LOCKSTEP_LANES(lockstep, count, _CPU_CMP(lane, lane.X)); break;
+        case LOCKSTEP_OP_CPY:   _LOCKSTEP_LANES(lockstep, count, _CPU_CMP(lane, lane.Y)); break;
+        case LOCKSTEP_OP_INC:   _LOCKSTEP_LANES(lockstep, count, _CPU_INC(lane)); break;
+        case LOCKSTEP_OP_DEC:   _LOCKSTEP_LANES(lockstep, count, _CPU_DEC(lane)); break;
+        case LOCKSTEP_OP_ASL:   _LOCKSTEP_LANES(lockstep, count, _CPU_ASL(lane, lane.data)); break;
+        case LOCKSTEP_OP_LSR:   _LOCKSTEP_LANES(lockstep, count, _CPU_LSR(lane, lane.data)); break;
+        case LOCKSTEP_OP_ROL:   _LOCKSTEP_LANES(lockstep, count, _CPU_ROL(lane, lane.data)); break;
+        case LOCKSTEP_OP_ROR:   _LOCKSTEP_LANES(lockstep, count, _CPU_ROR(lane, lane.data)); break;
+        case LOCKSTEP_OP_ASL_A: _LOCKSTEP_LANES(lockstep, count, _CPU_ASL(lane, lane.A)); break;
+        case LOCKSTEP_OP_LSR_A: _LOCKSTEP_LANES(lockstep, count, _CPU_LSR(lane, lane.A)); break;
+        case LOCKSTEP_OP_ROL_A: _LOCKSTEP_LANES(lockstep, count, _CPU_ROL(lane, lane.A)); break;
+        case LOCKSTEP_OP_ROR_A: _LOCKSTEP_LANES(lockstep, count, _CPU_ROR(lane, lane.A)); break;
+        case LOCKSTEP_OP_INX:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_X(lane, lane.X + 1)); break;
+        case LOCKSTEP_OP_INY:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_Y(lane, lane.Y + 1)); break;
+        case LOCKSTEP_OP_DEX:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_X(lane, lane.X - 1)); break;
+        case LOCKSTEP_OP_DEY:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_Y(lane, lane.Y - 1)); break;
+        case LOCKSTEP_OP_TAX:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_X(lane, lane.A)); break;
+        case LOCKSTEP_OP_TAY:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_Y(lane, lane.A)); break;
+        case LOCKSTEP_OP_TXA:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_A(lane, lane.X)); break;
+        case LOCKSTEP_OP_TYA:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_A(lane, lane.Y)); break;
+        case LOCKSTEP_OP_TSX:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_X(lane, lane.S)); break;
+        case LOCKSTEP_OP_TXS:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_S(lane, lane.X)); break;
+        case LOCKSTEP_OP_CLC:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_P(lane, lane.P & 0xFE)); break;
+        case LOCKSTEP_OP_SEC:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_P(lane, lane.P | 0x01)); break;
+        case LOCKSTEP_OP_CLI:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_P(lane, lane.P & 0xFB)); break;
+        case LOCKSTEP_OP_SEI:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_P(lane, lane.P | 0x04)); break;
+        case LOCKSTEP_OP_CLV:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_P(lane, lane.P & 0xBF)); break;
+        case LOCKSTEP_OP_CLD:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_P(lane, lane.P & 0xF7)); break;
+        case LOCKSTEP_OP_SED:   _LOCKSTEP_LANES(lockstep, count, _CPU_SET_REG_P(lane, lane.P | 0x08)); break;
+        default:
+            break;
+    }
+}
+
+// Runs the instruction the group agreed on, lanes the executor cannot run take the scalar path
+static void lockstep_run_group(nes_lockstep* lockstep, size_t count, const uint8_t* operands)
+{
+    uint8_t opcode = nes_system_cpu_state(lockstep->group[0])->data;
+    const lockstep_instruction* instruction = &lockstep_instructions[opcode];
+
+    if (instruction->mode == LOCKSTEP_MODE_NONE)
+    {
+        for (size_t i = 0; i < count; ++i)
+            nes_system_run_step(lockstep->group[i], 1);
+
+        lockstep->stats.scalar_steps += count;
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const cpu_state* cpu = nes_system_cpu_state(lockstep->group[i]);
+
+        lockstep->PC[i] = cpu->PC;
+        lockstep->address[i] = cpu->address;
+        lockstep->A[i] = cpu->A;
+        lockstep->X[i] = cpu->X;
+        lockstep->Y[i] = cpu->Y;
+        lockstep->S[i] = cpu->S;
+        lockstep->P[i] = cpu->P;
+        lockstep->data[i] = cpu->data;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        lockstep->failed[i] = !lockstep_lane_access(lockstep, i, instruction, operands);
+
+    lockstep_operate(lockstep, count, instruction->op);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        nes_system* system = lockstep->group[i];
+
+        if (lockstep->failed[i])
+        {
+            nes_system_run_step(system, 1);
+            ++lockstep->stats.scalar_steps;
+            continue;
+        }
+
+        if (instruction->access != LOCKSTEP_ACCESS_READ)
+        {
+            const cpu_page* page = &nes_system_cpu_pages(system)[lockstep->address[i] >> 8];
+            page->write[lockstep->address[i] & 0xFF] = lockstep->data[i];
+            *page->dirty = 1;
+        }
+
+        cpu_state cpu = *nes_system_cpu_state(system);
+        cpu.PC = lockstep->PC[i];
+        cpu.address = lockstep->address[i];
+        cpu.A = lockstep->A[i];
+        cpu.X = lockstep->X[i];
+        cpu.Y = lockstep->Y[i];
+        cpu.S = lockstep->S[i];
+        cpu.P = lockstep->P[i];
+        cpu.data = lockstep->data[i];
+        cpu.halted = 0;
+        cpu.cycle = (opcode << 8) | lockstep->cycles[i];
+
+        nes_system_complete_instruction(system, cpu, lockstep->cycles[i]);
+        ++lockstep->stats.grouped_instructions;
+    }
+}
+
+// Bytes after the opcode, lanes run an instruction together only when they agree on them
+static int lockstep_operands(nes_system* system, uint8_t* operands)
+{
+    uint16_t pc = nes_system_cpu_state(system)->PC;
+
+    return lockstep_read(system, pc, &operands[0]) && lockstep_read(system, (uint16_t)(pc + 1), &operands[1]);
+}
+
+/////////////////////////////////////////////////
+// Public
+/////////////////////////////////////////////////
+
+nes_lockstep* nes_lockstep_create(nes_config* configs, size_t count)
+{
+    if (count > NES_LOCKSTEP_MAX_LANES)
+        return 0;
+
+    nes_lockstep* lockstep = (nes_lockstep*)malloc(sizeof(nes_lockstep));
+    if (!lockstep)
+        return 0;
+
+    memset(&lockstep->stats, 0, sizeof(nes_lockstep_stats));
+
+    for (lockstep->count = 0; lockstep->count < count; ++lockstep->count)
+    {
+        lockstep->systems[lockstep->count] = nes_system_create(&configs[lockstep->count]);
+        if (!lockstep->systems[lockstep->count])
+        {
+            nes_lockstep_destroy(lockstep);
+            return 0;
+        }
+    }
+
+    return lockstep;
+}
+
+void nes_lockstep_destroy(nes_lockstep* lockstep)
+{
+    for (size_t i = 0; i < lockstep->count; ++i)
+        nes_system_destroy(lockstep->systems[i]);
+
+    free(lockstep);
+}
+
+nes_system* nes_lockstep_get_system(nes_lockstep* lockstep, size_t lane)
+{
+    return lane < lockstep->count ? lockstep->systems[lane] : 0;
+}
+
+void nes_lockstep_frame(nes_lockstep* lockstep)
+{
+    size_t active_count = lockstep->count;
+
+    for (size_t i = 0; i < lockstep->count; ++i)
+    {
+        nes_system_begin_frame_run(lockstep->systems[i]);
+        lockstep->active[i] = lockstep->systems[i];
+    }
+
+    while (active_count)
+    {
+        size_t candidate_count = 0;
+
+        // First cycle of every lane, lanes that cannot run a whole instruction stop there
+        for (size_t i = 0; i < active_count; ++i)
+        {
+            nes_system* system = lockstep->active[i];
+
+            if (nes_system_begin_step(system))
+            {
+                lockstep->candidates[candidate_count++] = system;
+            }
+            else
+            {
+                nes_system_run_step(system, 0);
+                ++lockstep->stats.scalar_steps;
+            }
+        }
+
+        // Lanes at the same instruction bytes form a group, the others wait for a later group or run alone
+        while (candidate_count)
+        {
+            nes_system* leader = lockstep->candidates[0];
+            const cpu_state* leader_cpu = nes_system_cpu_state(leader);
+            size_t group_count = 0;
+            size_t remaining = 0;
+            uint8_t operands[2];
+
+            if (!lockstep_operands(leader, operands))
+            {
+                nes_system_run_step(leader, 1);
+                ++lockstep->stats.scalar_steps;
+
+                memmove(lockstep->candidates, lockstep->candidates + 1, --candidate_count * sizeof(nes_system*));
+                continue;
+            }
+
+            lockstep->group[group_count++] = leader;
+
+            for (size_t i = 1; i < candidate_count; ++i)
+            {
+                nes_system* system = lockstep->candidates[i];
+                const cpu_state* cpu = nes_system_cpu_state(system);
+                uint8_t lane_operands[2];
+
+                if (cpu->PC == leader_cpu->PC && cpu->data == leader_cpu->data &&
+                    lockstep_operands(system, lane_operands) && lane_operands[0] == operands[0] && lane_operands[1] == operands[1])
+                {
+                    lockstep->group[group_count++] = system;
+                }
+                else
+                {
+                    lockstep->candidates[remaining++] = system;
+                }
+            }
+
+            candidate_count = remaining;
+
+            lockstep_run_group(lockstep, group_count, operands);
+        }
+
+        size_t remaining = 0;
+
+        for (size_t i = 0; i < active_count; ++i)
+        {
+            nes_system* system = lockstep->active[i];
+
+            if (!nes_system_end_frame_run(system))
+                lockstep->active[remaining++] = system;
+        }
+
+        active_count = remaining;
+    }
+}
+
+nes_lockstep_stats nes_lockstep_get_stats(nes_lockstep* lockstep)
+{
+    return lockstep->stats;
+}
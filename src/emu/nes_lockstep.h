@@ -0,0 +1,37 @@
+#ifndef _NES_LOCKSTEP_H_
+#define _NES_LOCKSTEP_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "nes_system.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Experimental lockstep engine: steps many systems of the same ROM together, lanes about to run the same instruction
+// run it as a group with their CPU registers held one array per register. Diverged lanes step on their own
+#define NES_LOCKSTEP_MAX_LANES 256
+
+typedef struct nes_lockstep nes_lockstep;
+
+typedef struct nes_lockstep_stats
+{
+    uint64_t    grouped_instructions;   // lane instructions run by the group executor
+    uint64_t    scalar_steps;           // lane steps run one system at a time
+} nes_lockstep_stats;
+
+// One system per config, configs should all load the same ROM. Returns 0 if count is above NES_LOCKSTEP_MAX_LANES or any system fails to create
+nes_lockstep*       nes_lockstep_create(nes_config* configs, size_t count);
+void                nes_lockstep_destroy(nes_lockstep* lockstep);
+nes_system*         nes_lockstep_get_system(nes_lockstep* lockstep, size_t lane);
+
+// Runs every lane to the start of its next frame, each lane ends up where nes_system_run_until with NES_RUN_FRAME leaves it
+void                nes_lockstep_frame(nes_lockstep* lockstep);
+nes_lockstep_stats  nes_lockstep_get_stats(nes_lockstep* lockstep);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -6,6 +6,7 @@
 
 #include "nes_ppu.h"
 #include "nes_cartridge.h"
+#include "nes_serializer.h"
 #include "emu6502.h"
 
 typedef struct nes_mapper
@@ -16,12 +17,65 @@ typedef struct nes_mapper
     void    (*write)(nes_cartridge*, uint16_t address, uint8_t data);
     void    (*ppu_read)(nes_cartridge*, uint8_t* vram, uint16_t address, uint8_t* out_data);
     void    (*ppu_write)(nes_cartridge*, uint8_t* vram, uint16_t address, uint8_t data);
-    void    (*tick)(nes_cartridge*, cpu_state*, nes_ppu*);
+    int     (*tick)(nes_cartridge*, cpu_state*, nes_ppu*);  // returns 0 once it has nothing to do until the next write, mappers driving IRQ never do
+    void    (*map_banks)(nes_cartridge*);   // recomputes the cartridge bank pointers from the mapper state, init and write keep them current
+    void    (*ppu_fetch)(nes_cartridge*, uint16_t address); // optional, sees the PPU reads served from chr_banks instead of ppu_read
+    int     observes_ppu;   // tick samples the PPU every CPU cycle and PPU fetches have side effects (MMC3 A12 IRQ counter)
+    void    (*serialize)(nes_cartridge*, nes_serializer*); // mapper registers, RAM at the end of the state is saved by the system
 } nes_mapper;
 
+// Pattern memory behind a CHR address, 0 when neither ROM nor RAM backs it
+static uint8_t* nes_mapper_chr_bank(nes_cartridge* cartridge, size_t chr_address)
+{
+    if (chr_address < cartridge->chr_rom_size)      return cartridge->chr_rom + chr_address;
+    else if (chr_address < cartridge->chr_ram_size) return cartridge->chr_ram + chr_address;
+    return 0;
+}
+
+// Nametables at the given CIRAM offsets, left to the mapper until the system attaches its CIRAM
+static void nes_mapper_map_nametables(nes_cartridge* cartridge, uint16_t nt0, uint16_t nt1, uint16_t nt2, uint16_t nt3)
+{
+    const uint16_t offsets[4] = { nt0, nt1, nt2, nt3 };
+
+    for (int i = 0; i < 4; ++i)
+        cartridge->nametable_banks[i] = cartridge->ciram ? cartridge->ciram + offsets[i] : 0;
+}
+
+static void nes_mapper_map_mirroring(nes_cartridge* cartridge)
+{
+    switch (cartridge->mirroring)
+    {
+        case NES_NAMETABLE_MIRRORING_VERTICAL:      nes_mapper_map_nametables(cartridge, 0, 0x400, 0, 0x400); break;
+        case NES_NAMETABLE_MIRRORING_HORIZONTAL:    nes_mapper_map_nametables(cartridge, 0, 0, 0x400, 0x400); break;
+        case NES_NAMETABLE_MIRRORING_SINGLE_LOW:    nes_mapper_map_nametables(cartridge, 0, 0, 0, 0); break;
+        case NES_NAMETABLE_MIRRORING_SINGLE_HIGH:   nes_mapper_map_nametables(cartridge, 0x800, 0x800, 0x800, 0x800); break;
+    }
+}
+
 // NROM
 
-static void NROM_init(nes_cartridge* cartridge){}
+static void NROM_map_banks(nes_cartridge* cartridge)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        if (cartridge->prg_rom_size == 0x8000)  cartridge->prg_banks[i] = cartridge->prg_rom + ((i * 0x2000) & 0x7FFF);
+        else                                    cartridge->prg_banks[i] = cartridge->prg_rom + ((i * 0x2000) & 0x3FFF);
+    }
+
+    cartridge->prg_ram_read = 0;
+    cartridge->prg_ram_write = 0;
+
+    for (int i = 0; i < 8; ++i)
+        cartridge->chr_banks[i] = nes_mapper_chr_bank(cartridge, i * 0x400);
+
+    nes_mapper_map_mirroring(cartridge);
+}
+
+static void NROM_init(nes_cartridge* cartridge)
+{
+    NROM_map_banks(cartridge);
+}
+
 static void NROM_write(nes_cartridge* cartridge, uint16_t address, uint8_t data){}
 
 static void NROM_read(nes_cartridge* cartridge, uint16_t address, uint8_t* out_data)
@@ -30,7 +84,7 @@ static void NROM_read(nes_cartridge* cartridge, uint16_t address, uint8_t* out_d
     else                                    *out_data = *(cartridge->prg_rom + (address & 0x3FFF));
 }
 
-static void NROM_tick(nes_cartridge* cartridge, cpu_state* cpu, nes_ppu* ppu) {}
+static int NROM_tick(nes_cartridge* cartridge, cpu_state* cpu, nes_ppu* ppu) { return 0; }
 
 static uint16_t NROM_nametable_address(nes_cartridge* cartridge, uint16_t address)
 {
@@ -73,9 +127,11 @@ static void NROM_ppu_write(nes_cartridge* cartridge, uint8_t* vram, uint16_t add
     }
 }
 
+static void NROM_serialize(nes_cartridge* cartridge, nes_serializer* s) {}
+
 static nes_mapper nes_mapper_get_NROM()
 {
-    nes_mapper nrom = {0, &NROM_init, &NROM_read, &NROM_write, &NROM_ppu_read, &NROM_ppu_write, &NROM_tick };
+    nes_mapper nrom = {0, &NROM_init, &NROM_read, &NROM_write, &NROM_ppu_read, &NROM_ppu_write, &NROM_tick, &NROM_map_banks, 0, 0, &NROM_serialize };
     return nrom;
 }
 
@@ -88,12 +144,25 @@ typedef struct axrom_mapper_state
 
 } axrom_mapper_state;
 
+static void AxROM_map_banks(nes_cartridge* cartridge)
+{
+    axrom_mapper_state* state = (axrom_mapper_state*)cartridge->state;
+
+    NROM_map_banks(cartridge);
+
+    for (int i = 0; i < 4; ++i)
+        cartridge->prg_banks[i] = cartridge->prg_rom + (state->bank_offset + i * 0x2000) % cartridge->prg_rom_size;
+
+    nes_mapper_map_nametables(cartridge, state->mirroring, state->mirroring, state->mirroring, state->mirroring);
+}
+
 static void AxROM_init(nes_cartridge* cartridge)
 {
     axrom_mapper_state* state = (axrom_mapper_state*)cartridge->state;
     size_t num_banks = cartridge->prg_rom_size / 0x8000;
     state->bank_offset = (num_banks - 1) * 0x8000; 
     state->mirroring = 0;
+    AxROM_map_banks(cartridge);
 }
 
 static void AxROM_read(nes_cartridge* cartridge, uint16_t address, uint8_t* out_data)
@@ -107,6 +176,7 @@ static void AxROM_write(nes_cartridge* cartridge, uint16_t address, uint8_t data
     axrom_mapper_state* state = (axrom_mapper_state*)cartridge->state;
     state->bank_offset = (data & 7) * 0x8000;
     state->mirroring = ((uint16_t)data & 0x10) << 7;
+    AxROM_map_banks(cartridge);
 }
 
 static uint16_t AxROM_nametable_address(nes_cartridge* cartridge, uint16_t address)
@@ -141,9 +211,16 @@ static void AxROM_ppu_write(nes_cartridge* cartridge, uint8_t* vram, uint16_t ad
     }
 }
 
+static void AxROM_serialize(nes_cartridge* cartridge, nes_serializer* s)
+{
+    axrom_mapper_state* state = (axrom_mapper_state*)cartridge->state;
+    _NES_SERIALIZE_AS(s, 32, state->bank_offset);
+    nes_serialize_u16(s, &state->mirroring);
+}
+
 static nes_mapper nes_mapper_get_AxROM()
 {
-    nes_mapper unrom = {sizeof(axrom_mapper_state), &AxROM_init, &AxROM_read, &AxROM_write, &AxROM_ppu_read, &AxROM_ppu_write, &NROM_tick };
+    nes_mapper unrom = {sizeof(axrom_mapper_state), &AxROM_init, &AxROM_read, &AxROM_write, &AxROM_ppu_read, &AxROM_ppu_write, &NROM_tick, &AxROM_map_banks, 0, 0, &AxROM_serialize };
     return unrom;
 }
 
@@ -156,6 +233,18 @@ typedef struct uxrom_mapper_state
     uint8_t bank_mask;
 } uxrom_mapper_state;
 
+static void UxROM_map_banks(nes_cartridge* cartridge)
+{
+    uxrom_mapper_state* state = (uxrom_mapper_state*)cartridge->state;
+
+    NROM_map_banks(cartridge);
+
+    cartridge->prg_banks[0] = cartridge->prg_rom + state->current_bank_offset;
+    cartridge->prg_banks[1] = cartridge->prg_rom + state->current_bank_offset + 0x2000;
+    cartridge->prg_banks[2] = cartridge->prg_rom + state->fixed_bank_offset;
+    cartridge->prg_banks[3] = cartridge->prg_rom + state->fixed_bank_offset + 0x2000;
+}
+
 static void UxROM_init(nes_cartridge* cartridge)
 {
     uxrom_mapper_state* state = (uxrom_mapper_state*)cartridge->state;
@@ -167,6 +256,8 @@ static void UxROM_init(nes_cartridge* cartridge)
     if (num_banks < 8)          state->bank_mask = 0x03;
     else if (num_banks < 16)    state->bank_mask = 0x07;
     else                        state->bank_mask = 0x0F;
+
+    UxROM_map_banks(cartridge);
 }
 
 static void UxROM_read(nes_cartridge* cartridge, uint16_t address, uint8_t* out_data)
@@ -180,12 +271,21 @@ static void UxROM_write(nes_cartridge* cartridge, uint16_t address, uint8_t data
 {
     uxrom_mapper_state* state = (uxrom_mapper_state*)cartridge->state;
     if (address >= 0x8000)
+    {
         state->current_bank_offset = (data & state->bank_mask) * 0x4000;
+        UxROM_map_banks(cartridge);
+    }
+}
+
+static void UxROM_serialize(nes_cartridge* cartridge, nes_serializer* s)
+{
+    uxrom_mapper_state* state = (uxrom_mapper_state*)cartridge->state;
+    _NES_SERIALIZE_AS(s, 32, state->current_bank_offset);
 }
 
 static nes_mapper nes_mapper_get_UxROM()
 {
-    nes_mapper unrom = {sizeof(uxrom_mapper_state), &UxROM_init, &UxROM_read, &UxROM_write, &NROM_ppu_read, &NROM_ppu_write, &NROM_tick };
+    nes_mapper unrom = {sizeof(uxrom_mapper_state), &UxROM_init, &UxROM_read, &UxROM_write, &NROM_ppu_read, &NROM_ppu_write, &NROM_tick, &UxROM_map_banks, 0, 0, &UxROM_serialize };
     return unrom;
 }
 
@@ -198,6 +298,18 @@ typedef struct mapper071_mapper_state
     uint8_t  mirroring_set;
 } mapper071_mapper_state;
 
+static void Mapper071_map_banks(nes_cartridge* cartridge)
+{
+    mapper071_mapper_state* state = (mapper071_mapper_state*)cartridge->state;
+
+    UxROM_map_banks(cartridge);
+
+    if (state->mirroring_set)
+        nes_mapper_map_nametables(cartridge, state->mirroring_mode, state->mirroring_mode, state->mirroring_mode, state->mirroring_mode);
+    else
+        nes_mapper_map_nametables(cartridge, 0, 0x400, 0, 0x400);
+}
+
 static void Mapper071_init(nes_cartridge* cartridge)
 {
     UxROM_init(cartridge);
@@ -205,6 +317,7 @@ static void Mapper071_init(nes_cartridge* cartridge)
     mapper071_mapper_state* state = (mapper071_mapper_state*)cartridge->state;
     state->mirroring_mode = 0;
     state->mirroring_set = 0;
+    Mapper071_map_banks(cartridge);
 }
 
 static void Mapper071_write(nes_cartridge* cartridge, uint16_t address, uint8_t data)
@@ -218,6 +331,8 @@ static void Mapper071_write(nes_cartridge* cartridge, uint16_t address, uint8_t
 
     if (!state->mirroring_set || address >= 0xC000)
         UxROM_write(cartridge, address, data);
+
+    Mapper071_map_banks(cartridge);
 }
 
 static uint16_t Mapper071_nametable_address(nes_cartridge* cartridge, uint16_t address)
@@ -259,9 +374,17 @@ static void Mapper071_ppu_write(nes_cartridge* cartridge, uint8_t* vram, uint16_
     }
 }
 
+static void Mapper071_serialize(nes_cartridge* cartridge, nes_serializer* s)
+{
+    mapper071_mapper_state* state = (mapper071_mapper_state*)cartridge->state;
+    UxROM_serialize(cartridge, s);
+    nes_serialize_u16(s, &state->mirroring_mode);
+    nes_serialize_u8(s, &state->mirroring_set);
+}
+
 static nes_mapper nes_mapper_get_Mapper071()
 {
-    nes_mapper unrom = {sizeof(mapper071_mapper_state), &Mapper071_init, &UxROM_read, &Mapper071_write, &Mapper071_ppu_read, &Mapper071_ppu_write, &NROM_tick };
+    nes_mapper unrom = {sizeof(mapper071_mapper_state), &Mapper071_init, &UxROM_read, &Mapper071_write, &Mapper071_ppu_read, &Mapper071_ppu_write, &NROM_tick, &Mapper071_map_banks, 0, 0, &Mapper071_serialize };
     return unrom;
 }
 
@@ -273,10 +396,23 @@ typedef struct cnrom_mapper_state
     uint8_t ram[0x800];
 }cnrom_mapper_state;
 
+static void CNROM_map_banks(nes_cartridge* cartridge)
+{
+    cnrom_mapper_state* state = (cnrom_mapper_state*)cartridge->state;
+
+    NROM_map_banks(cartridge);
+
+    for (int i = 0; i < 8; ++i)
+        cartridge->chr_banks[i] = nes_mapper_chr_bank(cartridge, state->current_bank_offset + i * 0x400);
+}
+
 static void CNROM_init(nes_cartridge* cartridge)
 {
     cnrom_mapper_state* state = (cnrom_mapper_state*)cartridge->state;
     state->current_bank_offset = 0;
+    cartridge->prg_ram = state->ram;
+    cartridge->prg_ram_size = sizeof(state->ram);
+    CNROM_map_banks(cartridge);
 }
 
 static void CNROM_write(nes_cartridge* cartridge, uint16_t address, uint8_t data)
@@ -289,6 +425,7 @@ static void CNROM_write(nes_cartridge* cartridge, uint16_t address, uint8_t data
     else if (address >= 0x8000)
     {
         state->current_bank_offset = (data & 3) * 0x2000;
+        CNROM_map_banks(cartridge);
     }
 }
 
@@ -319,9 +456,15 @@ static void CNROM_ppu_read(nes_cartridge* cartridge, uint8_t* vram, uint16_t add
     }
 }
 
+static void CNROM_serialize(nes_cartridge* cartridge, nes_serializer* s)
+{
+    cnrom_mapper_state* state = (cnrom_mapper_state*)cartridge->state;
+    _NES_SERIALIZE_AS(s, 32, state->current_bank_offset);
+}
+
 static nes_mapper nes_mapper_get_CNROM()
 {
-    nes_mapper unrom = {sizeof(cnrom_mapper_state), &CNROM_init, &CNROM_read, &CNROM_write, &CNROM_ppu_read, &NROM_ppu_write, &NROM_tick };
+    nes_mapper unrom = {sizeof(cnrom_mapper_state), &CNROM_init, &CNROM_read, &CNROM_write, &CNROM_ppu_read, &NROM_ppu_write, &NROM_tick, &CNROM_map_banks, 0, 0, &CNROM_serialize };
     return unrom;
 }
 
@@ -344,6 +487,44 @@ typedef struct mmc1_mapper_state
     uint8_t  ram[8192];
 } mmc1_mapper_state;
 
+static void MMC1_map_banks(nes_cartridge* cartridge)
+{
+    mmc1_mapper_state* state = (mmc1_mapper_state*)cartridge->state;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        size_t prg_address = state->prg_bank_selector;
+        size_t window = (i & 1) * 0x2000;
+
+        switch (state->bank_mode)
+        {
+            default:
+            case 0: case 1: prg_address |= state->current_bank_offset + i * 0x2000; break;
+            case 2:         prg_address |= (i >= 2 ? state->current_bank_offset : state->fixed_bank_offset) + window; break;
+            case 3:         prg_address |= (i >= 2 ? state->fixed_bank_offset : state->current_bank_offset) + window; break;
+        }
+
+        cartridge->prg_banks[i] = cartridge->prg_rom + prg_address;
+    }
+
+    cartridge->prg_ram_read = state->ram;
+    cartridge->prg_ram_write = state->ram;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        size_t chr_address;
+
+        if (state->chr_bank_mode == 0 || i < 4)
+            chr_address = state->chr_bank_low_offset + i * 0x400;
+        else
+            chr_address = state->chr_bank_high_offset + (i - 4) * 0x400;
+
+        cartridge->chr_banks[i] = nes_mapper_chr_bank(cartridge, chr_address);
+    }
+
+    nes_mapper_map_mirroring(cartridge);
+}
+
 static void MMC1_init(nes_cartridge* cartridge)
 {
     mmc1_mapper_state* state = (mmc1_mapper_state*)cartridge->state;
@@ -359,6 +540,9 @@ static void MMC1_init(nes_cartridge* cartridge)
     state->write_enable = 1;
     state->ram_enable = 1;
     state->is_SUROM = (cartridge->prg_rom_size == 512 * 1024);
+    cartridge->prg_ram = state->ram;
+    cartridge->prg_ram_size = sizeof(state->ram);
+    MMC1_map_banks(cartridge);
 }
 
 static void MMC1_read(nes_cartridge* cartridge, uint16_t address, uint8_t* out_data)
@@ -479,6 +663,8 @@ static void MMC1_write(nes_cartridge* cartridge, uint16_t address, uint8_t data)
                 state->shift_count = 0; 
             }
         }
+
+        MMC1_map_banks(cartridge);
     }
 }
 
@@ -504,16 +690,35 @@ static void MMC1_ppu_read(nes_cartridge* cartridge, uint8_t* vram, uint16_t addr
 }
 
 
-static void MMC1_tick(nes_cartridge* cartridge, cpu_state* cpu, nes_ppu* ppu)
+static int MMC1_tick(nes_cartridge* cartridge, cpu_state* cpu, nes_ppu* ppu)
 {
     mmc1_mapper_state* state = (mmc1_mapper_state*)cartridge->state;
     if ((cpu->cycle & 0xFF) == 0)
         state->write_enable = 1;
+
+    return !state->write_enable;
+}
+
+static void MMC1_serialize(nes_cartridge* cartridge, nes_serializer* s)
+{
+    mmc1_mapper_state* state = (mmc1_mapper_state*)cartridge->state;
+    _NES_SERIALIZE_AS(s, 8, state->bank_mode);
+    _NES_SERIALIZE_AS(s, 8, state->chr_bank_mode);
+    _NES_SERIALIZE_AS(s, 8, state->write_enable);
+    _NES_SERIALIZE_AS(s, 8, state->ram_enable);
+    _NES_SERIALIZE_AS(s, 32, state->prg_bank_selector);
+    _NES_SERIALIZE_AS(s, 32, state->fixed_bank_offset);
+    _NES_SERIALIZE_AS(s, 32, state->current_bank_offset);
+    _NES_SERIALIZE_AS(s, 32, state->chr_bank_low_offset);
+    _NES_SERIALIZE_AS(s, 32, state->chr_bank_high_offset);
+    nes_serialize_u8(s, &state->shift_reg);
+    nes_serialize_u8(s, &state->shift_count);
+    _NES_SERIALIZE_AS(s, 8, cartridge->mirroring); // control register bits, MMC1 keeps them in the cartridge
 }
 
 static nes_mapper nes_mapper_get_MMC1()
 {
-    nes_mapper unrom = {sizeof(mmc1_mapper_state), &MMC1_init, &MMC1_read, &MMC1_write, &MMC1_ppu_read, &NROM_ppu_write, &MMC1_tick };
+    nes_mapper unrom = {sizeof(mmc1_mapper_state), &MMC1_init, &MMC1_read, &MMC1_write, &MMC1_ppu_read, &NROM_ppu_write, &MMC1_tick, &MMC1_map_banks, 0, 0, &MMC1_serialize };
     return unrom;
 }
 
@@ -546,6 +751,47 @@ typedef struct mmc3_mapper_state_4screen
     uint8_t             nametable_vram[0x1000];
 }mmc3_mapper_state_4screen;
 
+static void MMC3_map_banks(nes_cartridge* cartridge)
+{
+    mmc3_mapper_state* state = (mmc3_mapper_state*)cartridge->state;
+
+    size_t second_last = cartridge->prg_rom_size - 0x4000;
+    size_t swappable = (state->banks[6] * 0x2000) % cartridge->prg_rom_size;
+
+    cartridge->prg_banks[0] = cartridge->prg_rom + (state->bank_mode ? second_last : swappable);
+    cartridge->prg_banks[1] = cartridge->prg_rom + (state->banks[7] * 0x2000) % cartridge->prg_rom_size;
+    cartridge->prg_banks[2] = cartridge->prg_rom + (state->bank_mode ? swappable : second_last);
+    cartridge->prg_banks[3] = cartridge->prg_rom + cartridge->prg_rom_size - 0x2000;
+
+    cartridge->prg_ram_read = state->ram_enable ? state->ram : 0;
+    cartridge->prg_ram_write = state->write_protect ? 0 : state->ram;
+
+    // 2 KB banks R0 and R1 and 1 KB banks R2-R5, the two halves swap with the CHR bank mode
+    const uint32_t chr_banks[8] = {
+        state->banks[0] * 0x400, state->banks[0] * 0x400 + 0x400, state->banks[1] * 0x400, state->banks[1] * 0x400 + 0x400,
+        state->banks[2] * 0x400, state->banks[3] * 0x400, state->banks[4] * 0x400, state->banks[5] * 0x400
+    };
+
+    for (int i = 0; i < 8; ++i)
+        cartridge->chr_banks[i] = nes_mapper_chr_bank(cartridge, chr_banks[(i + state->chr_bank_mode * 4) & 7]);
+
+    if (state->nametable_4screen)
+    {
+        mmc3_mapper_state_4screen* state_4screen = (mmc3_mapper_state_4screen*)cartridge->state;
+
+        for (int i = 0; i < 4; ++i)
+            cartridge->nametable_banks[i] = state_4screen->nametable_vram + i * 0x400;
+    }
+    else if (state->nametable_arrangement)
+    {
+        nes_mapper_map_nametables(cartridge, 0, 0, 0x400, 0x400);
+    }
+    else
+    {
+        nes_mapper_map_nametables(cartridge, 0, 0x400, 0, 0x400);
+    }
+}
+
 static void MMC3_init(nes_cartridge* cartridge)
 {
     mmc3_mapper_state* state = (mmc3_mapper_state*)cartridge->state;
@@ -553,6 +799,9 @@ static void MMC3_init(nes_cartridge* cartridge)
     state->nametable_arrangement = 0;
     state->ram_enable = 1;
     state->normal_irq_behaviour = 1;
+    cartridge->prg_ram = state->ram;
+    cartridge->prg_ram_size = sizeof(state->ram);
+    MMC3_map_banks(cartridge);
 }
 
 static void MMC3_init_4screen(nes_cartridge* cartridge)
@@ -561,6 +810,7 @@ static void MMC3_init_4screen(nes_cartridge* cartridge)
 
     mmc3_mapper_state* state = (mmc3_mapper_state*)cartridge->state;
     state->nametable_4screen = 1;
+    MMC3_map_banks(cartridge);
 }
 
 static void MMC3_read(nes_cartridge* cartridge, uint16_t address, uint8_t* out_data)
@@ -665,6 +915,8 @@ static void MMC3_write(nes_cartridge* cartridge, uint16_t address, uint8_t data)
                 state->has_irq = 0;
             }
         }
+
+        MMC3_map_banks(cartridge);
     }
 }
 
@@ -755,6 +1007,11 @@ static void MMC3_ppu_read(nes_cartridge* cartridge, uint8_t* vram, uint16_t addr
     }
 }
 
+static void MMC3_ppu_fetch(nes_cartridge* cartridge, uint16_t address)
+{
+    MMC3_check_A12((mmc3_mapper_state*)cartridge->state, address);
+}
+
 static void MMC3_ppu_write(nes_cartridge* cartridge, uint8_t* vram, uint16_t address, uint8_t data)
 {
     mmc3_mapper_state* state = (mmc3_mapper_state*)cartridge->state;
@@ -784,7 +1041,7 @@ static void MMC3_ppu_write(nes_cartridge* cartridge, uint8_t* vram, uint16_t add
     }
 }
 
-static void MMC3_tick(nes_cartridge* cartridge, cpu_state* cpu, nes_ppu* ppu)
+static int MMC3_tick(nes_cartridge* cartridge, cpu_state* cpu, nes_ppu* ppu)
 {
     mmc3_mapper_state* state = (mmc3_mapper_state*)cartridge->state;
 
@@ -792,15 +1049,38 @@ static void MMC3_tick(nes_cartridge* cartridge, cpu_state* cpu, nes_ppu* ppu)
 
     // Ignore dummy fetches
     if (_NES_PPU_IS_RENDERING(ppu) && ppu->vram_address == state->last_address)
-        return;
+        return 1;
 
     if (!MMC3_check_A12(state, ppu->vram_address) && state->a12_edge_counter)
         state->a12_edge_counter--;
+
+    return 1;
+}
+
+static void MMC3_serialize(nes_cartridge* cartridge, nes_serializer* s)
+{
+    mmc3_mapper_state* state = (mmc3_mapper_state*)cartridge->state;
+    _NES_SERIALIZE_AS(s, 8, state->nametable_arrangement);
+    _NES_SERIALIZE_AS(s, 8, state->bank_select);
+    _NES_SERIALIZE_AS(s, 8, state->bank_mode);
+    _NES_SERIALIZE_AS(s, 8, state->chr_bank_mode);
+    _NES_SERIALIZE_AS(s, 8, state->write_protect);
+    _NES_SERIALIZE_AS(s, 8, state->ram_enable);
+    _NES_SERIALIZE_AS(s, 8, state->irq_enable);
+    _NES_SERIALIZE_AS(s, 8, state->has_irq);
+    nes_serialize_u8(s, &state->irq_reload_value);
+    _NES_SERIALIZE_AS(s, 8, state->irq_reload_flag);
+    nes_serialize_u8(s, &state->irq_counter);
+    nes_serialize_u16(s, &state->last_address);
+    _NES_SERIALIZE_AS(s, 8, state->a12_edge_counter);
+
+    for (int i = 0; i < 8; ++i)
+        _NES_SERIALIZE_AS(s, 8, state->banks[i]);
 }
 
 static nes_mapper nes_mapper_get_MMC3(int layout_flag)
 {
-    nes_mapper mmc3rom = {sizeof(mmc3_mapper_state), &MMC3_init, &MMC3_read, &MMC3_write, &MMC3_ppu_read, &MMC3_ppu_write, &MMC3_tick};
+    nes_mapper mmc3rom = {sizeof(mmc3_mapper_state), &MMC3_init, &MMC3_read, &MMC3_write, &MMC3_ppu_read, &MMC3_ppu_write, &MMC3_tick, &MMC3_map_banks, &MMC3_ppu_fetch, 1, &MMC3_serialize};
     if (layout_flag)
     {
         mmc3rom.state_size = sizeof(mmc3_mapper_state_4screen);
@@ -811,6 +1091,17 @@ static nes_mapper nes_mapper_get_MMC3(int layout_flag)
 
 // Select mapper
 
+// Mappers nes_mapper_get implements, it falls back to NROM for any other id
+static int nes_mapper_is_supported(int mapper_id)
+{
+    switch(mapper_id)
+    {
+        case 0: case 1: case 2: case 3: case 4: case 7: case 71:
+            return 1;
+    }
+    return 0;
+}
+
 static nes_mapper nes_mapper_get(int mapper_id, int layout_flag)
 {
     switch(mapper_id)
@@ -4,6 +4,7 @@
 #include <memory.h>
 #include <stdint.h>
 #include <assert.h>
+#include "nes_serializer.h"
 
 #define SCANLINE_WIDTH          341
 #define TOTAL_SCANLINES         262
@@ -135,23 +136,20 @@ typedef struct nes_ppu
 
     uint8_t  tile_value;
     uint8_t  palette_attribute;
-    uint8_t  bitplane_slice_low;
-    uint8_t  bitplane_slice_high;
-
-    uint16_t bg_shift_low;
-    uint16_t bg_shift_high;
-    uint16_t attr_shift_low;
-    uint16_t attr_shift_high;
+    uint32_t tile_pixels;   // fetched tile row, see nes_ppu_decode_bitplane
+    uint64_t bg_shift;      // 16 background pixels, pattern and attribute bits, leftmost in the high nibble
 
     nes_ppu_sprite_attrib   sprite_attributes[8];
     uint8_t                 sprite_x_positions[8];
-    uint8_t                 sprite_shift_low[8];
-    uint8_t                 sprite_shift_high[8];
+    uint32_t                sprite_pixels[8];
+    uint8_t                 sprite_line[256];   // first opaque sprite pixel per x, see nes_ppu_build_sprite_line
+    uint8_t                 sprite_line_dirty;
 
     uint8_t         eval_oam_has_sprite_zero;
     uint8_t         eval_oam_entry_data;
     uint8_t         eval_oam_byte_count;
     uint8_t         eval_oam_src_addr;
+    uint8_t         eval_oam_deferred;
 
     uint8_t         sprite_0_test;
     uint8_t         cpu_read_buffer;
@@ -186,6 +184,167 @@ typedef struct nes_ppu
     uint8_t         open_bus_decay_timer[8];
 } nes_ppu;
 
+// Spread the 8 pixels of a bitplane byte to one nibble each, leftmost pixel in the high nibble
+static uint32_t nes_ppu_decode_bitplane(uint8_t bitplane)
+{
+    uint32_t pixels = bitplane;
+    pixels = (pixels | (pixels << 12)) & 0x000F000F;
+    pixels = (pixels | (pixels << 6))  & 0x03030303;
+    pixels = (pixels | (pixels << 3))  & 0x11111111;
+    return pixels;
+}
+
+// Sprite line entries hold the sprite palette index plus these flags, 0 when transparent
+#define _NES_PPU_SPRITE_LINE_BEHIND_BG  0x20
+#define _NES_PPU_SPRITE_LINE_SPRITE_0   0x40
+
+// Resolve the sprites of the current scanline once instead of testing all 8 at every dot
+static void nes_ppu_build_sprite_line(nes_ppu* ppu)
+{
+    memset(ppu->sprite_line, 0, sizeof(ppu->sprite_line));
+
+    for (int i = 0; i < 8; ++i)
+    {
+        uint32_t pixels = ppu->sprite_pixels[i];
+        if (!pixels)
+            continue;
+
+        uint8_t* line = ppu->sprite_line + ppu->sprite_x_positions[i];
+        int      width = 256 - ppu->sprite_x_positions[i];
+        uint8_t  flags = 0x10 | (ppu->sprite_attributes[i].palette << 2) |
+                         (ppu->sprite_attributes[i].priority ? _NES_PPU_SPRITE_LINE_BEHIND_BG : 0) |
+                         (i == 0 ? _NES_PPU_SPRITE_LINE_SPRITE_0 : 0);
+
+        if (width > 8)
+            width = 8;
+
+        // Lower sprite indices win, only fill what is still transparent
+        for (int x = 0; x < width; ++x)
+        {
+            unsigned pattern = (pixels >> ((7 - x) * 4)) & 0x03;
+            if (pattern && !line[x])
+                line[x] = flags | pattern;
+        }
+    }
+
+    ppu->sprite_line_dirty = 0;
+}
+
+// One dot of sprite evaluation (dots 65-256), reads on odd dots and copies to secondary OAM on even dots
+static void nes_ppu_evaluate_sprite_dot(nes_ppu* ppu, uint32_t dot, unsigned sprite_height)
+{
+    if (dot & 1)
+    {
+        ppu->eval_oam_entry_data = ppu->primary_oam.bytes[ppu->oam_address];
+    }
+    else
+    {
+        if (ppu->oam_address >= ppu->eval_oam_src_addr)
+        {
+            ppu->eval_oam_src_addr = ppu->oam_address;
+
+            int copy_oam = 1;
+
+            if ((ppu->eval_oam_byte_count & 3) == 0)
+            {
+                uint8_t pos = ppu->eval_oam_entry_data;
+                if (pos < 240 && ppu->scanline >= pos && ppu->scanline < (pos + sprite_height))
+                {
+                    if (dot == 66)
+                        ppu->eval_oam_has_sprite_zero = 1;
+
+                    if (ppu->eval_oam_byte_count == 32)
+                        ppu->status.sprite_overflow = 1;
+                }
+                else
+                {
+                    copy_oam = 0;
+                }
+            }
+
+            if (copy_oam)
+            {
+                if (ppu->eval_oam_byte_count < 32)
+                    ppu->secondary_oam.bytes[ppu->eval_oam_byte_count++] = ppu->eval_oam_entry_data;
+
+                ppu->oam_address++;
+            }
+            else
+            {
+                ppu->oam_address = (ppu->oam_address + 4);
+
+                if (ppu->eval_oam_byte_count == 32)
+                    ppu->oam_address = (ppu->oam_address & 0xFC) | ((ppu->oam_address + 1) & 3);
+                else
+                    ppu->oam_address &= 0xFC;
+            }
+        }
+    }
+}
+
+// Run the evaluation of dots 65-256 at once, same result as nes_ppu_evaluate_sprite_dot over the whole window
+static void nes_ppu_evaluate_sprites(nes_ppu* ppu, unsigned sprite_height)
+{
+    uint32_t dot = 65;
+
+    ppu->eval_oam_deferred = 0;
+
+    if ((ppu->oam_address & 3) == 0 && ppu->eval_oam_byte_count == 0 && ppu->eval_oam_src_addr <= ppu->oam_address)
+    {
+        // Y test all entries up front, the loop vectorizes
+        uint8_t in_range[64];
+        for (uint32_t i = 0; i < 64; ++i)
+        {
+            uint8_t pos = ppu->primary_oam.bytes[i * 4];
+            in_range[i] = (pos < 240) & ((ppu->scanline - pos) < sprite_height);
+        }
+
+        // Until secondary OAM is full entries are copied whole or skipped, 88 dot pairs at most
+        if (in_range[ppu->oam_address >> 2])
+            ppu->eval_oam_has_sprite_zero = 1;
+
+        for (uint32_t i = ppu->oam_address >> 2; i < 64 && ppu->eval_oam_byte_count < 32; ++i)
+        {
+            if (in_range[i])
+            {
+                memcpy(ppu->secondary_oam.bytes + ppu->eval_oam_byte_count, ppu->primary_oam.bytes + i * 4, 4);
+                ppu->eval_oam_byte_count += 4;
+                ppu->eval_oam_src_addr = i * 4 + 3;
+                dot += 8;
+            }
+            else
+            {
+                ppu->eval_oam_src_addr = i * 4;
+                dot += 2;
+            }
+
+            ppu->oam_address = i * 4 + 4;
+        }
+    }
+
+    // Overflow scan and wrap around, dot by dot
+    for (; dot <= 256; ++dot)
+        nes_ppu_evaluate_sprite_dot(ppu, dot, sprite_height);
+}
+
+// Catch up a deferred evaluation up to, not including, end_dot
+static void nes_ppu_resolve_sprite_evaluation(nes_ppu* ppu, uint32_t end_dot)
+{
+    const unsigned sprite_height = 8 << ppu->ctrl.sprite_size;
+
+    ppu->eval_oam_deferred = 0;
+
+    for (uint32_t dot = 65; dot < end_dot; ++dot)
+        nes_ppu_evaluate_sprite_dot(ppu, dot, sprite_height);
+}
+
+// Bring a deferred evaluation up to date before OAM is accessed from outside the PPU
+static void nes_ppu_sync_sprite_evaluation(nes_ppu* ppu)
+{
+    if (ppu->eval_oam_deferred)
+        nes_ppu_resolve_sprite_evaluation(ppu, ppu->dot + 1);
+}
+
 #define _NES_PPU_IS_RENDERING(ppu) ((ppu->scanline < RENDER_END_SCANLINE || ppu->scanline == PRE_RENDER_SCANLINE) &&\
                                     (ppu->render_mask & NES_PPU_RENDER_MASK_RENDER))
 
@@ -203,6 +362,67 @@ static void nes_ppu_reset(nes_ppu* ppu)
     ppu->color_out = 0x0F;
 }
 
+// The sprite line is rebuilt from the sprite registers on the next visible dot instead of being saved
+static void nes_ppu_serialize(nes_ppu* ppu, nes_serializer* s)
+{
+    _NES_SERIALIZE_AS(s, 16, ppu->dot);
+    _NES_SERIALIZE_AS(s, 16, ppu->scanline);
+    nes_serialize_u8(s, &ppu->reg_rw_mode);
+    nes_serialize_u8(s, &ppu->reg_data);
+    _NES_SERIALIZE_AS(s, 8, ppu->reg_addr);
+    _NES_SERIALIZE_AS(s, 8, ppu->r);
+    _NES_SERIALIZE_AS(s, 8, ppu->w);
+    _NES_SERIALIZE_AS(s, 8, ppu->vbl);
+    nes_serialize_u16(s, &ppu->color_out);
+    _NES_SERIALIZE_AS(s, 8, ppu->is_even_frame);
+    nes_serialize_u16(s, &ppu->v_addr_reg);
+    nes_serialize_u16(s, &ppu->t_addr_reg);
+    _NES_SERIALIZE_AS(s, 8, ppu->write_toggle);
+    nes_serialize_u8(s, &ppu->fine_x);
+
+    nes_serialize_u8(s, &ppu->tile_value);
+    nes_serialize_u8(s, &ppu->palette_attribute);
+    nes_serialize_u32(s, &ppu->tile_pixels);
+    nes_serialize_u64(s, &ppu->bg_shift);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        nes_serialize_u8(s, &ppu->sprite_attributes[i].b);
+        nes_serialize_u8(s, &ppu->sprite_x_positions[i]);
+        nes_serialize_u32(s, &ppu->sprite_pixels[i]);
+    }
+
+    nes_serialize_u8(s, &ppu->eval_oam_has_sprite_zero);
+    nes_serialize_u8(s, &ppu->eval_oam_entry_data);
+    nes_serialize_u8(s, &ppu->eval_oam_byte_count);
+    nes_serialize_u8(s, &ppu->eval_oam_src_addr);
+    nes_serialize_u8(s, &ppu->eval_oam_deferred);
+
+    nes_serialize_u8(s, &ppu->sprite_0_test);
+    nes_serialize_u8(s, &ppu->cpu_read_buffer);
+    nes_serialize_u8(s, &ppu->cpu_read_buffer_latency);
+    _NES_SERIALIZE_AS(s, 8, ppu->update_cpu_read_buffer);
+    nes_serialize_u8(s, &ppu->pre_vblank);
+
+    nes_serialize_u8(s, &ppu->ctrl.b);
+    _NES_SERIALIZE_AS(s, 8, ppu->render_mask);
+    _NES_SERIALIZE_AS(s, 8, ppu->next_render_mask);
+    nes_serialize_u8(s, &ppu->status.b);
+    nes_serialize_u8(s, &ppu->oam_address);
+    nes_serialize_u16(s, &ppu->vram_address);
+    nes_serialize_u8(s, &ppu->vram_data);
+
+    nes_serialize_bytes(s, ppu->primary_oam.bytes, sizeof(ppu->primary_oam.bytes));
+    nes_serialize_bytes(s, ppu->secondary_oam.bytes, sizeof(ppu->secondary_oam.bytes));
+    nes_serialize_bytes(s, ppu->palettes, sizeof(ppu->palettes));
+
+    nes_serialize_u8(s, &ppu->open_bus);
+    nes_serialize_bytes(s, ppu->open_bus_decay_timer, sizeof(ppu->open_bus_decay_timer));
+
+    if (s->loading)
+        ppu->sprite_line_dirty = 1;
+}
+
 static void nes_ppu_execute(nes_ppu* __restrict ppu)
 {
     uint8_t palette_index = 0;
@@ -270,6 +490,10 @@ static void nes_ppu_execute(nes_ppu* __restrict ppu)
     {
         uint8_t open_bus_refresh_bits = 0;
 
+        // Registers may observe or change sprite evaluation, replay it up to the previous dot
+        if (ppu->eval_oam_deferred)
+            nes_ppu_resolve_sprite_evaluation(ppu, ppu->dot);
+
         if (ppu->reg_rw_mode == NES_PPU_REG_RW_MODE_READ)
             ppu->reg_data = ppu->open_bus;
         else
@@ -482,6 +706,10 @@ static void nes_ppu_execute(nes_ppu* __restrict ppu)
 
     if (!_NES_PPU_IS_RENDERING(ppu))
     {
+        // Evaluation stops with rendering
+        if (ppu->eval_oam_deferred)
+            nes_ppu_resolve_sprite_evaluation(ppu, ppu->dot);
+
         ppu->vram_address = ppu->v_addr_reg;
     }
     else if (ppu->dot)
@@ -499,61 +727,43 @@ static void nes_ppu_execute(nes_ppu* __restrict ppu)
             if ((ppu->render_mask & NES_PPU_RENDER_MASK_BACKGROUND) && 
                ((ppu->render_mask & NES_PPU_RENDER_MASK_LEFTMOST_BACKGROUND) || x > 7))
             {
-                unsigned bg_shift_x = 15 - ppu->fine_x;
-                bg_pattern = ((ppu->bg_shift_low  >> (bg_shift_x))     & 0x01) |
-                             ((ppu->bg_shift_high >> (bg_shift_x - 1)) & 0x02);
+                unsigned bg_pixel = (unsigned)(ppu->bg_shift >> ((15 - ppu->fine_x) * 4)) & 0x0F;
+                bg_pattern = bg_pixel & 0x03;
 
                 if (bg_pattern)
-                {
-                    palette_index = (bg_pattern |
-                                ((ppu->attr_shift_low  >> (bg_shift_x - 2)) & 0x04) | 
-                                ((ppu->attr_shift_high >> (bg_shift_x - 3)) & 0x08)) & 0x0F;
-                }
+                    palette_index = bg_pixel;
             }
 
-            if ((ppu->render_mask & NES_PPU_RENDER_MASK_SPRITES) && 
+            if ((ppu->render_mask & NES_PPU_RENDER_MASK_SPRITES) && x >= 0 &&
                ((ppu->render_mask & NES_PPU_RENDER_MASK_LEFTMOST_SPRITES) || x > 7))
             {
-                for (int i = 0; i < 8; ++i)
-                {
-                    if (x >= ppu->sprite_x_positions[i] && (x < ppu->sprite_x_positions[i] + 8))
-                    {
-                        unsigned sprite_shift = 7 - (x - ppu->sprite_x_positions[i]) & 7;
-                        unsigned pattern = (((ppu->sprite_shift_high[i] >> sprite_shift) << 1) & 2) |
-                                           ((ppu->sprite_shift_low[i] >> sprite_shift) & 1);
+                if (ppu->sprite_line_dirty)
+                    nes_ppu_build_sprite_line(ppu);
 
-                        if (pattern)
-                        {
-                            if (i == 0 && ppu->sprite_0_test && ppu->status.sprite_0_hit == 0)
-                                ppu->status.sprite_0_hit = bg_pattern && x != 255;
+                uint8_t sprite = ppu->sprite_line[x];
 
-                            if (bg_pattern == 0 || (ppu->sprite_attributes[i].priority == 0))
-                                palette_index = pattern | (ppu->sprite_attributes[i].palette << 2) | 0x10;
+                if (sprite)
+                {
+                    if ((sprite & _NES_PPU_SPRITE_LINE_SPRITE_0) && ppu->sprite_0_test && ppu->status.sprite_0_hit == 0)
+                        ppu->status.sprite_0_hit = bg_pattern && x != 255;
 
-                            break;
-                        }
-                    }
+                    if (bg_pattern == 0 || !(sprite & _NES_PPU_SPRITE_LINE_BEHIND_BG))
+                        palette_index = sprite & 0x1F;
                 }
             }
         }
 
         if (ppu->dot <= 256 || (ppu->dot > 320 && ppu->dot <= 336))
         {
-            // Shift background shift registers
-            ppu->bg_shift_high <<= 1;
-            ppu->bg_shift_low <<= 1;
-            ppu->attr_shift_high <<= 1;
-            ppu->attr_shift_low <<= 1;
+            // Shift background shift register
+            ppu->bg_shift <<= 4;
 
             // Fetch background data and update shift registers
             switch(ppu->dot & 7)
             {
                 case 1:
-                    // Reload shift registers
-                    ppu->bg_shift_high |= ppu->bitplane_slice_high;
-                    ppu->bg_shift_low |= ppu->bitplane_slice_low;
-                    ppu->attr_shift_low |= (ppu->palette_attribute & 1) * 0xFF;
-                    ppu->attr_shift_high |= ((ppu->palette_attribute >> 1) & 1) * 0xFF;
+                    // Reload shift register with the whole tile row
+                    ppu->bg_shift |= ppu->tile_pixels | ((ppu->palette_attribute & 3) * 0x44444444u);
 
                     // Fetch tile from nametable
                     ppu->r = 1;
@@ -578,7 +788,7 @@ static void nes_ppu_execute(nes_ppu* __restrict ppu)
                     ppu->vram_address = (ppu->ctrl.bgr_pattern_table_addr << 12) | (ppu->tile_value << 4) | ppu->v_addr.fine_y;
                     break; 
                 case 6:
-                    ppu->bitplane_slice_low = ppu->vram_data;
+                    ppu->tile_pixels = (ppu->tile_pixels & 0x22222222) | nes_ppu_decode_bitplane(ppu->vram_data);
                     break;
                 case 7:
                     // Fetch high bitplane
@@ -586,7 +796,7 @@ static void nes_ppu_execute(nes_ppu* __restrict ppu)
                     ppu->vram_address = (ppu->ctrl.bgr_pattern_table_addr << 12) | (ppu->tile_value << 4) | 8 | ppu->v_addr.fine_y;
                     break;
                 case 0:
-                    ppu->bitplane_slice_high = ppu->vram_data;
+                    ppu->tile_pixels = (ppu->tile_pixels & 0x11111111) | (nes_ppu_decode_bitplane(ppu->vram_data) << 1);
 
                     // Increment horizontal scrolling
                     if (ppu->v_addr.coarse_x == 31)
@@ -643,55 +853,18 @@ static void nes_ppu_execute(nes_ppu* __restrict ppu)
                     // clear secondary oam 
                     ppu->secondary_oam.bytes[(ppu->dot - 1) >> 1] = 0xFF;
                 }
-                else 
+                else if (ppu->dot == 65)
                 {
-                    if (ppu->dot & 1)
-                    {
-                        ppu->eval_oam_entry_data = ppu->primary_oam.bytes[ppu->oam_address];
-                    }
-                    else
-                    {
-                        if (ppu->oam_address >= ppu->eval_oam_src_addr)
-                        {
-                            ppu->eval_oam_src_addr = ppu->oam_address;
-
-                            int copy_oam = 1;
-
-                            if ((ppu->eval_oam_byte_count & 3) == 0)
-                            {
-                                uint8_t pos = ppu->eval_oam_entry_data;
-                                if (pos < 240 && ppu->scanline >= pos && ppu->scanline < (pos + sprite_height))
-                                {
-                                    if (ppu->dot == 66)
-                                        ppu->eval_oam_has_sprite_zero = 1;
-
-                                    if (ppu->eval_oam_byte_count == 32)
-                                        ppu->status.sprite_overflow = 1;
-                                }
-                                else
-                                {
-                                    copy_oam = 0;
-                                }
-                            }
-
-                            if (copy_oam)
-                            {
-                                if (ppu->eval_oam_byte_count < 32)
-                                    ppu->secondary_oam.bytes[ppu->eval_oam_byte_count++] = ppu->eval_oam_entry_data;
-
-                                ppu->oam_address++;
-                            }
-                            else
-                            {
-                                ppu->oam_address = (ppu->oam_address + 4);
-
-                                if (ppu->eval_oam_byte_count == 32)
-                                    ppu->oam_address = (ppu->oam_address & 0xFC) | ((ppu->oam_address + 1) & 3);
-                                else
-                                    ppu->oam_address &= 0xFC;
-                            }
-                        }
-                    }
+                    // Evaluate the whole line at dot 256 unless something observes it before
+                    ppu->eval_oam_deferred = 1;
+                }
+                else if (!ppu->eval_oam_deferred)
+                {
+                    nes_ppu_evaluate_sprite_dot(ppu, ppu->dot, sprite_height);
+                }
+                else if (ppu->dot == 256)
+                {
+                    nes_ppu_evaluate_sprites(ppu, sprite_height);
                 }
             }
         }
@@ -726,9 +899,11 @@ static void nes_ppu_execute(nes_ppu* __restrict ppu)
                         ppu->vram_address = 0x23C0 | (ppu->v_addr_reg & 0x0C00) | ((ppu->v_addr_reg >> 4) & 0x38) | ((ppu->v_addr_reg >> 2) & 0x07);
 
                         ppu->sprite_attributes[current_oam_index] = current_oam.attribute;
+                        ppu->sprite_line_dirty = 1;
                         break;
                     case 4:
                         ppu->sprite_x_positions[current_oam_index] = current_oam.position_x;
+                        ppu->sprite_line_dirty = 1;
                         break;
                     case 5:
                         {
@@ -752,10 +927,14 @@ static void nes_ppu_execute(nes_ppu* __restrict ppu)
                         }
                         break; 
                     case 6:
-                        if (current_oam.attribute.flip_x)
-                            ppu->sprite_shift_low[current_oam_index] = (uint8_t)(((ppu->vram_data * 0x80200802ULL) & 0x0884422110ULL) * 0x0101010101ULL >> 32);
-                        else
-                            ppu->sprite_shift_low[current_oam_index] = ppu->vram_data;
+                        {
+                            uint8_t bitplane = ppu->vram_data;
+                            if (current_oam.attribute.flip_x)
+                                bitplane = (uint8_t)(((bitplane * 0x80200802ULL) & 0x0884422110ULL) * 0x0101010101ULL >> 32);
+
+                            ppu->sprite_pixels[current_oam_index] = (ppu->sprite_pixels[current_oam_index] & 0x22222222) | nes_ppu_decode_bitplane(bitplane);
+                            ppu->sprite_line_dirty = 1;
+                        }
                         break;
                     case 7:
                         {
@@ -779,17 +958,18 @@ static void nes_ppu_execute(nes_ppu* __restrict ppu)
                         }
                         break;
                     case 0:
-                        if (current_oam.attribute.flip_x)
-                            ppu->sprite_shift_high[current_oam_index] = (uint8_t)(((ppu->vram_data * 0x80200802ULL) & 0x0884422110ULL) * 0x0101010101ULL >> 32);
-                        else
-                            ppu->sprite_shift_high[current_oam_index] = ppu->vram_data;
+                        {
+                            uint8_t bitplane = ppu->vram_data;
+                            if (current_oam.attribute.flip_x)
+                                bitplane = (uint8_t)(((bitplane * 0x80200802ULL) & 0x0884422110ULL) * 0x0101010101ULL >> 32);
+
+                            ppu->sprite_pixels[current_oam_index] = (ppu->sprite_pixels[current_oam_index] & 0x11111111) | (nes_ppu_decode_bitplane(bitplane) << 1);
+                            ppu->sprite_line_dirty = 1;
+                        }
 
                         // Set sprite to transparent if it's not detected on scanline.
                         if (current_oam_index >= max_oam_index)
-                        {
-                            ppu->sprite_shift_high[current_oam_index] = 0;
-                            ppu->sprite_shift_low[current_oam_index] = 0;
-                        }
+                            ppu->sprite_pixels[current_oam_index] = 0;
                         break;
                 }
             }
@@ -0,0 +1,412 @@
+#include "nes_rewind.h"
+
+#include <string.h>
+
+/////////////////////////////////////////////////
+// LZ
+/////////////////////////////////////////////////
+
+// LZ77 in LZ4 style sequences: a token with 4 bit literal and match lengths, the literals, then a 16 bit match offset.
+// XOR deltas are mostly zero runs, matches at offset 1 cover them
+#define REWIND_LZ_MIN_MATCH     4
+#define REWIND_LZ_MAX_OFFSET    0xFFFF
+#define REWIND_LZ_HASH_BITS     12
+
+// Incompressible input grows by a length byte per 255 literals and a token
+#define _REWIND_LZ_BOUND(size)  ((size) + (size) / 255 + 16)
+
+static uint32_t rewind_lz_hash(const uint8_t* data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(uint32_t));
+    return (value * 2654435761u) >> (32 - REWIND_LZ_HASH_BITS);
+}
+
+static uint8_t* rewind_lz_write_length(uint8_t* out, size_t length)
+{
+    for (; length >= 255; length -= 255)
+        *out++ = 255;
+
+    *out++ = (uint8_t)length;
+    return out;
+}
+
+static size_t rewind_lz_read_length(const uint8_t** in, const uint8_t* end)
+{
+    size_t length = 0;
+    uint8_t byte;
+
+    do
+    {
+        byte = *in < end ? *(*in)++ : 0;
+        length += byte;
+    } while (byte == 255);
+
+    return length;
+}
+
+// match_length 0 ends the block after the literals
+static uint8_t* rewind_lz_sequence(uint8_t* out, const uint8_t* literals, size_t literal_length, size_t offset, size_t match_length)
+{
+    size_t match_code = match_length ? match_length - REWIND_LZ_MIN_MATCH : 0;
+    uint8_t* token = out++;
+
+    *token = (uint8_t)(((literal_length < 15 ? literal_length : 15) << 4) | (match_code < 15 ? match_code : 15));
+
+    if (literal_length >= 15)
+        out = rewind_lz_write_length(out, literal_length - 15);
+
+    memcpy(out, literals, literal_length);
+    out += literal_length;
+
+    if (match_length)
+    {
+        *out++ = (uint8_t)(offset & 0xFF);
+        *out++ = (uint8_t)(offset >> 8);
+
+        if (match_code >= 15)
+            out = rewind_lz_write_length(out, match_code - 15);
+    }
+
+    return out;
+}
+
+// dst holds _REWIND_LZ_BOUND(size) bytes, table (1 << REWIND_LZ_HASH_BITS) positions. Returns the compressed size
+static size_t rewind_lz_compress(const uint8_t* src, size_t size, uint8_t* dst, uint32_t* table)
+{
+    const uint8_t* end = src + size;
+    const uint8_t* literals = src;
+    const uint8_t* in = src;
+    uint8_t* out = dst;
+
+    memset(table, 0, sizeof(uint32_t) << REWIND_LZ_HASH_BITS);
+
+    while (size >= REWIND_LZ_MIN_MATCH && in <= end - REWIND_LZ_MIN_MATCH)
+    {
+        uint32_t hash = rewind_lz_hash(in);
+        const uint8_t* candidate = src + table[hash];
+        table[hash] = (uint32_t)(in - src);
+
+        if (candidate >= in || in - candidate > REWIND_LZ_MAX_OFFSET || memcmp(candidate, in, REWIND_LZ_MIN_MATCH) != 0)
+        {
+            ++in;
+            continue;
+        }
+
+        const uint8_t* match_end = in + REWIND_LZ_MIN_MATCH;
+        const uint8_t* reference = candidate + REWIND_LZ_MIN_MATCH;
+
+        while (match_end < end && *match_end == *reference)
+        {
+            ++match_end;
+            ++reference;
+        }
+
+        out = rewind_lz_sequence(out, literals, in - literals, in - candidate, match_end - in);
+        in = literals = match_end;
+    }
+
+    out = rewind_lz_sequence(out, literals, end - literals, 0, 0);
+    return out - dst;
+}
+
+// Returns 0 unless the block decodes to exactly dst_size bytes
+static int rewind_lz_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size)
+{
+    const uint8_t* in = src;
+    const uint8_t* end = src + size;
+    uint8_t* out = dst;
+    uint8_t* out_end = dst + dst_size;
+
+    while (in < end)
+    {
+        uint8_t token = *in++;
+        size_t length = token >> 4;
+
+        if (length == 15)
+            length += rewind_lz_read_length(&in, end);
+
+        if (length > (size_t)(end - in) || length > (size_t)(out_end - out))
+            return 0;
+
+        memcpy(out, in, length);
+        in += length;
+        out += length;
+
+        if (in == end)
+            break;
+
+        if (end - in < 2)
+            return 0;
+
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+
+        length = token & 15;
+        if (length == 15)
+            length += rewind_lz_read_length(&in, end);
+        length += REWIND_LZ_MIN_MATCH;
+
+        if (!offset || offset > (size_t)(out - dst) || length > (size_t)(out_end - out))
+            return 0;
+
+        const uint8_t* reference = out - offset;
+
+        if (offset >= length)
+        {
+            memcpy(out, reference, length);
+            out += length;
+        }
+        else
+        {
+            // Overlapping match, repeats the last offset bytes
+            while (length--)
+                *out++ = *reference++;
+        }
+    }
+
+    return out == out_end;
+}
+
+/////////////////////////////////////////////////
+// Rewind
+/////////////////////////////////////////////////
+
+// Bytes of ring memory per index entry, the index takes the rest of the budget
+#define REWIND_BYTES_PER_ENTRY 256
+
+typedef struct rewind_entry
+{
+    size_t      offset;
+    size_t      size;
+} rewind_entry;
+
+struct nes_rewind
+{
+    nes_system*     system;
+    size_t          state_size;
+    uint8_t*        state;          // last captured state, the entries lead back from it
+    uint8_t*        scratch;        // state being captured, then the XOR delta
+    uint8_t*        packed;         // compressed delta, _REWIND_LZ_BOUND(state_size) bytes
+    uint32_t*       hash_table;
+    uint8_t*        data;           // compressed deltas, each entry is contiguous
+    size_t          data_size;
+    size_t          data_used;
+    rewind_entry*   entries;        // deltas to the frame before, oldest first from first_entry on
+    size_t          entry_capacity;
+    size_t          first_entry;
+    size_t          entry_count;
+    uint64_t        frame;
+    int             has_state;
+};
+
+static rewind_entry* rewind_entry_at(nes_rewind* rewind, size_t index)
+{
+    return &rewind->entries[(rewind->first_entry + index) % rewind->entry_capacity];
+}
+
+static void rewind_drop_oldest(nes_rewind* rewind)
+{
+    rewind->data_used -= rewind_entry_at(rewind, 0)->size;
+    rewind->first_entry = (rewind->first_entry + 1) % rewind->entry_capacity;
+    rewind->entry_count--;
+}
+
+// Entries are written one after the other and start over at 0 when the next one does not fit, the oldest are overwritten
+static int rewind_push(nes_rewind* rewind, const uint8_t* packed, size_t size)
+{
+    if (size > rewind->data_size)
+        return 0;
+
+    size_t offset = 0;
+
+    if (rewind->entry_count)
+    {
+        const rewind_entry* newest = rewind_entry_at(rewind, rewind->entry_count - 1);
+        offset = newest->offset + newest->size;
+
+        // The entries between the newest and the end of the ring are the oldest ones
+        if (offset + size > rewind->data_size)
+        {
+            while (rewind->entry_count && rewind_entry_at(rewind, 0)->offset >= offset)
+                rewind_drop_oldest(rewind);
+
+            offset = 0;
+        }
+    }
+
+    while (rewind->entry_count == rewind->entry_capacity ||
+           (rewind->entry_count && rewind_entry_at(rewind, 0)->offset >= offset && rewind_entry_at(rewind, 0)->offset < offset + size))
+    {
+        rewind_drop_oldest(rewind);
+    }
+
+    rewind_entry* entry = rewind_entry_at(rewind, rewind->entry_count++);
+    entry->offset = offset;
+    entry->size = size;
+
+    memcpy(rewind->data + offset, packed, size);
+    rewind->data_used += size;
+
+    return 1;
+}
+
+// dst ^= src, dst takes the XOR and src is left alone
+static void rewind_xor(uint8_t* dst, const uint8_t* src, size_t size)
+{
+    size_t words = size / sizeof(uint64_t);
+
+    for (size_t i = 0; i < words; ++i)
+        ((uint64_t*)dst)[i] ^= ((const uint64_t*)src)[i];
+
+    for (size_t i = words * sizeof(uint64_t); i < size; ++i)
+        dst[i] ^= src[i];
+}
+
+// The new state replaces the last one and leaves the XOR of the two in its place
+static void rewind_swap_delta(uint8_t* last, uint8_t* state, size_t size)
+{
+    size_t words = size / sizeof(uint64_t);
+
+    for (size_t i = 0; i < words; ++i)
+    {
+        uint64_t word = ((uint64_t*)state)[i];
+        ((uint64_t*)state)[i] ^= ((uint64_t*)last)[i];
+        ((uint64_t*)last)[i] = word;
+    }
+
+    for (size_t i = words * sizeof(uint64_t); i < size; ++i)
+    {
+        uint8_t byte = state[i];
+        state[i] ^= last[i];
+        last[i] = byte;
+    }
+}
+
+// Undoes the newest delta on the last captured state
+static int rewind_pop(nes_rewind* rewind)
+{
+    if (!rewind->entry_count)
+        return 0;
+
+    const rewind_entry* entry = rewind_entry_at(rewind, rewind->entry_count - 1);
+
+    if (!rewind_lz_decompress(rewind->data + entry->offset, entry->size, rewind->scratch, rewind->state_size))
+        return 0;
+
+    rewind_xor(rewind->state, rewind->scratch, rewind->state_size);
+
+    rewind->data_used -= entry->size;
+    rewind->entry_count--;
+    rewind->frame--;
+
+    return 1;
+}
+
+/////////////////////////////////////////////////
+// Public
+/////////////////////////////////////////////////
+
+nes_rewind* nes_rewind_create(nes_system* system, uint32_t memory_mb)
+{
+    nes_rewind* rewind = (nes_rewind*)calloc(1, sizeof(nes_rewind));
+    if (!rewind)
+        return 0;
+
+    size_t memory_size = (size_t)memory_mb << 20;
+
+    rewind->system = system;
+    rewind->state_size = nes_system_get_state_size(system);
+    rewind->entry_capacity = memory_size / REWIND_BYTES_PER_ENTRY;
+    rewind->data_size = memory_size - rewind->entry_capacity * sizeof(rewind_entry);
+
+    rewind->state = (uint8_t*)malloc(rewind->state_size);
+    rewind->scratch = (uint8_t*)malloc(rewind->state_size);
+    rewind->packed = (uint8_t*)malloc(_REWIND_LZ_BOUND(rewind->state_size));
+    rewind->hash_table = (uint32_t*)malloc(sizeof(uint32_t) << REWIND_LZ_HASH_BITS);
+    rewind->data = (uint8_t*)malloc(rewind->data_size);
+    rewind->entries = (rewind_entry*)malloc(rewind->entry_capacity * sizeof(rewind_entry));
+
+    if (!memory_mb || !rewind->state || !rewind->scratch || !rewind->packed || !rewind->hash_table || !rewind->data || !rewind->entries)
+    {
+        nes_rewind_destroy(rewind);
+        return 0;
+    }
+
+    return rewind;
+}
+
+void nes_rewind_destroy(nes_rewind* rewind)
+{
+    free(rewind->state);
+    free(rewind->scratch);
+    free(rewind->packed);
+    free(rewind->hash_table);
+    free(rewind->data);
+    free(rewind->entries);
+    free(rewind);
+}
+
+int nes_rewind_capture(nes_rewind* rewind)
+{
+    if (!nes_system_save_state(rewind->system, rewind->scratch, rewind->state_size))
+        return 0;
+
+    if (!rewind->has_state)
+    {
+        memcpy(rewind->state, rewind->scratch, rewind->state_size);
+        rewind->has_state = 1;
+        return 1;
+    }
+
+    rewind_swap_delta(rewind->state, rewind->scratch, rewind->state_size);
+
+    rewind->frame++;
+
+    size_t packed_size = rewind_lz_compress(rewind->scratch, rewind->state_size, rewind->packed, rewind->hash_table);
+
+    if (!rewind_push(rewind, rewind->packed, packed_size))
+    {
+        // A delta that does not fit breaks the chain, only the new state is left
+        while (rewind->entry_count)
+            rewind_drop_oldest(rewind);
+
+        return 0;
+    }
+
+    return 1;
+}
+
+int nes_rewind_step_back(nes_rewind* rewind)
+{
+    if (!rewind_pop(rewind))
+        return 0;
+
+    return nes_system_load_state(rewind->system, rewind->state, rewind->state_size);
+}
+
+int nes_rewind_to_frame(nes_rewind* rewind, uint64_t frame)
+{
+    if (!rewind->has_state || frame > rewind->frame || frame < rewind->frame - rewind->entry_count)
+        return 0;
+
+    while (rewind->frame > frame)
+    {
+        if (!rewind_pop(rewind))
+            return 0;
+    }
+
+    return nes_system_load_state(rewind->system, rewind->state, rewind->state_size);
+}
+
+nes_rewind_stats nes_rewind_get_stats(nes_rewind* rewind)
+{
+    nes_rewind_stats stats;
+
+    stats.frame = rewind->frame;
+    stats.first_frame = rewind->frame - rewind->entry_count;
+    stats.memory_used = rewind->data_used;
+    stats.memory_size = rewind->data_size;
+
+    return stats;
+}
@@ -0,0 +1,41 @@
+#ifndef _NES_REWIND_H_
+#define _NES_REWIND_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "nes_system.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct nes_rewind_stats
+{
+    uint64_t    frame;              // frame of the last capture, counted from the first one
+    uint64_t    first_frame;        // oldest frame the ring can still go back to
+    size_t      memory_used;        // compressed deltas held
+    size_t      memory_size;
+} nes_rewind_stats;
+
+typedef struct nes_rewind nes_rewind;
+
+// Keeps the states of the last frames within memory_mb MB, each one stored as the compressed XOR against the next
+nes_rewind*         nes_rewind_create(nes_system* system, uint32_t memory_mb);
+void                nes_rewind_destroy(nes_rewind* rewind);
+
+// Call once per frame, the oldest frames are dropped when the memory budget is used up. Returns 0 on failure
+int                 nes_rewind_capture(nes_rewind* rewind);
+
+// Loads the state captured the frame before and forgets the newer one. Returns 0 when there is nothing to go back to
+int                 nes_rewind_step_back(nes_rewind* rewind);
+
+// Loads the state captured at frame and forgets the newer ones. Returns 0 when frame is not held
+int                 nes_rewind_to_frame(nes_rewind* rewind, uint64_t frame);
+
+nes_rewind_stats    nes_rewind_get_stats(nes_rewind* rewind);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -9,6 +9,54 @@
 #include "nes_cartridge.h"
 #include "nes_mapper.h"
 
+#if !_WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define NES_ROM_MAPPED 1
+#else
+#define NES_ROM_MAPPED 0
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+
+// Sealing constants of linux/memfd.h and linux/fcntl.h, glibc only declares them with _GNU_SOURCE
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING   0x0002
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS         1033
+#define F_GET_SEALS         1034
+#endif
+#ifndef F_SEAL_SEAL
+#define F_SEAL_SEAL         0x0001
+#define F_SEAL_SHRINK       0x0002
+#define F_SEAL_GROW         0x0004
+#define F_SEAL_WRITE        0x0008
+#endif
+#endif
+
+// memfd backed images other processes can map, see nes_rom_image_create_shared
+#if NES_ROM_MAPPED && defined(__linux__) && defined(SYS_memfd_create)
+#define NES_ROM_SHARED 1
+#else
+#define NES_ROM_SHARED 0
+#endif
+
+// A shared memfd can no longer change size or contents, nor lose these seals
+#define _NES_ROM_SHARED_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+#if _WIN32
+#include <intrin.h>
+#define _NES_ROM_ATOMIC_INC(value)  _InterlockedIncrement(&(value))
+#define _NES_ROM_ATOMIC_DEC(value)  _InterlockedDecrement(&(value))
+#else
+#define _NES_ROM_ATOMIC_INC(value)  __atomic_add_fetch(&(value), 1, __ATOMIC_RELAXED)
+#define _NES_ROM_ATOMIC_DEC(value)  __atomic_sub_fetch(&(value), 1, __ATOMIC_ACQ_REL)
+#endif
+
 typedef enum nes_rom_format
 {
     NES_ROM_FORMAT_UNKNOWN,
@@ -67,56 +115,293 @@ struct ines_header
     uint8_t reserved[5];
 };
 
-static nes_cartridge* nes_rom_create_ines_cartridge(const void* rom_file, size_t rom_file_size)
+static nes_rom_format nes_rom_get_format(const void* rom_file, size_t rom_file_size)
 {
+    if (rom_file_size > 4 && memcmp(rom_file, "NES\x1a", 4) == 0)
+        return NES_ROM_FORMAT_INES;
+
+    return NES_ROM_FORMAT_UNKNOWN;
+}
+
+// Where PRG ROM starts in an iNES file, after the header and the trainer. 0 when the file is too short for the ROM sizes
+// its header declares
+static size_t nes_rom_ines_prg_offset(const void* rom_file, size_t rom_file_size)
+{
+    if (nes_rom_get_format(rom_file, rom_file_size) != NES_ROM_FORMAT_INES || rom_file_size < sizeof(struct ines_header))
+        return 0;
+
     struct ines_header* hdr = (struct ines_header*)rom_file;
-    int mapper_id = ((hdr->flags7.mapper_high << 4) | hdr->flags6.mapper_low);
+    size_t prg_offset = sizeof(struct ines_header) + (hdr->flags6.has_trainer?512:0);
+    size_t rom_size = hdr->prg_rom_size * 0x4000 + hdr->chr_rom_size * 0x2000;
+
+    if (prg_offset > rom_file_size || rom_size > rom_file_size - prg_offset)
+        return 0;
+
+    return prg_offset;
+}
+
+static void nes_rom_image_read_header(nes_rom_image* image, const struct ines_header* hdr)
+{
+    image->prg_rom_size = hdr->prg_rom_size * 0x4000;
+    image->chr_rom_size = hdr->chr_rom_size * 0x2000;
+    image->mapper_id = ((hdr->flags7.mapper_high << 4) | hdr->flags6.mapper_low);
+    image->alternative_nametable_layout = hdr->flags6.alternative_nametable_layout;
+
+    if (hdr->flags6.mirroring)
+        image->mirroring = NES_NAMETABLE_MIRRORING_VERTICAL;
+    else
+        image->mirroring = NES_NAMETABLE_MIRRORING_HORIZONTAL;
+
+    image->refs = 1;
+    image->mapping = 0;
+    image->mapping_size = 0;
+    image->shared_fd = -1;
+
+    printf("PRG ROM: %d KB \tCHR ROM: %d KB\n", (int)(image->prg_rom_size / 1024), (int)(image->chr_rom_size / 1024));
+    printf("mapper: %d\n", image->mapper_id);
+}
+
+// Copy of the PRG and CHR ROM of an iNES file, the caller holds the one reference
+static nes_rom_image* nes_rom_image_create(const void* rom_file, size_t rom_file_size)
+{
+    size_t prg_offset = nes_rom_ines_prg_offset(rom_file, rom_file_size);
+    if (!prg_offset)
+        return 0;
+
+    struct ines_header* hdr = (struct ines_header*)rom_file;
+    size_t rom_size = hdr->prg_rom_size * 0x4000 + hdr->chr_rom_size * 0x2000;
+
+    nes_rom_image* image = (nes_rom_image*)malloc(sizeof(nes_rom_image) + rom_size);
+    if (!image)
+        return 0;
+
+    nes_rom_image_read_header(image, hdr);
+    image->prg_rom = (uint8_t*)image + sizeof(nes_rom_image);
+    image->chr_rom = image->prg_rom + image->prg_rom_size;
+
+    memcpy(image->prg_rom, (uint8_t*)rom_file + prg_offset, rom_size);
+
+    return image;
+}
+
+#if NES_ROM_MAPPED
+// Image reading PRG and CHR ROM in place from a read only mapping of a whole iNES file, it unmaps it once released.
+// Returns 0 without taking the mapping when the file is too short
+static nes_rom_image* nes_rom_image_create_mapped(void* mapping, size_t mapping_size)
+{
+    size_t prg_offset = nes_rom_ines_prg_offset(mapping, mapping_size);
+    if (!prg_offset)
+        return 0;
+
+    nes_rom_image* image = (nes_rom_image*)malloc(sizeof(nes_rom_image));
+    if (!image)
+        return 0;
+
+    nes_rom_image_read_header(image, (struct ines_header*)mapping);
+    image->prg_rom = (uint8_t*)mapping + prg_offset;
+    image->chr_rom = image->prg_rom + image->prg_rom_size;
+    image->mapping = mapping;
+    image->mapping_size = mapping_size;
+
+    return image;
+}
+#endif
+
+// Maps the memfd of an image made by nes_rom_image_create_shared in another process, the caller keeps fd.
+// Returns 0 for a memfd that is not sealed and where there are no shared images
+static nes_rom_image* nes_rom_image_open_shared(int fd)
+{
+#if NES_ROM_SHARED
+    // Only a sealed memfd is safe to read in place, whoever else holds fd could otherwise write or truncate it under us
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & _NES_ROM_SHARED_SEALS) != _NES_ROM_SHARED_SEALS)
+        return 0;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(struct ines_header))
+        return 0;
+
+    size_t mapping_size = (size_t)file_stat.st_size;
+    uint8_t* mapping = (uint8_t*)mmap(0, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+        return 0;
+
+    // The memfd holds the iNES header without a trainer followed by PRG and CHR ROM
+    struct ines_header* hdr = (struct ines_header*)mapping;
+    size_t rom_size = hdr->prg_rom_size * 0x4000 + hdr->chr_rom_size * 0x2000;
+
+    nes_rom_image* image = 0;
+
+    if (nes_rom_get_format(mapping, mapping_size) == NES_ROM_FORMAT_INES && !hdr->flags6.has_trainer &&
+        rom_size <= mapping_size - sizeof(struct ines_header))
+    {
+        image = (nes_rom_image*)malloc(sizeof(nes_rom_image));
+    }
+
+    if (!image)
+    {
+        munmap(mapping, mapping_size);
+        return 0;
+    }
+
+    nes_rom_image_read_header(image, hdr);
+    image->prg_rom = mapping + sizeof(struct ines_header);
+    image->chr_rom = image->prg_rom + image->prg_rom_size;
+    image->mapping = mapping;
+    image->mapping_size = mapping_size;
+
+    return image;
+#else
+    return 0;
+#endif
+}
+
+// Same as nes_rom_image_create with the ROM in a sealed memfd mapped read only. Other processes given shared_fd, inherited or
+// sent over a socket, map the same pages with nes_rom_image_open_shared. Falls back to a private copy without memfd
+static nes_rom_image* nes_rom_image_create_shared(const void* rom_file, size_t rom_file_size)
+{
+#if NES_ROM_SHARED
+    size_t prg_offset = nes_rom_ines_prg_offset(rom_file, rom_file_size);
+    if (!prg_offset)
+        return 0;
+
+    struct ines_header hdr = *(struct ines_header*)rom_file;
+    size_t rom_size = hdr.prg_rom_size * 0x4000 + hdr.chr_rom_size * 0x2000;
+    size_t mapping_size = sizeof(struct ines_header) + rom_size;
+
+    uint8_t* prg_ptr = (uint8_t*)rom_file + prg_offset;
+    hdr.flags6.has_trainer = 0;
+
+    int fd = (int)syscall(SYS_memfd_create, "nesm-rom", MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return nes_rom_image_create(rom_file, rom_file_size);
+
+    uint8_t* mapping = (uint8_t*)MAP_FAILED;
+    if (ftruncate(fd, (off_t)mapping_size) == 0)
+        mapping = (uint8_t*)mmap(0, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 
-    uint32_t chr_ram_size = hdr->chr_rom_size ? 0 : 0x2000;
+    if (mapping == MAP_FAILED)
+    {
+        close(fd);
+        return 0;
+    }
 
-    size_t cartridge_size = sizeof(nes_cartridge) + sizeof(nes_mapper);
-    cartridge_size += hdr->prg_rom_size * 0x4000;
-    cartridge_size += hdr->chr_rom_size * 0x2000;
-    cartridge_size += chr_ram_size;
+    memcpy(mapping, &hdr, sizeof(struct ines_header));
+    memcpy(mapping + sizeof(struct ines_header), prg_ptr, rom_size);
+    munmap(mapping, mapping_size);
 
-    nes_mapper mapper = nes_mapper_get(mapper_id, hdr->flags6.alternative_nametable_layout);
-    cartridge_size += mapper.state_size;
+    // F_SEAL_WRITE fails while a writable mapping is left
+    nes_rom_image* image = 0;
+    if (fcntl(fd, F_ADD_SEALS, _NES_ROM_SHARED_SEALS) == 0)
+        image = nes_rom_image_open_shared(fd);
 
-    printf("PRG ROM: %d KB \tCHR ROM: %d KB\n", ((hdr->prg_rom_size * 16384)/1024), ((hdr->chr_rom_size * 8192)/1024));
-    printf("mapper: %d\n", mapper_id);
+    if (!image)
+    {
+        close(fd);
+        return 0;
+    }
 
-    nes_cartridge* cartridge = (nes_cartridge*)malloc(cartridge_size);
-    cartridge->prg_rom_size = hdr->prg_rom_size * 0x4000;
-    cartridge->chr_rom_size = hdr->chr_rom_size * 0x2000;
-    cartridge->chr_ram_size = hdr->chr_rom_size ? 0 : 0x2000;
+    image->shared_fd = fd;
+    return image;
+#else
+    return nes_rom_image_create(rom_file, rom_file_size);
+#endif
+}
+
+static nes_rom_image* nes_rom_image_retain(nes_rom_image* image)
+{
+    _NES_ROM_ATOMIC_INC(image->refs);
+    return image;
+}
+
+// Any thread can drop its reference, the last one frees the ROM
+static void nes_rom_image_release(nes_rom_image* image)
+{
+    if (_NES_ROM_ATOMIC_DEC(image->refs) != 0)
+        return;
+
+#if NES_ROM_MAPPED
+    if (image->mapping)
+        munmap(image->mapping, image->mapping_size);
+
+    if (image->shared_fd >= 0)
+        close(image->shared_fd);
+#endif
+
+    free(image);
+}
+
+// Mapper state and CHR RAM of one instance running the image, the cartridge takes its own reference
+static nes_cartridge* nes_rom_create_image_cartridge(nes_rom_image* image)
+{
+    uint32_t chr_ram_size = image->chr_rom_size ? 0 : 0x2000;
+
+    nes_mapper mapper = nes_mapper_get(image->mapper_id, image->alternative_nametable_layout);
+
+    nes_cartridge* cartridge = (nes_cartridge*)malloc(sizeof(nes_cartridge) + sizeof(nes_mapper) + mapper.state_size + chr_ram_size);
+    if (!cartridge)
+        return 0;
+
+    cartridge->rom = nes_rom_image_retain(image);
+    cartridge->prg_rom = image->prg_rom;
+    cartridge->prg_rom_size = image->prg_rom_size;
+    cartridge->chr_rom = image->chr_rom;
+    cartridge->chr_rom_size = image->chr_rom_size;
+    cartridge->chr_ram_size = chr_ram_size;
     cartridge->state_size = mapper.state_size + cartridge->chr_ram_size;
     cartridge->mapper = (nes_mapper*)((uint8_t*)cartridge + sizeof(nes_cartridge));
-    cartridge->prg_rom = (uint8_t*)cartridge->mapper + sizeof(nes_mapper);
-    cartridge->chr_rom = cartridge->prg_rom + cartridge->prg_rom_size;
-    cartridge->state   = cartridge->chr_rom + cartridge->chr_rom_size;
+    cartridge->state   = (uint8_t*)cartridge->mapper + sizeof(nes_mapper);
     cartridge->chr_ram = (uint8_t*)cartridge->state + mapper.state_size;
+    cartridge->mirroring = image->mirroring;
 
-    if (hdr->flags6.mirroring)
-        cartridge->mirroring = NES_NAMETABLE_MIRRORING_VERTICAL;
-    else
-        cartridge->mirroring = NES_NAMETABLE_MIRRORING_HORIZONTAL;
+    cartridge->ciram = 0;
+    cartridge->prg_ram = 0;
+    cartridge->prg_ram_size = 0;
 
     memcpy(cartridge->mapper, &mapper, sizeof(nes_mapper));
     mapper.init(cartridge);
 
-    uint8_t* prg_ptr = (uint8_t*)rom_file + sizeof(struct ines_header) + (hdr->flags6.has_trainer?512:0);
-    memcpy(cartridge->prg_rom, prg_ptr, cartridge->prg_rom_size);
-    memcpy(cartridge->chr_rom, prg_ptr + cartridge->prg_rom_size, cartridge->chr_rom_size);
+    return cartridge;
+}
+
+static nes_cartridge* nes_rom_create_ines_cartridge(const void* rom_file, size_t rom_file_size)
+{
+    nes_rom_image* image = nes_rom_image_create(rom_file, rom_file_size);
+    if (!image)
+        return 0;
+
+    nes_cartridge* cartridge = nes_rom_create_image_cartridge(image);
+    nes_rom_image_release(image);
 
     return cartridge;
 }
 
-static nes_rom_format nes_rom_get_format(const void* rom_file, size_t rom_file_size)
+// New cartridge with a copy of the mapper state and CHR RAM running the same ROM image
+static nes_cartridge* nes_rom_clone_cartridge(const nes_cartridge* cartridge)
 {
-    if (rom_file_size > 4 && memcmp(rom_file, "NES\x1a", 4) == 0)
-        return NES_ROM_FORMAT_INES;
+    nes_cartridge* clone = (nes_cartridge*)malloc(sizeof(nes_cartridge) + sizeof(nes_mapper) + cartridge->state_size);
+    if (!clone)
+        return 0;
 
-    return NES_ROM_FORMAT_UNKNOWN;
+    memcpy(clone, cartridge, sizeof(nes_cartridge));
+    clone->mapper = (nes_mapper*)((uint8_t*)clone + sizeof(nes_cartridge));
+    clone->state = (uint8_t*)clone->mapper + sizeof(nes_mapper);
+    clone->chr_ram = (uint8_t*)clone->state + (cartridge->chr_ram - (uint8_t*)cartridge->state);
+    clone->prg_ram = cartridge->prg_ram ? (uint8_t*)clone->state + (cartridge->prg_ram - (uint8_t*)cartridge->state) : 0;
+    clone->ciram = 0;
+
+    memcpy(clone->mapper, cartridge->mapper, sizeof(nes_mapper));
+    memcpy(clone->state, cartridge->state, cartridge->state_size);
+    clone->mapper->map_banks(clone);
+
+    nes_rom_image_retain(clone->rom);
+    return clone;
+}
+
+static void nes_rom_free_cartridge(nes_cartridge* cartridge)
+{
+    nes_rom_image_release(cartridge->rom);
+    free(cartridge);
 }
 
 static nes_cartridge* nes_rom_create_cartridge(const void* rom_file, size_t rom_file_size)
@@ -129,9 +414,46 @@ static nes_cartridge* nes_rom_create_cartridge(const void* rom_file, size_t rom_
     return 0;
 }
 
-static nes_cartridge* nes_rom_load_cartridge(const char* path)
+// Loads an iNES file into a new image, a shared one when asked, see nes_rom_image_create_shared. A private image maps
+// the file and reads the ROM in place, the file must not be truncated while the image lives. Files that cannot be mapped
+// are read and copied
+static nes_rom_image* nes_rom_load_image(const char* path, int shared)
 {
-    nes_cartridge* cartridge = 0;
+    nes_rom_image* image = 0;
+
+#if NES_ROM_MAPPED
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        struct stat file_stat;
+        void* mapping = MAP_FAILED;
+        size_t mapping_size = 0;
+
+        if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0)
+        {
+            mapping_size = (size_t)file_stat.st_size;
+            mapping = mmap(0, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+
+        close(fd);
+
+        if (mapping != MAP_FAILED)
+        {
+            if (shared)
+                image = nes_rom_image_create_shared(mapping, mapping_size);
+            else
+                image = nes_rom_image_create_mapped(mapping, mapping_size);
+
+            if (!image || shared)
+                munmap(mapping, mapping_size);
+
+            if (!image)
+                fprintf(stderr, "Invalid NES ROM: %s\n", path);
+
+            return image;
+        }
+    }
+#endif
 
 #if _WIN32
     FILE* rom_file = NULL;
@@ -149,9 +471,15 @@ static nes_cartridge* nes_rom_load_cartridge(const char* path)
         fseek(rom_file, 0, SEEK_SET);
 
         rom_file_data = malloc(rom_file_size);
-        fread(rom_file_data, rom_file_size, 1, rom_file);
 
-        cartridge = nes_rom_create_cartridge(rom_file_data, rom_file_size);
+        if (rom_file_data && fread(rom_file_data, rom_file_size, 1, rom_file) == 1)
+        {
+            if (shared)
+                image = nes_rom_image_create_shared(rom_file_data, rom_file_size);
+            else
+                image = nes_rom_image_create(rom_file_data, rom_file_size);
+        }
+
         free(rom_file_data);
 
         fclose(rom_file);
@@ -161,6 +489,18 @@ static nes_cartridge* nes_rom_load_cartridge(const char* path)
         perror("Failed to load NES ROM");
     }
 
+    return image;
+}
+
+static nes_cartridge* nes_rom_load_cartridge(const char* path)
+{
+    nes_rom_image* image = nes_rom_load_image(path, 0);
+    if (!image)
+        return 0;
+
+    nes_cartridge* cartridge = nes_rom_create_image_cartridge(image);
+    nes_rom_image_release(image);
+
     return cartridge;
 }
 
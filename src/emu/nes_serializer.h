@@ -0,0 +1,204 @@
+#ifndef _NES_SERIALIZER_H_
+#define _NES_SERIALIZER_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <memory.h>
+
+// Field by field state serialization in a fixed little endian layout, the same function saves and loads.
+// Data is a list of chunks, a 4 byte tag and the 4 byte payload size, so loaders can skip what they do not know.
+
+typedef struct nes_serializer
+{
+    uint8_t*    data;       // 0 only counts the bytes a save takes
+    size_t      size;
+    size_t      offset;
+    int         loading;
+    int         failed;     // ran past size, the fields after that were left alone
+} nes_serializer;
+
+#define _NES_SERIALIZER_TAG(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+static nes_serializer nes_serializer_create(void* data, size_t size, int loading)
+{
+    nes_serializer s;
+    s.data = (uint8_t*)data;
+    s.size = size;
+    s.offset = 0;
+    s.loading = loading;
+    s.failed = 0;
+    return s;
+}
+
+static void nes_serialize_bytes(nes_serializer* s, void* bytes, size_t size)
+{
+    if (s->failed)
+        return;
+
+    if (s->data)
+    {
+        if (size > s->size - s->offset)
+        {
+            s->failed = 1;
+            return;
+        }
+
+        if (s->loading)
+            memcpy(bytes, s->data + s->offset, size);
+        else
+            memcpy(s->data + s->offset, bytes, size);
+    }
+
+    s->offset += size;
+}
+
+static void nes_serialize_u8(nes_serializer* s, uint8_t* value)
+{
+    nes_serialize_bytes(s, value, 1);
+}
+
+static void nes_serialize_u16(nes_serializer* s, uint16_t* value)
+{
+    uint8_t bytes[2] = { (uint8_t)*value, (uint8_t)(*value >> 8) };
+
+    nes_serialize_bytes(s, bytes, sizeof(bytes));
+
+    if (s->loading && !s->failed)
+        *value = (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+static void nes_serialize_u32(nes_serializer* s, uint32_t* value)
+{
+    uint8_t bytes[4];
+
+    for (int i = 0; i < 4; ++i)
+        bytes[i] = (uint8_t)(*value >> (i * 8));
+
+    nes_serialize_bytes(s, bytes, sizeof(bytes));
+
+    if (s->loading && !s->failed)
+        *value = (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static void nes_serialize_u64(nes_serializer* s, uint64_t* value)
+{
+    uint8_t bytes[8];
+
+    for (int i = 0; i < 8; ++i)
+        bytes[i] = (uint8_t)(*value >> (i * 8));
+
+    nes_serialize_bytes(s, bytes, sizeof(bytes));
+
+    if (s->loading && !s->failed)
+    {
+        *value = 0;
+
+        for (int i = 0; i < 8; ++i)
+            *value |= (uint64_t)bytes[i] << (i * 8);
+    }
+}
+
+// Arrays of 16 bit values, bounds checked once for the whole array
+static void nes_serialize_u16_array(nes_serializer* s, uint16_t* values, size_t count)
+{
+    size_t size = count * sizeof(uint16_t);
+
+    if (s->failed)
+        return;
+
+    if (s->data)
+    {
+        if (size > s->size - s->offset)
+        {
+            s->failed = 1;
+            return;
+        }
+
+        uint8_t* bytes = s->data + s->offset;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (s->loading)
+            {
+                values[i] = (uint16_t)(bytes[i * 2] | (bytes[i * 2 + 1] << 8));
+            }
+            else
+            {
+                bytes[i * 2] = (uint8_t)values[i];
+                bytes[i * 2 + 1] = (uint8_t)(values[i] >> 8);
+            }
+        }
+    }
+
+    s->offset += size;
+}
+
+// Zeros on save and skipped on load, for fields that only use part of a fixed size area
+static void nes_serialize_padding(nes_serializer* s, size_t size)
+{
+    if (s->failed)
+        return;
+
+    if (s->data)
+    {
+        if (size > s->size - s->offset)
+        {
+            s->failed = 1;
+            return;
+        }
+
+        if (!s->loading)
+            memset(s->data + s->offset, 0, size);
+    }
+
+    s->offset += size;
+}
+
+// Bitfields, enums and host sized integers go through a temporary of the width they are stored with
+#define _NES_SERIALIZE_AS(s, bits, field) \
+    { uint##bits##_t value_ = (uint##bits##_t)(field); nes_serialize_u##bits((s), &value_); (field) = value_; }
+
+// Returns where the payload starts, pass it to nes_serializer_end_chunk once the payload is written
+static size_t nes_serializer_begin_chunk(nes_serializer* s, uint32_t tag)
+{
+    uint32_t size = 0;
+
+    nes_serialize_u32(s, &tag);
+    nes_serialize_u32(s, &size);
+
+    return s->offset;
+}
+
+static void nes_serializer_end_chunk(nes_serializer* s, size_t payload_offset)
+{
+    if (s->data && !s->failed)
+    {
+        nes_serializer header = nes_serializer_create(s->data + payload_offset - sizeof(uint32_t), sizeof(uint32_t), 0);
+        uint32_t size = (uint32_t)(s->offset - payload_offset);
+        nes_serialize_u32(&header, &size);
+    }
+}
+
+// Steps over the next chunk of a loading serializer and returns a loader bounded to its payload. Returns 0 at the end or on a truncated chunk
+static int nes_serializer_next_chunk(nes_serializer* s, uint32_t* tag, nes_serializer* payload)
+{
+    uint32_t size = 0;
+
+    if (s->failed || s->offset >= s->size)
+        return 0;
+
+    nes_serialize_u32(s, tag);
+    nes_serialize_u32(s, &size);
+
+    if (s->failed || size > s->size - s->offset)
+    {
+        s->failed = 1;
+        return 0;
+    }
+
+    *payload = nes_serializer_create(s->data + s->offset, size, 1);
+    s->offset += size;
+    return 1;
+}
+
+#endif
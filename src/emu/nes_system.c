@@ -1,14 +1,100 @@
 #include <memory.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include "nes_system.h"
+#include "nes_system_internal.h"
 #include "nes_rom.h"
 #include "nes_ppu.h"
 #include "nes_apu.h"
-#include "emu6502.h"
+#include "nes_blip.h"
+#include "nes_serializer.h"
+#include "emu6502_uop.h"
+
+#if NES_SYSTEM_PROFILE
+#include <time.h>
+#endif
 
 // TODO:
 // - 2nd controller handling
 
+// Layer hooks, dispatched from per-hook arrays so systems without layers only test a mask
+enum
+{
+    LAYER_HOOK_MEMORY,
+    LAYER_HOOK_CPU,
+    LAYER_HOOK_PPU,
+    LAYER_HOOK_APU,
+    LAYER_HOOK_COUNT
+};
+
+#define _LAYER_HOOK_BIT(hook) (1u << (hook))
+#define _LAYER_CPU_CYCLE_BIT  (1u << LAYER_HOOK_COUNT) // a CPU layer wants every cycle, not only instruction starts
+
+// Components that need peripherals_tick to stop and look at them, see schedule_event
+enum
+{
+    EVENT_PPU,      // vblank NMI edge, video output or a PPU access, the PPU runs dot by dot from here
+    EVENT_IRQ,      // the interrupt line inputs changed
+    EVENT_MAPPER,   // mapper tick has work to do
+    EVENT_APU,      // frame sequencer IRQ, DMC fetch or an APU access, the APU runs cycle by cycle from here
+    EVENT_COUNT
+};
+
+#define _EVENT_NEVER UINT64_MAX
+
+// Memory the system writes in place, delta snapshots only keep its 256 byte blocks written since the base snapshot
+#define _DIRTY_BLOCK_SIZE   0x100
+#define _DIRTY_MAX_BLOCKS   128
+
+#define _STATIC_ASSERT(condition, name) typedef char static_assert_##name[(condition) ? 1 : -1]
+
+enum
+{
+    DIRTY_REGION_RAM,
+    DIRTY_REGION_VRAM,
+    DIRTY_REGION_CARTRIDGE, // mapper RAM and CHR RAM at the end of the cartridge state
+    DIRTY_REGION_COUNT
+};
+
+typedef struct dirty_region
+{
+    uint8_t*    memory;
+    size_t      size;
+    size_t      first_block;
+    size_t      state_offset;   // where the region is in a nes_system_save_state buffer
+} dirty_region;
+
+// Save states are a header and these chunks, all of them required and of a fixed size for a given cartridge
+#define _STATE_MAGIC        _NES_SERIALIZER_TAG('N', 'E', 'S', 'S')
+#define _STATE_VERSION      1
+#define _STATE_HEADER_SIZE  8   // magic and version
+#define _STATE_CHUNK_HEADER_SIZE 8
+
+enum
+{
+    STATE_CHUNK_CPU,
+    STATE_CHUNK_PPU,
+    STATE_CHUNK_APU,
+    STATE_CHUNK_SYSTEM,     // DMA, controller ports and cached register reads
+    STATE_CHUNK_RAM,
+    STATE_CHUNK_VRAM,
+    STATE_CHUNK_MAPPER,     // mapper registers, see nes_mapper.serialize
+    STATE_CHUNK_CARTRIDGE_RAM,
+    STATE_CHUNK_COUNT
+};
+
+static const uint32_t state_chunk_tags[STATE_CHUNK_COUNT] =
+{
+    _NES_SERIALIZER_TAG('C', 'P', 'U', ' '),
+    _NES_SERIALIZER_TAG('P', 'P', 'U', ' '),
+    _NES_SERIALIZER_TAG('A', 'P', 'U', ' '),
+    _NES_SERIALIZER_TAG('S', 'Y', 'S', ' '),
+    _NES_SERIALIZER_TAG('R', 'A', 'M', ' '),
+    _NES_SERIALIZER_TAG('V', 'R', 'A', 'M'),
+    _NES_SERIALIZER_TAG('M', 'A', 'P', 'R'),
+    _NES_SERIALIZER_TAG('C', 'R', 'A', 'M')
+};
+
 typedef struct nes_system_state
 {
     cpu_state   cpu;
@@ -37,46 +123,260 @@ struct nes_system
     nes_system_state    state;
     nes_config          config;
     nes_cartridge*      cartridge;
+    int                 owns_cartridge;     // created by the system or cloned, otherwise the caller's NES_SOURCE_CARTRIGE
+    uint32_t            layer_hooks;        // _LAYER_HOOK_BIT of every hook with at least one layer, see update_layer_hooks
+    nes_system_layer**  layer_hook_lists[LAYER_HOOK_COUNT]; // layers implementing each hook in chain order, 0 terminated
     uint16_t            framebuffer[SCANLINE_WIDTH * TOTAL_SCANLINES];
+    cpu_page            cpu_pages[0x100];
+    uint8_t*            cpu_prg_banks[4];   // cartridge PRG banks the pages were mapped from
+    uint8_t*            cpu_prg_ram_read;
+    uint8_t*            cpu_prg_ram_write;
+    uint8_t*            ppu_pages[16];      // 1 KB PPU pages as mapped by the cartridge, 0 when the mapper decodes the access
+    dirty_region        dirty_regions[DIRTY_REGION_COUNT];
+    size_t              dirty_block_count;
+    uint8_t             dirty_blocks[_DIRTY_MAX_BLOCKS + 1]; // written since the base snapshot, the last flag takes writes outside the regions
+    size_t              state_chunk_sizes[STATE_CHUNK_COUNT];
+    size_t              state_size;
+    uint64_t            cycle;              // master clock, CPU cycles since the system was created
+    uint64_t            event_cycles[EVENT_COUNT]; // cycle each component wants peripherals_tick back at
+    uint64_t            next_event_cycle;   // earliest of event_cycles, cycles before it are only counted
+    uint64_t            ppu_cycle;          // cycle the PPU has caught up to, it runs behind the master clock in between events
+    int                 ppu_observed;       // mapper or layers watch the PPU cycle by cycle
+    uint64_t            apu_cycle;          // cycle the APU has caught up to
+    int                 apu_observed;       // layers watch the APU cycle by cycle
+    uint32_t            run_flags;          // NES_RUN_VBLANK, NES_RUN_FRAME and NES_RUN_INPUT conditions nes_system_run_until waits for
+    uint32_t            run_stops;          // conditions met since the run started
+    nes_blip            audio_blip;
+    uint32_t            audio_clock;        // CPU cycles since the last audio output
+    uint32_t            audio_output_state; // channel outputs audio_amplitude was mixed from
+    int16_t             audio_amplitude;
+    int                 audio_muted;        // the APU runs but audio output stays where it was, see nes_system_set_audio_muted
+    int16_t             audio_samples[NES_BLIP_MAX_SAMPLES];
+#if NES_SYSTEM_PROFILE
+    nes_system_profile* profile;
+    uint64_t            profile_time;
+#endif
 };
 
-static void execute_memory_callbacks(nes_system* system, nes_memory_type memory_type, nes_memory_op op, uint16_t address, uint8_t* data)
+static void schedule_event(nes_system* system, int event, uint64_t cycle)
 {
-    for (nes_system_layer* layer = system->config.layer; layer; layer = layer->next)
+    system->event_cycles[event] = cycle;
+
+    if (cycle < system->next_event_cycle)
+        system->next_event_cycle = cycle;
+}
+
+static void update_next_event(nes_system* system)
+{
+    system->next_event_cycle = system->event_cycles[0];
+
+    for (int i = 1; i < EVENT_COUNT; ++i)
     {
-        if (layer->memory_callback)
-            layer->memory_callback(memory_type, op, address, data, layer->client_data);
+        if (system->event_cycles[i] < system->next_event_cycle)
+            system->next_event_cycle = system->event_cycles[i];
     }
 }
 
-static void execute_cpu_callbacks(nes_system* system, cpu_state* state)
+// Drop deferred work and look at every component on the next cycle
+static void reset_events(nes_system* system)
 {
-    for (nes_system_layer* layer = system->config.layer; layer; layer = layer->next)
+    system->ppu_cycle = system->cycle;
+    system->apu_cycle = system->cycle;
+
+    for (int i = 0; i < EVENT_COUNT; ++i)
+        system->event_cycles[i] = system->cycle;
+
+    system->next_event_cycle = system->cycle;
+}
+
+// Dirty flag of the block holding memory, the spare flag when no region holds it
+static uint8_t* dirty_flag(nes_system* system, const uint8_t* memory)
+{
+    for (int i = 0; i < DIRTY_REGION_COUNT; ++i)
     {
-        if (layer->cpu_cycle_callback)
-            layer->cpu_cycle_callback(state, layer->client_data);
+        const dirty_region* region = &system->dirty_regions[i];
 
-        if (layer->cpu_callback && ((uint8_t)state->cycle) == 0)
-            layer->cpu_callback(state, layer->client_data);
+        if (memory >= region->memory && memory < region->memory + region->size)
+            return &system->dirty_blocks[region->first_block + (memory - region->memory) / _DIRTY_BLOCK_SIZE];
     }
+
+    return &system->dirty_blocks[_DIRTY_MAX_BLOCKS];
 }
 
-static void execute_ppu_callbacks(nes_system* system, nes_ppu* ppu)
+// Region holding a block and the block offset in it, the last block of a region may be short
+static const dirty_region* dirty_block_region(nes_system* system, size_t block, size_t* offset, size_t* size)
 {
-    for (nes_system_layer* layer = system->config.layer; layer; layer = layer->next)
+    for (int i = DIRTY_REGION_COUNT - 1; i >= 0; --i)
+    {
+        const dirty_region* region = &system->dirty_regions[i];
+
+        if (block >= region->first_block && region->size)
+        {
+            *offset = (block - region->first_block) * _DIRTY_BLOCK_SIZE;
+            *size = region->size - *offset < _DIRTY_BLOCK_SIZE ? region->size - *offset : _DIRTY_BLOCK_SIZE;
+            return region;
+        }
+    }
+
+    return 0;
+}
+
+// Mapper RAM sits at the end of the mapper state, CHR RAM right after it
+static uint8_t* cartridge_ram(nes_cartridge* cartridge)
+{
+    return cartridge->prg_ram ? cartridge->prg_ram : cartridge->chr_ram;
+}
+
+static void dirty_init_regions(nes_system* system)
+{
+    nes_cartridge* cartridge = system->cartridge;
+    uint8_t* cartridge_end = (uint8_t*)cartridge->state + cartridge->state_size;
+
+    dirty_region* regions = system->dirty_regions;
+    regions[DIRTY_REGION_RAM].memory = system->state.ram;
+    regions[DIRTY_REGION_RAM].size = sizeof(system->state.ram);
+    regions[DIRTY_REGION_VRAM].memory = system->state.vram;
+    regions[DIRTY_REGION_VRAM].size = sizeof(system->state.vram);
+    regions[DIRTY_REGION_CARTRIDGE].memory = cartridge_ram(cartridge);
+    regions[DIRTY_REGION_CARTRIDGE].size = cartridge_end - cartridge_ram(cartridge);
+
+    system->dirty_block_count = 0;
+
+    for (int i = 0; i < DIRTY_REGION_COUNT; ++i)
+    {
+        size_t blocks = (regions[i].size + _DIRTY_BLOCK_SIZE - 1) / _DIRTY_BLOCK_SIZE;
+
+        // Too much mapper RAM to track, the whole cartridge state goes into every delta
+        if (system->dirty_block_count + blocks > _DIRTY_MAX_BLOCKS)
+        {
+            regions[i].memory = cartridge_end;
+            regions[i].size = 0;
+            blocks = 0;
+        }
+
+        regions[i].first_block = system->dirty_block_count;
+        system->dirty_block_count += blocks;
+    }
+
+    memset(system->dirty_blocks, 1, sizeof(system->dirty_blocks));
+}
+
+// Power up, full state loads and writes no block can be told for
+static void dirty_mark_all(nes_system* system)
+{
+    memset(system->dirty_blocks, 1, system->dirty_block_count);
+}
+
+#if NES_SYSTEM_PROFILE
+static uint64_t profile_time_ns()
+{
+    struct timespec ts;
+#if _WIN32
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#define _NES_PROFILE_BEGIN(system)          if ((system)->profile) (system)->profile_time = profile_time_ns()
+#define _NES_PROFILE_SPLIT(system, field)   if ((system)->profile) { uint64_t t = profile_time_ns(); (system)->profile->field += t - (system)->profile_time; (system)->profile_time = t; }
+#define _NES_PROFILE_END(system, cycles)    if ((system)->profile) (system)->profile->cycles += (cycles)
+#else
+#define _NES_PROFILE_BEGIN(system)
+#define _NES_PROFILE_SPLIT(system, field)
+#define _NES_PROFILE_END(system, cycles)
+#endif
+
+static void execute_memory_callbacks(nes_system* system, nes_memory_type memory_type, nes_memory_op op, uint16_t address, uint8_t* data)
+{
+    if (!(system->layer_hooks & _LAYER_HOOK_BIT(LAYER_HOOK_MEMORY)))
+        return;
+
+    for (nes_system_layer** layer = system->layer_hook_lists[LAYER_HOOK_MEMORY]; *layer; ++layer)
+        (*layer)->memory_callback(memory_type, op, address, data, (*layer)->client_data);
+}
+
+static void execute_cpu_callbacks(nes_system* system, cpu_state* state)
+{
+    if (!(system->layer_hooks & _LAYER_HOOK_BIT(LAYER_HOOK_CPU)))
+        return;
+
+    for (nes_system_layer** layer = system->layer_hook_lists[LAYER_HOOK_CPU]; *layer; ++layer)
     {
-        if (layer->ppu_callback)
-            layer->ppu_callback(ppu, layer->client_data);
+        if ((*layer)->cpu_cycle_callback)
+            (*layer)->cpu_cycle_callback(state, (*layer)->client_data);
+
+        if ((*layer)->cpu_callback && ((uint8_t)state->cycle) == 0)
+            (*layer)->cpu_callback(state, (*layer)->client_data);
     }
 }
 
+static void execute_ppu_callbacks(nes_system* system, nes_ppu* ppu)
+{
+    if (!(system->layer_hooks & _LAYER_HOOK_BIT(LAYER_HOOK_PPU)))
+        return;
+
+    for (nes_system_layer** layer = system->layer_hook_lists[LAYER_HOOK_PPU]; *layer; ++layer)
+        (*layer)->ppu_callback(ppu, (*layer)->client_data);
+}
+
 static void execute_apu_callbacks(nes_system* system, nes_apu* apu)
 {
+    if (!(system->layer_hooks & _LAYER_HOOK_BIT(LAYER_HOOK_APU)))
+        return;
+
+    for (nes_system_layer** layer = system->layer_hook_lists[LAYER_HOOK_APU]; *layer; ++layer)
+        (*layer)->apu_callback(apu, (*layer)->client_data);
+}
+
+static int update_layer_hooks(nes_system* system)
+{
+    size_t layer_count = 0;
     for (nes_system_layer* layer = system->config.layer; layer; layer = layer->next)
+        ++layer_count;
+
+    // One block holds every list, each sized for the whole chain plus the terminator
+    nes_system_layer** lists = (nes_system_layer**)malloc(LAYER_HOOK_COUNT * (layer_count + 1) * sizeof(nes_system_layer*));
+    if (!lists)
+        return 0;
+
+    free(system->layer_hook_lists[0]);
+
+    system->layer_hooks = 0;
+
+    for (int hook = 0; hook < LAYER_HOOK_COUNT; ++hook)
     {
-        if (layer->apu_callback)
-            layer->apu_callback(apu, layer->client_data);
+        nes_system_layer** list = lists + hook * (layer_count + 1);
+        system->layer_hook_lists[hook] = list;
+
+        for (nes_system_layer* layer = system->config.layer; layer; layer = layer->next)
+        {
+            int has_hook =  (hook == LAYER_HOOK_MEMORY && layer->memory_callback) ||
+                            (hook == LAYER_HOOK_CPU && (layer->cpu_callback || layer->cpu_cycle_callback)) ||
+                            (hook == LAYER_HOOK_PPU && layer->ppu_callback) ||
+                            (hook == LAYER_HOOK_APU && layer->apu_callback);
+
+            if (has_hook)
+            {
+                *list++ = layer;
+                system->layer_hooks |= _LAYER_HOOK_BIT(hook);
+            }
+
+            if (hook == LAYER_HOOK_CPU && layer->cpu_cycle_callback)
+                system->layer_hooks |= _LAYER_CPU_CYCLE_BIT;
+        }
+
+        *list = 0;
     }
+
+    // PPU fetches must go through the mapper when anyone watches them
+    system->ppu_observed = system->cartridge->mapper->observes_ppu ||
+                           (system->layer_hooks & (_LAYER_HOOK_BIT(LAYER_HOOK_PPU) | _LAYER_HOOK_BIT(LAYER_HOOK_MEMORY)));
+
+    system->apu_observed = (system->layer_hooks & _LAYER_HOOK_BIT(LAYER_HOOK_APU)) != 0;
+
+    return 1;
 }
 
 /////////////////////////////////////////////////
@@ -107,6 +407,8 @@ static int oam_dma_execute(nes_system* system)
     {
         execute_memory_callbacks(system, NES_MEMORY_TYPE_OAM, NES_MEMORY_OP_WRITE, state->oam_dma_dst_address & 0xFF, &state->cpu.data);
 
+        nes_ppu_sync_sprite_evaluation(&state->ppu);
+
         state->ppu.primary_oam.bytes[(state->oam_dma_dst_address++) & 0xFF] = state->cpu.data;
     }
     else
@@ -154,7 +456,12 @@ static int dmc_dma_execute(nes_system* system)
 
     if (state->dmc_dma_src_address >= 0x6000)
     {
-        system->cartridge->mapper->read(system->cartridge, state->dmc_dma_src_address, &state->apu.dmc.sample_buffer);
+        const cpu_page* page = &system->cpu_pages[state->dmc_dma_src_address >> 8];
+
+        if (page->read)
+            state->apu.dmc.sample_buffer = page->read[state->dmc_dma_src_address & 0xFF];
+        else
+            system->cartridge->mapper->read(system->cartridge, state->dmc_dma_src_address, &state->apu.dmc.sample_buffer);
     }
     else
     {
@@ -193,6 +500,27 @@ static int dmc_dma_execute(nes_system* system)
     return 0;
 }
 
+// Mappers write pattern memory to chr_ram unbanked and $2000-$2FFF where nametable_banks point, the mirrors above are left to them
+static void ppu_mark_write(nes_system* system, uint16_t address)
+{
+    nes_cartridge* cartridge = system->cartridge;
+    uint8_t* page = system->ppu_pages[address >> 10];
+
+    if (address < 0x2000)
+    {
+        if (address < cartridge->chr_ram_size)
+            *dirty_flag(system, cartridge->chr_ram + address) = 1;
+    }
+    else if (address < 0x3000 && page)
+    {
+        *dirty_flag(system, page + (address & 0x3FF)) = 1;
+    }
+    else
+    {
+        dirty_mark_all(system);
+    }
+}
+
 static void ppu_mem_rw(nes_system* system)
 {
     nes_system_state* state = &system->state;
@@ -202,7 +530,20 @@ static void ppu_mem_rw(nes_system* system)
 
     if (state->ppu.r)
     {
-        mapper->ppu_read(system->cartridge, state->vram, address, &state->ppu.vram_data);
+        // Pattern and nametable fetches read the mapped page directly, the mapper only sees them if it asks to
+        uint8_t* page = system->ppu_pages[address >> 10];
+
+        if (page)
+        {
+            if (mapper->ppu_fetch)
+                mapper->ppu_fetch(system->cartridge, address);
+
+            state->ppu.vram_data = page[address & 0x3FF];
+        }
+        else
+        {
+            mapper->ppu_read(system->cartridge, state->vram, address, &state->ppu.vram_data);
+        }
 
         execute_memory_callbacks(system, NES_MEMORY_TYPE_PPU, NES_MEMORY_OP_READ, state->ppu.vram_address, &state->ppu.vram_data);
     }
@@ -211,6 +552,22 @@ static void ppu_mem_rw(nes_system* system)
         execute_memory_callbacks(system, NES_MEMORY_TYPE_PPU, NES_MEMORY_OP_WRITE, state->ppu.vram_address, &state->ppu.vram_data);
 
         mapper->ppu_write(system->cartridge, state->vram, address, state->ppu.vram_data);
+        ppu_mark_write(system, address);
+    }
+}
+
+static void ppu_map_pages(nes_system* system)
+{
+    nes_cartridge* cartridge = system->cartridge;
+
+    for (int i = 0; i < 8; ++i)
+        system->ppu_pages[i] = cartridge->chr_banks[i];
+
+    // $3000-$3FFF mirrors and the palettes are left to the mapper
+    for (int i = 0; i < 4; ++i)
+    {
+        system->ppu_pages[8 + i] = cartridge->nametable_banks[i];
+        system->ppu_pages[12 + i] = 0;
     }
 }
 
@@ -233,7 +590,7 @@ static void ppu_cpu_bus(nes_system* system)
     }
 }
 
-static void ppu_tick(nes_system* system)
+static inline void ppu_dot(nes_system* system, uint32_t layer_hooks)
 {
     nes_system_state* state = &system->state;
 
@@ -242,7 +599,8 @@ static void ppu_tick(nes_system* system)
     if (state->ppu.r | state->ppu.w)
         ppu_mem_rw(system);
 
-    execute_ppu_callbacks(system, &state->ppu);
+    if (layer_hooks & _LAYER_HOOK_BIT(LAYER_HOOK_PPU))
+        execute_ppu_callbacks(system, &state->ppu);
 
     nes_ppu_execute(&state->ppu);
 
@@ -263,22 +621,162 @@ static void ppu_tick(nes_system* system)
     }
 }
 
-static void cpu_mem_rw(nes_system* system)
+static void ppu_tick(nes_system* system)
+{
+    ppu_dot(system, system->layer_hooks);
+}
+
+static void ppu_sync(nes_system* system)
+{
+    // Dots are only deferred while no layer watches the PPU
+    for (; system->ppu_cycle < system->cycle; ++system->ppu_cycle)
+    {
+        ppu_dot(system, 0);
+        ppu_dot(system, 0);
+        ppu_dot(system, 0);
+    }
+}
+
+static int ppu_lazy_dots(nes_system* system)
 {
     nes_system_state* state = &system->state;
 
-    int is_ram      = state->cpu.address <  0x2000;
-    int is_mapper   = state->cpu.address >= 0x6000;
+    // Anything observing the PPU cycle by cycle keeps it in lockstep with the CPU
+    if (system->ppu_observed || state->oam_dma || state->ppu.reg_rw_mode != NES_PPU_REG_RW_MODE_NONE)
+        return 0;
 
-    if (!(is_ram || is_mapper))
-        return;
+    // Run the video callback and the vblank NMI edge (241,0 to 241,2) in lockstep
+    int vblank_dot  = VBLANK_BEGIN_SCANLINE * SCANLINE_WIDTH;
+    int dot         = state->ppu.scanline * SCANLINE_WIDTH + state->ppu.dot;
 
-    if (state->cpu.rw_mode == CPU_RW_MODE_READ)
+    if (dot < vblank_dot)
+        return vblank_dot - dot - 1;
+
+    if (dot < vblank_dot + 2)
+        return 0;
+
+    // Odd frames may skip a dot on the pre-render scanline
+    int frame_dot = SCANLINE_WIDTH * TOTAL_SCANLINES;
+
+    if (system->run_flags & NES_RUN_FRAME)
+        return frame_dot - dot > 2 ? frame_dot - dot - 2 : 0;
+
+    return vblank_dot + frame_dot - dot - 2;
+}
+
+static void apu_audio_output(nes_system* system)
+{
+    nes_audio_output audio;
+
+    if (system->config.audio_sample_rate)
+    {
+        nes_blip_end_frame(&system->audio_blip, system->audio_clock);
+        system->audio_clock = 0;
+
+        audio.samples = system->audio_samples;
+        audio.sample_count = nes_blip_read_samples(&system->audio_blip, system->audio_samples, NES_BLIP_MAX_SAMPLES);
+        audio.sample_rate = system->config.audio_sample_rate;
+    }
+    else
+    {
+        audio.samples = system->state.apu.samples;
+        audio.sample_count = system->state.apu.sample_count;
+        audio.sample_rate = 1789773;
+    }
+
+    if (system->config.audio_callback)
+        system->config.audio_callback(&audio, system->config.client_data);
+}
+
+static void apu_sync(nes_system* system)
+{
+    nes_apu* apu = &system->state.apu;
+
+    while (system->apu_cycle < system->cycle)
     {
-        if (is_ram)
-            state->cpu.data = state->ram[state->cpu.address & 0x7FF];
+        // Both audio modes hand out a buffer every NES_APU_MAX_SAMPLES cycles
+        uint32_t buffer_cycles = system->config.audio_sample_rate ? system->audio_clock : apu->sample_count % NES_APU_MAX_SAMPLES;
+        uint32_t max_cycles = NES_APU_MAX_SAMPLES - buffer_cycles;
+
+        if (max_cycles > system->cycle - system->apu_cycle)
+            max_cycles = (uint32_t)(system->cycle - system->apu_cycle);
+
+        uint32_t cycles = nes_apu_advance(apu, max_cycles);
+        system->apu_cycle += cycles;
+
+        if (system->audio_muted)
+            continue;
+
+        // Only mix when a channel output changes, that only happens on the last cycle
+        uint32_t output_state = nes_apu_output_state(apu);
+        if (output_state != system->audio_output_state)
+        {
+            int16_t amplitude = nes_apu_mix(apu);
+
+            if (system->config.audio_sample_rate)
+                nes_blip_add_delta(&system->audio_blip, system->audio_clock + cycles - 1, amplitude - system->audio_amplitude);
+
+            system->audio_output_state = output_state;
+            system->audio_amplitude = amplitude;
+        }
+
+        if (system->config.audio_sample_rate)
+        {
+            system->audio_clock += cycles;
+        }
         else
-            system->cartridge->mapper->read(system->cartridge, state->cpu.address, &state->cpu.data);
+        {
+            for (uint32_t i = 0; i < cycles; ++i)
+                apu->samples[buffer_cycles + i] = system->audio_amplitude;
+
+            apu->sample_count = buffer_cycles + cycles;
+        }
+
+        if (buffer_cycles + cycles == NES_APU_MAX_SAMPLES)
+            apu_audio_output(system);
+    }
+}
+
+static void cpu_map_prg_pages(nes_system* system)
+{
+    nes_cartridge* cartridge = system->cartridge;
+
+    memcpy(system->cpu_prg_banks, cartridge->prg_banks, sizeof(system->cpu_prg_banks));
+    system->cpu_prg_ram_read = cartridge->prg_ram_read;
+    system->cpu_prg_ram_write = cartridge->prg_ram_write;
+
+    // PRG RAM goes straight to memory while the mapper exports it, otherwise through the handler
+    for (int page = 0x60; page < 0x80; ++page)
+    {
+        system->cpu_pages[page].read = cartridge->prg_ram_read ? cartridge->prg_ram_read + ((page & 0x1F) << 8) : 0;
+        system->cpu_pages[page].write = cartridge->prg_ram_write ? cartridge->prg_ram_write + ((page & 0x1F) << 8) : 0;
+        system->cpu_pages[page].dirty = dirty_flag(system, system->cpu_pages[page].write);
+    }
+
+    // Mapper registers are written through the handler, PRG ROM reads go straight to the mapped bank
+    for (int page = 0x80; page < 0x100; ++page)
+    {
+        uint8_t* bank = cartridge->prg_banks[(page >> 5) & 3];
+        system->cpu_pages[page].read = bank ? bank + ((page & 0x1F) << 8) : 0;
+    }
+}
+
+static int cpu_prg_pages_stale(nes_system* system)
+{
+    nes_cartridge* cartridge = system->cartridge;
+
+    return memcmp(system->cpu_prg_banks, cartridge->prg_banks, sizeof(system->cpu_prg_banks)) != 0 ||
+           system->cpu_prg_ram_read != cartridge->prg_ram_read ||
+           system->cpu_prg_ram_write != cartridge->prg_ram_write;
+}
+
+static void cpu_cartridge_bus(nes_system* system)
+{
+    nes_system_state* state = &system->state;
+
+    if (state->cpu.rw_mode == CPU_RW_MODE_READ)
+    {
+        system->cartridge->mapper->read(system->cartridge, state->cpu.address, &state->cpu.data);
 
         nes_memory_op read_op = (state->oam_dma || state->dmc_dma) ? NES_MEMORY_OP_READ_DMA : NES_MEMORY_OP_READ;
         execute_memory_callbacks(system, NES_MEMORY_TYPE_CPU, read_op, state->cpu.address, &state->cpu.data);
@@ -287,23 +785,37 @@ static void cpu_mem_rw(nes_system* system)
     {
         execute_memory_callbacks(system, NES_MEMORY_TYPE_CPU, NES_MEMORY_OP_WRITE, state->cpu.address, &state->cpu.data);
 
-        if (is_ram)
-            state->ram[state->cpu.address & 0x7FF] = state->cpu.data;
-        else
-            system->cartridge->mapper->write(system->cartridge, state->cpu.address, state->cpu.data);
+        // Mapper registers may switch CHR banks or mirroring under the PPU, some mappers decode them below $8000
+        ppu_sync(system);
+
+        nes_cartridge* cartridge = system->cartridge;
+        cartridge->mapper->write(cartridge, state->cpu.address, state->cpu.data);
+        schedule_event(system, EVENT_MAPPER, system->cycle);
+
+        // PRG RAM the mapper decodes itself, mirrored over $6000-$7FFF
+        if (cartridge->prg_ram && state->cpu.address >= 0x6000 && state->cpu.address < 0x8000)
+            *dirty_flag(system, cartridge->prg_ram + ((state->cpu.address - 0x6000) & (cartridge->prg_ram_size - 1))) = 1;
+
+        if (cpu_prg_pages_stale(system))
+            cpu_map_prg_pages(system);
+
+        ppu_map_pages(system);
     }
 }
 
 static void cpu_ppu_bus(nes_system* system)
 {
     nes_system_state* state = &system->state;
-    int is_ppu_reg = state->cpu.address >= 0x2000 && state->cpu.address <= 0x3FFF;
-
-    if (!is_ppu_reg)
-        return;
 
     uint8_t reg_addr = state->cpu.address & 7;
 
+    if (state->cpu.rw_mode != CPU_RW_MODE_NONE)
+    {
+        ppu_sync(system);
+        schedule_event(system, EVENT_PPU, system->cycle);
+        nes_ppu_sync_sprite_evaluation(&state->ppu);
+    }
+
     if (state->cpu.rw_mode == CPU_RW_MODE_READ)
     {
         state->ppu.reg_rw_mode = NES_PPU_REG_RW_MODE_READ;
@@ -329,6 +841,9 @@ static void cpu_apu_bus(nes_system* system)
 
     if (state->cpu.rw_mode == CPU_RW_MODE_READ && state->cpu.address == 0x4015)
     {
+        apu_sync(system);
+        schedule_event(system, EVENT_APU, system->cycle);
+
         state->apu.reg_rw_mode = NES_APU_REG_RW_MODE_READ;
         state->apu.reg_addr = 0x4015;
     }
@@ -342,6 +857,9 @@ static void cpu_apu_bus(nes_system* system)
 
         execute_memory_callbacks(system, NES_MEMORY_TYPE_CPU, NES_MEMORY_OP_WRITE, state->cpu.address, &state->cpu.data);
 
+        apu_sync(system);
+        schedule_event(system, EVENT_APU, system->cycle);
+
         state->apu.reg_rw_mode = NES_APU_REG_RW_MODE_WRITE;
         state->apu.reg_addr = state->cpu.address;
         state->apu.reg_data = state->cpu.data;
@@ -355,6 +873,9 @@ static void cpu_joy_bus(nes_system* system)
 
     if (state->cpu.rw_mode == CPU_RW_MODE_READ)
     {
+        if (state->cpu.address == 0x4016 || state->cpu.address == 0x4017)
+            system->run_stops |= system->run_flags & NES_RUN_INPUT;
+
         if (state->cpu.address == 0x4016)
         {
             uint8_t input = (state->controller_input0 >> 7) & 1;
@@ -403,30 +924,81 @@ static void cpu_oam_dma_bus(nes_system* system)
         execute_memory_callbacks(system, NES_MEMORY_TYPE_CPU, NES_MEMORY_OP_WRITE, state->cpu.address, &state->cpu.data);
 
         state->cached_apuio_reg[state->cpu.address & 0x1F] = state->cpu.data;
+
+        ppu_sync(system);
+        schedule_event(system, EVENT_PPU, system->cycle);
+        nes_ppu_sync_sprite_evaluation(&state->ppu);
+
         oam_dma_init(system, state->cpu.data, state->ppu.oam_address);
     }
 }
 
-static void cpu_tick(nes_system* system)
+static void cpu_io_bus(nes_system* system)
 {
-    nes_system_state* state = &system->state;
+    cpu_apu_bus(system);
+    cpu_joy_bus(system);
+    cpu_oam_dma_bus(system);
+}
 
-    state->cpu.address = state->cpu_next_address; // DMA may have hijacked the address, restore it
-    if (!state->cpu.halted)
-        execute_cpu_callbacks(system, &state->cpu);
+static void cpu_open_bus(nes_system* system)
+{
+}
+
+static void cpu_map_pages(nes_system* system)
+{
+    for (int page = 0; page < 0x100; ++page)
+    {
+        cpu_page* entry = &system->cpu_pages[page];
+
+        entry->read = 0;
+        entry->write = 0;
+        entry->dirty = &system->dirty_blocks[_DIRTY_MAX_BLOCKS];
+
+        if (page < 0x20)
+        {
+            entry->read = entry->write = system->state.ram + ((page & 7) << 8);
+            entry->dirty = dirty_flag(system, entry->write);
+            entry->handler = &cpu_open_bus;
+        }
+        else if (page < 0x40)   entry->handler = &cpu_ppu_bus;
+        else if (page == 0x40)  entry->handler = &cpu_io_bus;
+        else if (page < 0x60)   entry->handler = &cpu_open_bus;
+        else                    entry->handler = &cpu_cartridge_bus;
+    }
+
+    cpu_map_prg_pages(system);
+}
+
+static void cpu_bus_tick(nes_system* system)
+{
+    nes_system_state* state = &system->state;
 
-    state->cpu = cpu_execute(state->cpu);
     state->cpu_next_address = state->cpu.address;
 
     state->cpu.rdy = !(state->dmc_dma || state->oam_dma);
 
     if (state->cpu.rdy || !state->cpu.halted || (state->dmc_dma ? dmc_dma_execute(system) : oam_dma_execute(system)))
     {
-        cpu_mem_rw(system);
-        cpu_ppu_bus(system);
-        cpu_apu_bus(system);
-        cpu_joy_bus(system);
-        cpu_oam_dma_bus(system);
+        const cpu_page* page = &system->cpu_pages[state->cpu.address >> 8];
+
+        if (state->cpu.rw_mode == CPU_RW_MODE_READ && page->read)
+        {
+            state->cpu.data = page->read[state->cpu.address & 0xFF];
+
+            nes_memory_op read_op = (state->oam_dma || state->dmc_dma) ? NES_MEMORY_OP_READ_DMA : NES_MEMORY_OP_READ;
+            execute_memory_callbacks(system, NES_MEMORY_TYPE_CPU, read_op, state->cpu.address, &state->cpu.data);
+        }
+        else if (state->cpu.rw_mode == CPU_RW_MODE_WRITE && page->write)
+        {
+            execute_memory_callbacks(system, NES_MEMORY_TYPE_CPU, NES_MEMORY_OP_WRITE, state->cpu.address, &state->cpu.data);
+
+            page->write[state->cpu.address & 0xFF] = state->cpu.data;
+            *page->dirty = 1;
+        }
+        else if (state->cpu.rw_mode != CPU_RW_MODE_NONE)
+        {
+            page->handler(system);
+        }
     }
 
     state->controller_read_timer0 >>= 1;
@@ -434,7 +1006,26 @@ static void cpu_tick(nes_system* system)
     state->cpu_odd_cycle ^= 1; 
 }
 
-static void apu_cpu_bus(nes_system* system)
+static void cpu_begin_tick(nes_system* system)
+{
+    nes_system_state* state = &system->state;
+
+    state->cpu.address = state->cpu_next_address; // DMA may have hijacked the address, restore it
+    if (!state->cpu.halted)
+        execute_cpu_callbacks(system, &state->cpu);
+}
+
+static void cpu_tick(nes_system* system)
+{
+    nes_system_state* state = &system->state;
+
+    cpu_begin_tick(system);
+
+    cpu_execute_uop(&state->cpu);
+    cpu_bus_tick(system);
+}
+
+static void apu_cpu_bus(nes_system* system)
 {
     nes_system_state* state = &system->state;
 
@@ -448,13 +1039,25 @@ static void apu_cpu_bus(nes_system* system)
     }
 }
 
+static uint32_t apu_lazy_cycles(nes_system* system)
+{
+    nes_system_state* state = &system->state;
+
+    if (system->apu_observed || state->dmc_dma)
+        return 0;
+
+    return nes_apu_quiet_cycles(&state->apu);
+}
+
 static void apu_tick(nes_system* system)
 {
     nes_system_state* state = &system->state;
 
+    int interrupt = state->apu.frame_interrupt | state->apu.dmc.interrupt;
+
     execute_apu_callbacks(system, &state->apu);
 
-    nes_apu_execute(&state->apu);
+    apu_sync(system);
 
     apu_cpu_bus(system);
 
@@ -464,15 +1067,508 @@ static void apu_tick(nes_system* system)
     if (state->dmc_dma && state->apu.dmc.bytes_remaining == 0)
         state->dmc_dma = 0;
 
-    if (system->config.audio_callback && state->apu.sample_count == NES_APU_MAX_SAMPLES)
+    system->event_cycles[EVENT_APU] = system->cycle + apu_lazy_cycles(system);
+
+    if (interrupt != (state->apu.frame_interrupt | state->apu.dmc.interrupt))
+        system->event_cycles[EVENT_IRQ] = system->cycle;
+}
+
+static void peripherals_tick(nes_system* system)
+{
+    nes_system_state* state = &system->state;
+    uint64_t cycle = system->cycle;
+
+    // Nothing can observe the PPU or APU and the interrupt lines hold still until the next event
+    if (cycle < system->next_event_cycle)
     {
-        nes_audio_output audio;
-        audio.samples = state->apu.samples;
-        audio.sample_count = state->apu.sample_count;
-        audio.sample_rate = 1789773;
+        system->cycle = cycle + 1;
+        return;
+    }
 
-        system->config.audio_callback(&audio, system->config.client_data);
+    if (cycle >= system->event_cycles[EVENT_PPU])
+    {
+        ppu_sync(system);
+
+        int had_vbl = state->ppu.vbl;
+        int had_vblank = state->ppu.status.vblank_started;
+        int frame_dot = state->ppu.scanline * SCANLINE_WIDTH + state->ppu.dot;
+
+        ppu_tick(system);
+        ppu_tick(system);
+        ppu_tick(system);
+
+        system->ppu_cycle = cycle + 1;
+
+        if (!had_vbl && state->ppu.vbl)
+            state->cpu.nmi = 1;
+
+        if (system->run_flags)
+        {
+            if (!had_vblank && state->ppu.status.vblank_started)
+                system->run_stops |= system->run_flags & NES_RUN_VBLANK;
+
+            if (state->ppu.scanline * SCANLINE_WIDTH + state->ppu.dot < frame_dot)
+                system->run_stops |= system->run_flags & NES_RUN_FRAME;
+        }
+
+        // Deferred dots are caught up in one go at the next event or sync point
+        system->event_cycles[EVENT_PPU] = cycle + 1 + ppu_lazy_dots(system) / 3;
     }
+
+    _NES_PROFILE_SPLIT(system, ppu_ns);
+
+    state->cpu.irq = state->apu.frame_interrupt | state->apu.dmc.interrupt;
+    system->event_cycles[EVENT_IRQ] = _EVENT_NEVER;
+
+    if (cycle >= system->event_cycles[EVENT_MAPPER])
+    {
+        if (!system->cartridge->mapper->tick(system->cartridge, &state->cpu, &state->ppu))
+            system->event_cycles[EVENT_MAPPER] = _EVENT_NEVER;
+        else
+            system->event_cycles[EVENT_MAPPER] = cycle + 1;
+    }
+
+    _NES_PROFILE_SPLIT(system, mapper_ns);
+
+    system->cycle = cycle + 1;
+
+    // Only the channel timers move until the next interrupt or DMC fetch, catch up in bulk later
+    if (cycle >= system->event_cycles[EVENT_APU])
+        apu_tick(system);
+
+    update_next_event(system);
+
+    _NES_PROFILE_SPLIT(system, apu_ns);
+}
+
+static int cpu_instruction_read(void* context, uint16_t address, uint8_t* data)
+{
+    nes_system* system = (nes_system*)context;
+    const cpu_page* page = &system->cpu_pages[address >> 8];
+
+    if (page->read)
+        *data = page->read[address & 0xFF];
+    else if (address >= 0x6000)
+        system->cartridge->mapper->read(system->cartridge, address, data);
+    else
+        return 0;
+
+    return 1;
+}
+
+static int cpu_instruction_write(void* context, uint16_t address, uint8_t data)
+{
+    nes_system* system = (nes_system*)context;
+
+    const cpu_page* page = &system->cpu_pages[address >> 8];
+
+    // Mapper registers may depend on the exact cycle of the write (MMC1 consecutive writes, MMC3 IRQ counter)
+    if (!page->write)
+        return 0;
+
+    page->write[address & 0xFF] = data;
+    *page->dirty = 1;
+    return 1;
+}
+
+static int cpu_can_execute_instruction(nes_system* system)
+{
+    nes_system_state* state = &system->state;
+    nes_apu_dmc* dmc = &state->apu.dmc;
+
+    if (_CPU_GET_CYCLE(state->cpu) != 0 || state->cpu.halted || !state->cpu.rdy || state->oam_dma || state->dmc_dma)
+        return 0;
+
+    // Operand bytes must be readable, see cpu_execute_instruction
+    if (state->cpu.PC >= 0x1FFE && state->cpu.PC < 0x6000)
+        return 0;
+
+    // DMC must not start a DMA within the instruction
+    if ((dmc->bytes_remaining || dmc->sample_buffer_load_request) && system->event_cycles[EVENT_APU] - system->cycle < _CPU_MAX_INSTRUCTION_CYCLES)
+    {
+        apu_sync(system);
+
+        if (!(dmc->sample_buffer_loaded && (dmc->t >= 4 || (dmc->bits_remaining >= 2 && dmc->timer >= 4))))
+            return 0;
+    }
+
+    return !(system->layer_hooks & (_LAYER_HOOK_BIT(LAYER_HOOK_MEMORY) | _LAYER_CPU_CYCLE_BIT));
+}
+
+// Runs the rest of the system through an instruction cpu_execute_instruction already ran, then its final cycle
+static void cpu_complete_instruction(nes_system* system, cpu_state cpu, int cycles)
+{
+    nes_system_state* state = &system->state;
+
+    // Catch up the rest of the system, the instruction only depends on the interrupt lines
+    uint8_t irq_lines = state->cpu.irq;
+    uint8_t nmi_lines = state->cpu.nmi;
+
+    state->cpu.rw_mode = CPU_RW_MODE_NONE;
+
+    for (int cycle = 1; cycle < cycles; ++cycle)
+    {
+        _CPU_SET_CYCLE(state->cpu, cycle);
+        peripherals_tick(system);
+
+        irq_lines |= state->cpu.irq << cycle;
+        nmi_lines |= state->cpu.nmi << cycle;
+    }
+
+    cpu.irq = state->cpu.irq;
+    cpu.nmi = state->cpu.nmi;
+    state->cpu = cpu_end_instruction(cpu, state->cpu.P, irq_lines, nmi_lines);
+
+    state->controller_read_timer0 >>= cycles - 1;
+    state->cpu_odd_cycle ^= (cycles - 1) & 1;
+
+    cpu_bus_tick(system);
+}
+
+// Rest of cpu_instruction_tick after cpu_begin_tick, a whole instruction when can_execute allows it, otherwise one cycle
+static int cpu_instruction_run(nes_system* system, int can_execute)
+{
+    nes_system_state* state = &system->state;
+
+    cpu_state cpu = state->cpu;
+    cpu_bus bus = { system, &cpu_instruction_read, &cpu_instruction_write };
+
+    int cycles = can_execute ? cpu_execute_instruction(&cpu, &bus) : 0;
+    if (!cycles)
+    {
+        cpu_execute_uop(&state->cpu);
+        cpu_bus_tick(system);
+        return 1;
+    }
+
+    _NES_PROFILE_SPLIT(system, cpu_ns);
+
+    cpu_complete_instruction(system, cpu, cycles);
+
+    return cycles;
+}
+
+static int cpu_instruction_tick(nes_system* system)
+{
+    cpu_begin_tick(system);
+
+    return cpu_instruction_run(system, cpu_can_execute_instruction(system));
+}
+
+static int nes_system_step(nes_system* system, int max_cycles)
+{
+    int cycles = 1;
+
+    _NES_PROFILE_BEGIN(system);
+
+    peripherals_tick(system);
+
+    if (max_cycles >= _CPU_MAX_INSTRUCTION_CYCLES)
+        cycles = cpu_instruction_tick(system);
+    else
+        cpu_tick(system);
+
+    _NES_PROFILE_SPLIT(system, cpu_ns);
+    _NES_PROFILE_END(system, cycles);
+
+    return cycles;
+}
+
+static int run_breakpoint_hit(const nes_run_conditions* conditions, uint16_t pc)
+{
+    for (size_t i = 0; i < conditions->breakpoint_count; ++i)
+    {
+        if (conditions->breakpoints[i] == pc)
+            return 1;
+    }
+
+    return 0;
+}
+
+// Inlined per flag combination so the checks a run does not ask for drop out of the loop
+static inline uint32_t run_until(nes_system* system, const nes_run_conditions* conditions, uint32_t flags)
+{
+    nes_system_state* state = &system->state;
+
+    uint64_t end_cycle = (flags & NES_RUN_CYCLES) ? system->cycle + conditions->cycles : _EVENT_NEVER;
+    uint32_t stops = (flags & NES_RUN_CYCLES) && !conditions->cycles ? NES_RUN_CYCLES : 0;
+    int      left_breakpoint = 0; // the instruction the run starts at does not count as a hit
+
+    system->run_flags = flags & (NES_RUN_VBLANK | NES_RUN_FRAME | NES_RUN_INPUT);
+    system->run_stops = 0;
+
+    // The PPU has to be in lockstep when the frame wraps
+    if (flags & NES_RUN_FRAME)
+        schedule_event(system, EVENT_PPU, system->cycle);
+
+    while (!stops)
+    {
+        uint64_t budget = end_cycle - system->cycle;
+        int cycles = nes_system_step(system, budget < _CPU_MAX_INSTRUCTION_CYCLES ? (int)budget : _CPU_MAX_INSTRUCTION_CYCLES);
+
+        stops = system->run_stops;
+
+        if ((flags & NES_RUN_CYCLES) && system->cycle >= end_cycle)
+            stops |= NES_RUN_CYCLES;
+
+        if (flags & NES_RUN_BREAKPOINT)
+        {
+            left_breakpoint |= cycles > 1 || _CPU_GET_CYCLE(state->cpu) != 0;
+
+            if (left_breakpoint && _CPU_GET_CYCLE(state->cpu) == 0 && run_breakpoint_hit(conditions, state->cpu.PC))
+                stops |= NES_RUN_BREAKPOINT;
+        }
+    }
+
+    system->run_flags = 0;
+
+    ppu_sync(system);
+    apu_sync(system);
+
+    return stops;
+}
+
+static void serialize_cpu(cpu_state* cpu, nes_serializer* s)
+{
+    nes_serialize_u16(s, &cpu->cycle);
+    nes_serialize_u16(s, &cpu->PC);
+    nes_serialize_u8(s, &cpu->S);
+    nes_serialize_u8(s, &cpu->P);
+    nes_serialize_u16(s, &cpu->address);
+    nes_serialize_u8(s, &cpu->rw_mode);
+    _NES_SERIALIZE_AS(s, 8, cpu->rdy);
+    _NES_SERIALIZE_AS(s, 8, cpu->halted);
+    _NES_SERIALIZE_AS(s, 8, cpu->irq);
+    _NES_SERIALIZE_AS(s, 8, cpu->nmi);
+    _NES_SERIALIZE_AS(s, 8, cpu->irq_phase0);
+    _NES_SERIALIZE_AS(s, 8, cpu->nmi_phase0);
+    nes_serialize_u8(s, &cpu->data);
+    nes_serialize_u8(s, &cpu->temp);
+    nes_serialize_u8(s, &cpu->A);
+    nes_serialize_u8(s, &cpu->X);
+    nes_serialize_u8(s, &cpu->Y);
+}
+
+static void serialize_system(nes_system_state* state, nes_serializer* s)
+{
+    _NES_SERIALIZE_AS(s, 8, state->cpu_odd_cycle);
+    nes_serialize_u16(s, &state->cpu_next_address);
+    _NES_SERIALIZE_AS(s, 8, state->oam_dma);
+    _NES_SERIALIZE_AS(s, 16, state->oam_dma_cycle);
+    nes_serialize_u16(s, &state->oam_dma_src_address);
+    nes_serialize_u8(s, &state->oam_dma_dst_address);
+    _NES_SERIALIZE_AS(s, 8, state->dmc_dma);
+    nes_serialize_u8(s, &state->dmc_dma_dummy);
+    nes_serialize_u16(s, &state->dmc_dma_src_address);
+    nes_serialize_u8(s, &state->controller_input0);
+    nes_serialize_u8(s, &state->controller_input1);
+    nes_serialize_u8(s, &state->controller_read_timer0);
+    nes_serialize_bytes(s, state->cached_ppu_reg, sizeof(state->cached_ppu_reg));
+    nes_serialize_bytes(s, state->cached_apuio_reg, sizeof(state->cached_apuio_reg));
+}
+
+static void state_serialize_chunk(nes_system* system, int chunk, nes_serializer* s)
+{
+    nes_system_state* state = &system->state;
+    nes_cartridge* cartridge = system->cartridge;
+    uint8_t* cartridge_end = (uint8_t*)cartridge->state + cartridge->state_size;
+
+    switch (chunk)
+    {
+        case STATE_CHUNK_CPU:           serialize_cpu(&state->cpu, s); break;
+        case STATE_CHUNK_PPU:           nes_ppu_serialize(&state->ppu, s); break;
+        case STATE_CHUNK_APU:           nes_apu_serialize(&state->apu, s); break;
+        case STATE_CHUNK_SYSTEM:        serialize_system(state, s); break;
+        case STATE_CHUNK_RAM:           nes_serialize_bytes(s, state->ram, sizeof(state->ram)); break;
+        case STATE_CHUNK_VRAM:          nes_serialize_bytes(s, state->vram, sizeof(state->vram)); break;
+        case STATE_CHUNK_MAPPER:        cartridge->mapper->serialize(cartridge, s); break;
+        case STATE_CHUNK_CARTRIDGE_RAM: nes_serialize_bytes(s, cartridge_ram(cartridge), cartridge_end - cartridge_ram(cartridge)); break;
+    }
+}
+
+// The layout only depends on the cartridge, measure it once and tell the dirty regions where their chunks are
+static void state_init_layout(nes_system* system)
+{
+    size_t chunk_offsets[STATE_CHUNK_COUNT];
+    size_t offset = _STATE_HEADER_SIZE;
+
+    for (int i = 0; i < STATE_CHUNK_COUNT; ++i)
+    {
+        nes_serializer counter = nes_serializer_create(0, 0, 0);
+        state_serialize_chunk(system, i, &counter);
+
+        chunk_offsets[i] = offset + _STATE_CHUNK_HEADER_SIZE;
+        system->state_chunk_sizes[i] = counter.offset;
+        offset = chunk_offsets[i] + counter.offset;
+    }
+
+    system->state_size = offset;
+
+    dirty_region* regions = system->dirty_regions;
+    regions[DIRTY_REGION_RAM].state_offset = chunk_offsets[STATE_CHUNK_RAM];
+    regions[DIRTY_REGION_VRAM].state_offset = chunk_offsets[STATE_CHUNK_VRAM];
+    regions[DIRTY_REGION_CARTRIDGE].state_offset = chunk_offsets[STATE_CHUNK_CARTRIDGE_RAM] + (regions[DIRTY_REGION_CARTRIDGE].memory - cartridge_ram(system->cartridge));
+}
+
+static void state_save(nes_system* system, nes_serializer* s)
+{
+    uint32_t magic = _STATE_MAGIC;
+    uint32_t version = _STATE_VERSION;
+
+    nes_serialize_u32(s, &magic);
+    nes_serialize_u32(s, &version);
+
+    for (int i = 0; i < STATE_CHUNK_COUNT; ++i)
+    {
+        size_t payload_offset = nes_serializer_begin_chunk(s, state_chunk_tags[i]);
+        state_serialize_chunk(system, i, s);
+        nes_serializer_end_chunk(s, payload_offset);
+    }
+}
+
+// Unknown chunks are skipped, the whole buffer is checked before the system is touched
+static int state_load(nes_system* system, const void* buffer, size_t buffer_size)
+{
+    nes_serializer s = nes_serializer_create((void*)buffer, buffer_size, 1);
+    nes_serializer payloads[STATE_CHUNK_COUNT];
+    nes_serializer payload;
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t tag = 0;
+    uint32_t found = 0;
+
+    nes_serialize_u32(&s, &magic);
+    nes_serialize_u32(&s, &version);
+
+    if (s.failed || magic != _STATE_MAGIC || version == 0 || version > _STATE_VERSION)
+        return 0;
+
+    while (nes_serializer_next_chunk(&s, &tag, &payload))
+    {
+        for (int i = 0; i < STATE_CHUNK_COUNT; ++i)
+        {
+            if (tag != state_chunk_tags[i])
+                continue;
+
+            // A size that does not match is another cartridge or a corrupt buffer
+            if (payload.size != system->state_chunk_sizes[i])
+                return 0;
+
+            payloads[i] = payload;
+            found |= 1u << i;
+        }
+    }
+
+    if (s.failed || found != (1u << STATE_CHUNK_COUNT) - 1)
+        return 0;
+
+    for (int i = 0; i < STATE_CHUNK_COUNT; ++i)
+        state_serialize_chunk(system, i, &payloads[i]);
+
+    return 1;
+}
+
+static uint8_t* delta_copy(uint8_t* delta, void* memory, size_t size, int save)
+{
+    if (save)
+        memcpy(delta, memory, size);
+    else
+        memcpy(memory, delta, size);
+
+    return delta + size;
+}
+
+// The fixed part skips RAM and VRAM in one go and reads the sample count before the samples it counts
+_STATIC_ASSERT(offsetof(nes_system_state, vram) == offsetof(nes_system_state, ram) + sizeof(((nes_system_state*)0)->ram), ram_before_vram);
+_STATIC_ASSERT(offsetof(nes_system_state, apu.sample_count) > offsetof(nes_system_state, apu.samples) &&
+               offsetof(nes_system_state, apu.sample_count) < offsetof(nes_system_state, ram), sample_count_in_fixed_part);
+
+// Everything around the dirty regions, of the APU sample buffer only the samples not output yet
+static uint8_t* delta_copy_fixed(nes_system* system, uint8_t* delta, int save)
+{
+    nes_system_state* state = &system->state;
+    uint8_t* state_begin = (uint8_t*)state;
+    uint8_t* state_end = state_begin + sizeof(nes_system_state);
+    uint8_t* samples_end = (uint8_t*)(state->apu.samples + NES_APU_MAX_SAMPLES);
+    uint8_t* vram_end = state->vram + sizeof(state->vram);
+
+    delta = delta_copy(delta, state_begin, (uint8_t*)state->apu.samples - state_begin, save);
+    delta = delta_copy(delta, samples_end, state->ram - samples_end, save);
+    delta = delta_copy(delta, vram_end, state_end - vram_end, save);
+    delta = delta_copy(delta, state->apu.samples, (state->apu.sample_count % NES_APU_MAX_SAMPLES) * sizeof(int16_t), save);
+
+    uint8_t* cartridge_state = (uint8_t*)system->cartridge->state;
+    return delta_copy(delta, cartridge_state, system->dirty_regions[DIRTY_REGION_CARTRIDGE].memory - cartridge_state, save);
+}
+
+// Size delta_copy_fixed reads from the fixed part at delta, 0 when it does not fit in delta_size
+static size_t delta_fixed_size(nes_system* system, const uint8_t* delta, size_t delta_size)
+{
+    nes_system_state* state = &system->state;
+    uint8_t* cartridge_state = (uint8_t*)system->cartridge->state;
+    size_t sample_count_offset = offsetof(nes_system_state, apu.sample_count) - sizeof(state->apu.samples);
+    size_t size = sizeof(nes_system_state) - sizeof(state->apu.samples) - sizeof(state->ram) - sizeof(state->vram) +
+                  (system->dirty_regions[DIRTY_REGION_CARTRIDGE].memory - cartridge_state);
+    uint32_t sample_count;
+
+    if (delta_size < size)
+        return 0;
+
+    memcpy(&sample_count, delta + sample_count_offset, sizeof(uint32_t));
+    size += (sample_count % NES_APU_MAX_SAMPLES) * sizeof(int16_t);
+
+    return delta_size < size ? 0 : size;
+}
+
+/////////////////////////////////////////////////
+// Engines
+/////////////////////////////////////////////////
+
+cpu_state* nes_system_cpu_state(nes_system* system)
+{
+    return &system->state.cpu;
+}
+
+const cpu_page* nes_system_cpu_pages(nes_system* system)
+{
+    return system->cpu_pages;
+}
+
+void nes_system_begin_frame_run(nes_system* system)
+{
+    // Same stop condition as run_until with NES_RUN_FRAME
+    system->run_flags = NES_RUN_FRAME;
+    system->run_stops = 0;
+    schedule_event(system, EVENT_PPU, system->cycle);
+}
+
+int nes_system_end_frame_run(nes_system* system)
+{
+    if (!system->run_stops)
+        return 0;
+
+    system->run_flags = 0;
+    ppu_sync(system);
+    apu_sync(system);
+    return 1;
+}
+
+int nes_system_begin_step(nes_system* system)
+{
+    peripherals_tick(system);
+    cpu_begin_tick(system);
+
+    return cpu_can_execute_instruction(system);
+}
+
+void nes_system_run_step(nes_system* system, int can_execute)
+{
+    cpu_instruction_run(system, can_execute);
+}
+
+void nes_system_complete_instruction(nes_system* system, cpu_state cpu, int cycles)
+{
+    cpu_complete_instruction(system, cpu, cycles);
 }
 
 /////////////////////////////////////////////////
@@ -495,13 +1591,50 @@ nes_system* nes_system_create(nes_config* config)
     {
         cartridge = config->source.cartridge;
     }
+    else if (config->source_type == NES_SOURCE_ROM_IMAGE)
+    {
+        cartridge = nes_rom_create_image_cartridge(config->source.rom_image);
+    }
 
     if (!cartridge)
         return 0;
 
     nes_system* system  = (nes_system*)malloc(sizeof(nes_system));
     system->cartridge   = cartridge;
+    system->owns_cartridge = config->source_type != NES_SOURCE_CARTRIGE;
     system->config      = *config;
+#if NES_SYSTEM_PROFILE
+    system->profile     = 0;
+#endif
+
+    system->layer_hook_lists[0] = 0;
+    system->cycle = 0;
+    system->run_flags = 0;
+    system->run_stops = 0;
+
+    // Let the mapper mirror the console nametables into its banks
+    cartridge->ciram = system->state.vram;
+    cartridge->mapper->map_banks(cartridge);
+
+    dirty_init_regions(system);
+    state_init_layout(system);
+
+    cpu_map_pages(system);
+    ppu_map_pages(system);
+
+    if (!update_layer_hooks(system))
+    {
+        nes_system_destroy(system);
+        return 0;
+    }
+
+    if (config->audio_sample_rate)
+        nes_blip_init(&system->audio_blip, 1789773, config->audio_sample_rate);
+
+    system->audio_clock = 0;
+    system->audio_output_state = 0;
+    system->audio_muted = 0;
+    system->audio_amplitude = 0;
 
     nes_system_reset(system, NES_SYSTEM_RESET_POWER_UP);
 
@@ -510,12 +1643,89 @@ nes_system* nes_system_create(nes_config* config)
 
 void nes_system_destroy(nes_system* system)
 {
-    if (system->config.source_type != NES_SOURCE_CARTRIGE)
-        free(system->cartridge);
+    if (system->owns_cartridge)
+    {
+        nes_rom_free_cartridge(system->cartridge);
+    }
+    else
+    {
+        system->cartridge->ciram = 0;
+        system->cartridge->mapper->map_banks(system->cartridge);
+    }
 
+    free(system->layer_hook_lists[0]);
     free(system);
 }
 
+nes_system* nes_system_clone(nes_system* system)
+{
+    nes_cartridge* cartridge = nes_rom_clone_cartridge(system->cartridge);
+    if (!cartridge)
+        return 0;
+
+    nes_system* clone = (nes_system*)malloc(sizeof(nes_system));
+    if (!clone)
+    {
+        nes_rom_free_cartridge(cartridge);
+        return 0;
+    }
+
+    memcpy(clone, system, sizeof(nes_system));
+    clone->cartridge = cartridge;
+    clone->owns_cartridge = 1;
+    clone->layer_hook_lists[0] = 0;
+#if NES_SYSTEM_PROFILE
+    clone->profile = 0;
+#endif
+
+    // Everything pointing into the system or its cartridge is rebuilt, the PPU and APU catch up the same way the source would
+    cartridge->ciram = clone->state.vram;
+    cartridge->mapper->map_banks(cartridge);
+
+    dirty_init_regions(clone);
+    memcpy(clone->dirty_blocks, system->dirty_blocks, sizeof(clone->dirty_blocks)); // deltas of the clone still apply to the base of the source
+
+    cpu_map_pages(clone);
+    ppu_map_pages(clone);
+
+    if (!update_layer_hooks(clone))
+    {
+        nes_system_destroy(clone);
+        return 0;
+    }
+
+    return clone;
+}
+
+void nes_system_set_audio_muted(nes_system* system, int muted)
+{
+    // Output up to now belongs to the previous setting
+    apu_sync(system);
+    system->audio_muted = muted;
+}
+
+int nes_system_set_layer(nes_system* system, nes_system_layer* layer)
+{
+    // Deferred work must not run behind layers that were not there when it was deferred
+    ppu_sync(system);
+    apu_sync(system);
+
+    nes_system_layer* previous_layer = system->config.layer;
+    system->config.layer = layer;
+
+    if (!update_layer_hooks(system))
+    {
+        system->config.layer = previous_layer;
+        return 0;
+    }
+
+    // Recompute how far the PPU and APU may run behind
+    schedule_event(system, EVENT_PPU, system->cycle);
+    schedule_event(system, EVENT_APU, system->cycle);
+
+    return 1;
+}
+
 void nes_system_reset(nes_system* system, nes_system_reset_type reset_type)
 {
     nes_system_state* state = &system->state;
@@ -527,6 +1737,8 @@ void nes_system_reset(nes_system* system, nes_system_reset_type reset_type)
         for (uint32_t i = 0; i < 0x800; ++i)
             system->state.ram[i] = (uint8_t)rand();
 
+        dirty_mark_all(system);
+
         nes_apu_power_up(&system->state.apu);
     }
     else
@@ -536,6 +1748,7 @@ void nes_system_reset(nes_system* system, nes_system_reset_type reset_type)
     }
 
     nes_ppu_reset(&state->ppu);
+    reset_events(system);
     state->cpu_odd_cycle = 1;
     state->dmc_dma = 0;
     state->oam_dma = 0;
@@ -548,18 +1761,16 @@ void nes_system_reset(nes_system* system, nes_system_reset_type reset_type)
 
 size_t nes_system_get_state_size(nes_system *system)
 {
-    return sizeof(nes_system_state) + system->cartridge->state_size;
+    return system->state_size;
 }
 
 int nes_system_save_state(nes_system* system, void* buffer, size_t buffer_size)
 {
-    size_t state_size = nes_system_get_state_size(system);
-    
-    if (buffer && buffer_size >= state_size)
+    if (buffer && buffer_size >= system->state_size)
     {
-        memcpy(buffer,                                   &system->state,            sizeof(nes_system_state));
-        memcpy((char*)buffer + sizeof(nes_system_state), system->cartridge->state,  system->cartridge->state_size);
-        return 1;
+        nes_serializer s = nes_serializer_create(buffer, buffer_size, 0);
+        state_save(system, &s);
+        return !s.failed;
     }
 
     return 0;
@@ -567,18 +1778,139 @@ int nes_system_save_state(nes_system* system, void* buffer, size_t buffer_size)
 
 int nes_system_load_state(nes_system* system, const void* buffer, size_t buffer_size)
 {
-    size_t state_size = nes_system_get_state_size(system);
-    
-    if (buffer && buffer_size >= state_size)
+    if (buffer && state_load(system, buffer, buffer_size))
     {
-        memcpy(&system->state,           buffer,                                    sizeof(nes_system_state));
-        memcpy(system->cartridge->state, (char*)buffer + sizeof(nes_system_state),  system->cartridge->state_size);
+        system->cartridge->mapper->map_banks(system->cartridge);
+        cpu_map_prg_pages(system);
+        ppu_map_pages(system);
+        reset_events(system);
+        dirty_mark_all(system);
         return 1;
     }
 
     return 0;
 }
 
+size_t nes_system_get_delta_size(nes_system* system)
+{
+    // Block count, then at most the whole state as it is in memory with one index byte per block
+    return sizeof(uint32_t) + sizeof(nes_system_state) + system->cartridge->state_size + system->dirty_block_count;
+}
+
+int nes_system_save_base(nes_system* system, void* buffer, size_t buffer_size)
+{
+    if (!nes_system_save_state(system, buffer, buffer_size))
+        return 0;
+
+    memset(system->dirty_blocks, 0, system->dirty_block_count);
+    return 1;
+}
+
+size_t nes_system_save_delta(nes_system* system, void* buffer, size_t buffer_size)
+{
+    if (!buffer || buffer_size < nes_system_get_delta_size(system))
+        return 0;
+
+    uint8_t* delta = delta_copy_fixed(system, (uint8_t*)buffer + sizeof(uint32_t), 1);
+    uint32_t block_count = 0;
+
+    for (int i = 0; i < DIRTY_REGION_COUNT; ++i)
+    {
+        const dirty_region* region = &system->dirty_regions[i];
+
+        for (size_t offset = 0; offset < region->size; offset += _DIRTY_BLOCK_SIZE)
+        {
+            size_t block = region->first_block + offset / _DIRTY_BLOCK_SIZE;
+
+            if (system->dirty_blocks[block])
+            {
+                size_t size = region->size - offset < _DIRTY_BLOCK_SIZE ? region->size - offset : _DIRTY_BLOCK_SIZE;
+
+                *delta++ = (uint8_t)block;
+                delta = delta_copy(delta, region->memory + offset, size, 1);
+                ++block_count;
+            }
+        }
+    }
+
+    memcpy(buffer, &block_count, sizeof(uint32_t));
+    return delta - (uint8_t*)buffer;
+}
+
+int nes_system_load_delta(nes_system* system, const void* base, const void* delta, size_t delta_size)
+{
+    uint32_t block_count;
+
+    if (!base || !delta || delta_size < sizeof(uint32_t))
+        return 0;
+
+    memcpy(&block_count, delta, sizeof(uint32_t));
+    if (block_count > system->dirty_block_count)
+        return 0;
+
+    // The whole delta is checked before the system is touched
+    size_t fixed_size = delta_fixed_size(system, (const uint8_t*)delta + sizeof(uint32_t), delta_size - sizeof(uint32_t));
+    if (!fixed_size)
+        return 0;
+
+    size_t expected_size = sizeof(uint32_t) + fixed_size;
+
+    for (uint32_t i = 0; i < block_count; ++i)
+    {
+        size_t block, offset, size;
+
+        if (expected_size >= delta_size)
+            return 0;
+
+        block = ((const uint8_t*)delta)[expected_size];
+        if (block >= system->dirty_block_count)
+            return 0;
+
+        dirty_block_region(system, block, &offset, &size);
+        expected_size += 1 + size;
+    }
+
+    if (expected_size != delta_size)
+        return 0;
+
+    uint8_t* cursor = delta_copy_fixed(system, (uint8_t*)delta + sizeof(uint32_t), 0);
+    uint8_t delta_blocks[_DIRTY_MAX_BLOCKS] = { 0 };
+
+    for (uint32_t i = 0; i < block_count; ++i)
+    {
+        size_t block = *cursor++, offset, size;
+        const dirty_region* region = dirty_block_region(system, block, &offset, &size);
+
+        cursor = delta_copy(cursor, region->memory + offset, size, 0);
+        delta_blocks[block] = 1;
+    }
+
+    // Blocks written since the base but not by the time of the delta go back to the base, the rest already match it
+    for (int i = 0; i < DIRTY_REGION_COUNT; ++i)
+    {
+        const dirty_region* region = &system->dirty_regions[i];
+
+        for (size_t offset = 0; offset < region->size; offset += _DIRTY_BLOCK_SIZE)
+        {
+            size_t block = region->first_block + offset / _DIRTY_BLOCK_SIZE;
+
+            if (system->dirty_blocks[block] && !delta_blocks[block])
+            {
+                size_t size = region->size - offset < _DIRTY_BLOCK_SIZE ? region->size - offset : _DIRTY_BLOCK_SIZE;
+                memcpy(region->memory + offset, (const uint8_t*)base + region->state_offset + offset, size);
+            }
+        }
+    }
+
+    memcpy(system->dirty_blocks, delta_blocks, system->dirty_block_count);
+
+    system->cartridge->mapper->map_banks(system->cartridge);
+    cpu_map_prg_pages(system);
+    ppu_map_pages(system);
+    reset_events(system);
+    return 1;
+}
+
 static uint8_t nes_system_read_cpu_byte(nes_system* system, uint16_t address)
 { 
     if (address >= 0x6000)
@@ -613,8 +1945,14 @@ static uint8_t nes_system_read_ppu_byte(nes_system* system, uint16_t address)
 { 
     if (address < 0x3F00)
     {
+        uint8_t* page = system->ppu_pages[address >> 10];
         uint8_t data = 0;
-        system->cartridge->mapper->ppu_read(system->cartridge, system->state.vram, address, &data);
+
+        if (page)
+            data = page[address & 0x3FF];
+        else
+            system->cartridge->mapper->ppu_read(system->cartridge, system->state.vram, address, &data);
+
         return data;
     }
     else if (address <= 0x3FFF)
@@ -652,28 +1990,37 @@ void nes_system_read_memory(nes_system* system, nes_memory_type memory_type, uin
         *((uint8_t*)buffer + i) = read_byte(system, address + i);
 }
 
-void nes_system_tick(nes_system* system)
+int nes_system_tick(nes_system* system)
 {
-    nes_system_state* state = &system->state;
-
-    int had_vbl = state->ppu.vbl;
-
-    ppu_tick(system);
-    ppu_tick(system);
-    ppu_tick(system);
+    int cycles = nes_system_step(system, _CPU_MAX_INSTRUCTION_CYCLES);
+    ppu_sync(system);
+    apu_sync(system);
+    return cycles;
+}
 
-    if (!had_vbl && state->ppu.vbl)
-        state->cpu.nmi = 1;
- 
-    state->cpu.irq = state->apu.frame_interrupt | state->apu.dmc.interrupt;
-    system->cartridge->mapper->tick(system->cartridge, &state->cpu, &state->ppu);
+void nes_system_frame(nes_system* system)
+{
+    nes_run_conditions conditions = { NES_RUN_CYCLES, NES_SYSTEM_CYCLES_PER_FRAME };
+    run_until(system, &conditions, NES_RUN_CYCLES);
+}
 
-    apu_tick(system);
-    cpu_tick(system);
+uint32_t nes_system_run_until(nes_system* system, const nes_run_conditions* conditions)
+{
+    switch (conditions->flags)
+    {
+        case 0:                                 return 0;
+        case NES_RUN_CYCLES:                    return run_until(system, conditions, NES_RUN_CYCLES);
+        case NES_RUN_VBLANK:                    return run_until(system, conditions, NES_RUN_VBLANK);
+        case NES_RUN_FRAME:                     return run_until(system, conditions, NES_RUN_FRAME);
+        case NES_RUN_CYCLES | NES_RUN_FRAME:    return run_until(system, conditions, NES_RUN_CYCLES | NES_RUN_FRAME);
+        case NES_RUN_BREAKPOINT:                return run_until(system, conditions, NES_RUN_BREAKPOINT);
+        default:                                return run_until(system, conditions, conditions->flags);
+    }
 }
 
-void nes_system_frame(nes_system* system)
+#if NES_SYSTEM_PROFILE
+void nes_system_set_profile(nes_system* system, nes_system_profile* profile)
 {
-    for (int i = 0; i < 29781; ++i)
-        nes_system_tick(system);
+    system->profile = profile;
 }
+#endif
@@ -69,6 +69,8 @@ typedef enum nes_memory_op
 #define NES_MEMORY_SIZE_PPU 0x4000
 #define NES_MEMORY_SIZE_OAM 0x100
 
+#define NES_SYSTEM_CYCLES_PER_FRAME 29781
+
 typedef enum nes_system_reset_type
 {
     NES_SYSTEM_RESET,
@@ -79,7 +81,8 @@ typedef enum nes_source_type
 {
     NES_SOURCE_FILE,
     NES_SOURCE_MEMORY,
-    NES_SOURCE_CARTRIGE
+    NES_SOURCE_CARTRIGE,
+    NES_SOURCE_ROM_IMAGE    // shared by every system created from it, see nes_rom_image_create in nes_rom.h
 } nes_source_type;
 
 typedef struct nes_source
@@ -87,6 +90,7 @@ typedef struct nes_source
     struct { const void* data; size_t data_size; } memory;
     const char*     file_path;
     nes_cartridge*  cartridge;
+    nes_rom_image*  rom_image;
 } nes_source;
 
 typedef struct cpu_state_   cpu_state;
@@ -114,23 +118,81 @@ typedef struct nes_config
     nes_controller_state    (*input_callback)(int controller_id, void* client_data);
     void                    (*video_callback)(const nes_video_output* video_output, void* client_data);
     void                    (*audio_callback)(const nes_audio_output* audio_output, void* client_data);
+    uint32_t                audio_sample_rate;  // 0 outputs the APU mix at the CPU rate, otherwise band-limited audio at this rate
 } nes_config;
 
 typedef struct nes_system nes_system;
 
+typedef enum nes_run_condition
+{
+    NES_RUN_CYCLES      = 1 << 0,   // ran the cycle budget
+    NES_RUN_VBLANK      = 1 << 1,   // the PPU raised the vblank flag
+    NES_RUN_FRAME       = 1 << 2,   // the PPU started a new frame at scanline 0, dot 0
+    NES_RUN_BREAKPOINT  = 1 << 3,   // the CPU is about to execute an instruction at one of the breakpoints
+    NES_RUN_INPUT       = 1 << 4    // the CPU read a controller port
+} nes_run_condition;
+
+typedef struct nes_run_conditions
+{
+    uint32_t        flags;          // nes_run_condition bits to stop on
+    uint64_t        cycles;         // budget for NES_RUN_CYCLES
+    const uint16_t* breakpoints;    // PC values for NES_RUN_BREAKPOINT
+    size_t          breakpoint_count;
+} nes_run_conditions;
+
+#if NES_SYSTEM_PROFILE
+typedef struct nes_system_profile
+{
+    uint64_t    cycles;
+    uint64_t    cpu_ns;
+    uint64_t    ppu_ns;
+    uint64_t    apu_ns;
+    uint64_t    mapper_ns;
+} nes_system_profile;
+#endif
+
 nes_system* nes_system_create(nes_config* config);
 void        nes_system_destroy(nes_system* system);
 void        nes_system_reset(nes_system* system, nes_system_reset_type reset_type);
 
+// Copy of the system that shares its PRG and CHR ROM and takes the same config and layers, for branching searches.
+// The ROM image stays until the last system using it is destroyed
+nes_system* nes_system_clone(nes_system* system);
+
+// Muted systems still run the APU but mix and hand out no audio, the output picks up where it stopped once unmuted.
+// Frames that are thrown away afterwards, like run-ahead frames undone with a state load, then leave no trace in the audio
+void        nes_system_set_audio_muted(nes_system* system, int muted);
+
+// Replaces the layer chain, call it again after editing the chain in place. Returns 0 and keeps the old chain on failure
+int         nes_system_set_layer(nes_system* system, nes_system_layer* layer);
+
+// Save states are versioned tagged chunks in a little endian layout, the size stays the same for the life of the system
 size_t      nes_system_get_state_size(nes_system* system);
 int         nes_system_save_state(nes_system* system, void* buffer, size_t buffer_size);
 int         nes_system_load_state(nes_system* system, const void* buffer, size_t buffer_size);
 
+// Delta snapshots keep only the 256 byte blocks of RAM, VRAM, mapper RAM and CHR RAM written since the last base snapshot,
+// a base is a regular save state. Loading a delta takes the buffer of that base
+size_t      nes_system_get_delta_size(nes_system* system);
+int         nes_system_save_base(nes_system* system, void* buffer, size_t buffer_size);
+size_t      nes_system_save_delta(nes_system* system, void* buffer, size_t buffer_size); // returns the bytes used, 0 on failure
+int         nes_system_load_delta(nes_system* system, const void* base, const void* delta, size_t delta_size);
+
 void        nes_system_read_memory(nes_system* system, nes_memory_type memory_type, uint16_t address, void* buffer, size_t buffer_size);
 
-void        nes_system_tick(nes_system* system);
+// Runs one CPU cycle, or a whole instruction when nothing can observe its individual cycles. Returns the cycle count
+int         nes_system_tick(nes_system* system);
 void        nes_system_frame(nes_system* system);
 
+// Runs until one of the conditions is met, at the end of the CPU cycle or instruction it happened in. The cycle budget is exact.
+// Returns the nes_run_condition bits that were met, 0 when no condition was given
+uint32_t    nes_system_run_until(nes_system* system, const nes_run_conditions* conditions);
+
+#if NES_SYSTEM_PROFILE
+// Accumulates time spent per subsystem into profile, pass 0 to stop profiling
+void        nes_system_set_profile(nes_system* system, nes_system_profile* profile);
+#endif
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,39 @@
+#ifndef _NES_SYSTEM_INTERNAL_H_
+#define _NES_SYSTEM_INTERNAL_H_
+
+#include <stdint.h>
+#include "nes_system.h"
+#include "emu6502.h"
+
+// Internals of nes_system for the engines that step systems themselves, see nes_lockstep.
+// Not part of the public API, it changes along with nes_system.c
+
+// 256 byte pages of the CPU address space
+typedef struct cpu_page
+{
+    uint8_t*    read;       // host memory behind the page, 0 when the handler decodes reads
+    uint8_t*    write;      // host memory behind the page, 0 when the handler decodes writes
+    void        (*handler)(nes_system* system);
+    uint8_t*    dirty;      // dirty_blocks flag of the block write points at
+} cpu_page;
+
+// Both stay at the same address for the life of the system
+cpu_state*      nes_system_cpu_state(nes_system* system);
+const cpu_page* nes_system_cpu_pages(nes_system* system);
+
+// Frame run as nes_system_run_until with NES_RUN_FRAME does it, one step at a time: after nes_system_begin_frame_run,
+// each step is nes_system_begin_step followed by nes_system_run_step or nes_system_complete_instruction, until
+// nes_system_end_frame_run returns 1
+void            nes_system_begin_frame_run(nes_system* system);
+int             nes_system_end_frame_run(nes_system* system);
+
+// Peripherals and the first CPU cycle of the step. Returns whether cpu_execute_instruction may run the whole instruction
+int             nes_system_begin_step(nes_system* system);
+
+// Rest of the step, the whole instruction when can_execute allows it, otherwise one cycle
+void            nes_system_run_step(nes_system* system, int can_execute);
+
+// Runs the rest of the system through an instruction the caller executed on a copy of the CPU state, then its final cycle
+void            nes_system_complete_instruction(nes_system* system, cpu_state cpu, int cycles);
+
+#endif
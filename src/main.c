@@ -5,8 +5,10 @@
 #include <SDL.h>
 #include <assert.h>
 #include "emu/nes_system.h"
+#include "emu/nes_rewind.h"
 #include "emu-utils/audio_resampler.h"
 #include "emu-utils/audio_clip.h"
+#include "emu-utils/rom_library.h"
 
 #define TEXTURE_WIDTH   256
 #define TEXTURE_HEIGHT  224
@@ -15,6 +17,8 @@
 
 #define SAMPLE_RATE 44100
 
+#define REWIND_MEMORY_MB 32
+
 SDL_Rect            video_srcrect = {0,0,TEXTURE_WIDTH, TEXTURE_HEIGHT};
 uint32_t*           texture_buffer = 0;
 uint32_t            wnd_scale = 3;
@@ -32,6 +36,14 @@ char                save_path[1024];
 void*               state_buffer = 0;
 size_t              state_buffer_size = 0;
 
+nes_rewind*         rewind_buffer = 0;
+int                 rewinding = 0;
+
+uint32_t            run_ahead_frames = 0;
+void*               run_ahead_state = 0;
+size_t              run_ahead_state_size = 0;
+int                 video_hidden = 0;
+
 uint32_t            palette_colors[64 * 8];
 
 void init_palette(const char* palette_path)
@@ -176,6 +188,9 @@ nes_controller_state on_nes_input(int controller_id, void* client)
 
 void on_nes_video(const nes_video_output* video, void* client)
 {
+    if (video_hidden)
+        return;
+
     nes_pixel* pixel = video->framebuffer;
     for (int y = 0; y < video->height; ++y)
     {
@@ -195,6 +210,10 @@ void on_nes_video(const nes_video_output* video, void* client)
 
 void on_nes_audio(const nes_audio_output* audio, void* client)
 {
+    // Frames shown while rewinding play forward, keep them quiet
+    if (rewinding)
+        return;
+
     int queue_size = SDL_GetQueuedAudioSize(audio_device_id) / resampler.info.dst_buffer_size;
 
     audio_resampler_begin(&resampler, audio->sample_rate);
@@ -211,6 +230,33 @@ void on_nes_audio(const nes_audio_output* audio, void* client)
     audio_resampler_end(&resampler);
 }
 
+// Runs the frame that counts without showing it, then the next frames with the same input from a saved state and shows
+// the last of them before going back. The frames the game takes to react to input are already on screen
+void run_ahead(nes_system* system)
+{
+    video_hidden = 1;
+    nes_system_frame(system);
+
+    if (!nes_system_save_state(system, run_ahead_state, run_ahead_state_size))
+    {
+        video_hidden = 0;
+        return;
+    }
+
+    nes_system_set_audio_muted(system, 1);
+
+    for (uint32_t i = 0; i < run_ahead_frames; ++i)
+    {
+        video_hidden = i + 1 < run_ahead_frames;
+        nes_system_frame(system);
+    }
+
+    nes_system_set_audio_muted(system, 0);
+
+    if (!nes_system_load_state(system, run_ahead_state, run_ahead_state_size))
+        fprintf(stderr, "Run-ahead state restore failed\n");
+}
+
 void handle_shortcut_key(nes_system* system, SDL_Scancode key)
 {
     const uint8_t* keys = SDL_GetKeyboardState(0);
@@ -273,11 +319,55 @@ void handle_joystick_removed(uint32_t index)
     }
 }
 
+// Settings given on the command line are stored for the ROM, the ones left out come from the library.
+// Returns 0 when the library knows the ROM cannot run
+int apply_library(const char* library_path, const char* rom_path, uint32_t* rewind_mb, uint32_t settings_given)
+{
+    rom_library_t* library = rom_library_open(library_path);
+    if (!library)
+        return 1;
+
+    const rom_library_entry_t* entry = rom_library_update(library, rom_path);
+    int supported = !entry || (entry->flags & ROM_LIBRARY_ROM_SUPPORTED);
+
+    if (entry && !(entry->flags & ROM_LIBRARY_ROM_VALID))
+        fprintf(stderr, "%s is not a valid NES ROM.\n", rom_path);
+    else if (!supported)
+        fprintf(stderr, "%s uses mapper %u, which is not supported.\n", rom_path, entry->mapper_id);
+
+    if (entry && supported)
+    {
+        rom_library_settings_t settings = entry->settings;
+
+        if (settings_given & ROM_LIBRARY_SETTING_REWIND)
+            settings.rewind_mb = *rewind_mb;
+        else if (settings.flags & ROM_LIBRARY_SETTING_REWIND)
+            *rewind_mb = settings.rewind_mb;
+
+        if (settings_given & ROM_LIBRARY_SETTING_RUN_AHEAD)
+            settings.run_ahead_frames = run_ahead_frames;
+        else if (settings.flags & ROM_LIBRARY_SETTING_RUN_AHEAD)
+            run_ahead_frames = settings.run_ahead_frames;
+
+        settings.flags |= settings_given;
+        rom_library_set_settings(library, rom_path, &settings);
+    }
+
+    if (entry && !rom_library_save(library))
+        fprintf(stderr, "Failed to save %s.\n", library_path);
+
+    rom_library_destroy(library);
+    return supported;
+}
+
 int main(int argc, char** argv)
 {
     const char*     pal_path = 0;
     const char*     rom_path = "rom.nes";
     const char*     ac_path = 0;
+    const char*     library_path = 0;
+    uint32_t        rewind_mb = REWIND_MEMORY_MB;
+    uint32_t        settings_given = 0;
     char            title[256];
     int             quit = 0;
     nes_config      config;
@@ -290,10 +380,25 @@ int main(int argc, char** argv)
             pal_path = argv[i];
         else if (strcmp(argv[i], "-record-audio") == 0 && ++i < argc)
             ac_path = argv[i];
+        else if (strcmp(argv[i], "-rewind") == 0 && ++i < argc)
+        {
+            rewind_mb = (uint32_t)atoi(argv[i]);
+            settings_given |= ROM_LIBRARY_SETTING_REWIND;
+        }
+        else if (strcmp(argv[i], "-runahead") == 0 && ++i < argc)
+        {
+            run_ahead_frames = (uint32_t)atoi(argv[i]);
+            settings_given |= ROM_LIBRARY_SETTING_RUN_AHEAD;
+        }
+        else if (strcmp(argv[i], "-library") == 0 && ++i < argc)
+            library_path = argv[i];
         else
             rom_path = argv[i];
     }
 
+    if (library_path && !apply_library(library_path, rom_path, &rewind_mb, settings_given))
+        return -1;
+
     init_palette(pal_path);
 
     audio_resampler_info resampler_info;
@@ -313,6 +418,7 @@ int main(int argc, char** argv)
     config.input_callback = &on_nes_input;
     config.video_callback = &on_nes_video;
     config.audio_callback = &on_nes_audio;
+    config.audio_sample_rate = SAMPLE_RATE;
 
     audio_clip_layer_init(&audio_clip_layer);
 
@@ -320,7 +426,11 @@ int main(int argc, char** argv)
     {
         puts("Recording audio");
         config.layer = (nes_system_layer*)&audio_clip_layer;
+        config.audio_sample_rate = 0; // The clip is recorded at the CPU rate
         audio_clip_layer_begin_record(&audio_clip_layer);
+
+        // The clip layer would record the frames run ahead too
+        run_ahead_frames = 0;
     }
 
     system = nes_system_create(&config);
@@ -330,6 +440,21 @@ int main(int argc, char** argv)
         return -1;
     }
 
+    if (rewind_mb)
+    {
+        rewind_buffer = nes_rewind_create(system, rewind_mb);
+        if (!rewind_buffer)
+            fprintf(stderr, "Failed to allocate %u MB for rewind.\n", rewind_mb);
+    }
+
+    if (run_ahead_frames)
+    {
+        run_ahead_state_size = nes_system_get_state_size(system);
+        run_ahead_state = malloc(run_ahead_state_size);
+        if (!run_ahead_state)
+            run_ahead_frames = 0;
+    }
+
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_JOYSTICK) < 0)
     {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,"Failed to initialized SDL2: %s\n", SDL_GetError());
@@ -428,7 +553,28 @@ int main(int argc, char** argv)
             dstrect.y = (h - dstrect.h)>>1;
         }
 
-        nes_system_frame(system);
+        // Hold backspace to rewind
+        rewinding = rewind_buffer && SDL_GetKeyboardState(0)[SDL_SCANCODE_BACKSPACE];
+
+        if (rewinding)
+        {
+            // Show the frame that runs from the state rewound to, then go back to that state
+            if (nes_rewind_step_back(rewind_buffer))
+            {
+                nes_system_frame(system);
+                nes_rewind_to_frame(rewind_buffer, nes_rewind_get_stats(rewind_buffer).frame);
+            }
+        }
+        else
+        {
+            if (run_ahead_frames)
+                run_ahead(system);
+            else
+                nes_system_frame(system);
+
+            if (rewind_buffer)
+                nes_rewind_capture(rewind_buffer);
+        }
 
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
         SDL_RenderClear(renderer);
@@ -458,6 +604,9 @@ int main(int argc, char** argv)
     if (audio_device_id >= 0)
         SDL_CloseAudioDevice(audio_device_id);
 
+    if (rewind_buffer)
+        nes_rewind_destroy(rewind_buffer);
+
     nes_system_destroy(system);
     free(texture_buffer);
 
@@ -466,6 +615,8 @@ int main(int argc, char** argv)
     if (state_buffer)
         free(state_buffer);
 
+    free(run_ahead_state);
+
     if (controller[0]) SDL_GameControllerClose(controller[0]);
     if (controller[1]) SDL_GameControllerClose(controller[1]);
 
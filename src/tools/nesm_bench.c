@@ -0,0 +1,508 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "emu/nes_system.h"
+#include "emu/nes_batch.h"
+#include "emu/nes_lockstep.h"
+#include "emu/nes_rewind.h"
+#include "emu/nes_rom.h"
+
+uint64_t time_ns()
+{
+    struct timespec ts;
+#if _WIN32
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Frontends always consume output, keep the callback dispatch in the measurement
+void on_nes_video(const nes_video_output* video, void* client) {}
+void on_nes_audio(const nes_audio_output* audio, void* client) {}
+
+// FNV-1a of every audio buffer into the hash client points at
+void on_nes_audio_hash(const nes_audio_output* audio, void* client)
+{
+    uint64_t* hash = *(uint64_t**)client;
+    const uint8_t* bytes = (const uint8_t*)audio->samples;
+
+    for (size_t i = 0; i < audio->sample_count * sizeof(int16_t); ++i)
+        *hash = (*hash ^ bytes[i]) * 1099511628211ull;
+}
+
+void print_usage()
+{
+    puts("usage: nesm_bench [-frames N] [-warmup N] [-rate N] [-instances N [-threads N | -lockstep]] [-rewind MB] [-runahead N] [-clone N] [-json report.json] rom.nes");
+}
+
+// Aggregate throughput of many instances stepped by the batch runner
+int run_batch(nes_config* config, int instances, int threads, int frames, int warmup)
+{
+    nes_config* configs = (nes_config*)malloc(instances * sizeof(nes_config));
+    if (!configs)
+        return -1;
+
+    for (int i = 0; i < instances; ++i)
+        configs[i] = *config;
+
+    nes_batch* batch = nes_batch_create(configs, instances, threads);
+    free(configs);
+
+    if (!batch)
+    {
+        fprintf(stderr, "Failed to initialized NES batch.\n");
+        return -1;
+    }
+
+    nes_batch_step(batch, warmup);
+    nes_batch_stats warmup_stats = nes_batch_get_stats(batch);
+
+    nes_batch_step(batch, frames);
+    nes_batch_stats stats = nes_batch_get_stats(batch);
+
+    nes_batch_destroy(batch);
+
+    uint64_t total_frames = stats.frames - warmup_stats.frames;
+    double seconds = (stats.elapsed_ns - warmup_stats.elapsed_ns) / 1e9;
+
+    printf("instances:      %d (%u threads)\n", instances, stats.thread_count);
+    printf("frames:         %llu (%.3f s)\n", (unsigned long long)total_frames, seconds);
+    printf("frames/sec:     %.2f aggregate, %.2f per instance\n", total_frames / seconds, total_frames / seconds / instances);
+
+    return 0;
+}
+
+// Same instances stepped together by the lockstep engine on the calling thread
+int run_lockstep(nes_config* config, int instances, int frames, int warmup)
+{
+    nes_config* configs = (nes_config*)malloc(instances * sizeof(nes_config));
+    if (!configs)
+        return -1;
+
+    for (int i = 0; i < instances; ++i)
+        configs[i] = *config;
+
+    nes_lockstep* lockstep = nes_lockstep_create(configs, instances);
+    free(configs);
+
+    if (!lockstep)
+    {
+        fprintf(stderr, "Failed to initialized NES lockstep.\n");
+        return -1;
+    }
+
+    for (int i = 0; i < warmup; ++i)
+        nes_lockstep_frame(lockstep);
+
+    nes_lockstep_stats warmup_stats = nes_lockstep_get_stats(lockstep);
+    uint64_t begin = time_ns();
+
+    for (int i = 0; i < frames; ++i)
+        nes_lockstep_frame(lockstep);
+
+    uint64_t elapsed_ns = time_ns() - begin;
+    nes_lockstep_stats stats = nes_lockstep_get_stats(lockstep);
+
+    nes_lockstep_destroy(lockstep);
+
+    uint64_t total_frames = (uint64_t)frames * instances;
+    uint64_t grouped = stats.grouped_instructions - warmup_stats.grouped_instructions;
+    uint64_t scalar = stats.scalar_steps - warmup_stats.scalar_steps;
+    double seconds = elapsed_ns / 1e9;
+
+    printf("instances:      %d (lockstep)\n", instances);
+    printf("frames:         %llu (%.3f s)\n", (unsigned long long)total_frames, seconds);
+    printf("frames/sec:     %.2f aggregate, %.2f per instance\n", total_frames / seconds, total_frames / seconds / instances);
+    printf("grouped:        %.1f%% of lane steps\n", grouped + scalar ? 100.0 * grouped / (grouped + scalar) : 0.0);
+
+    return 0;
+}
+
+// Cost of a rewind capture every frame and of stepping back through them
+int run_rewind(nes_config* config, uint32_t memory_mb, int frames, int warmup)
+{
+    nes_system* system = nes_system_create(config);
+    if (!system)
+    {
+        fprintf(stderr, "Failed to initialized NES system.\n");
+        return -1;
+    }
+
+    nes_rewind* rewind = nes_rewind_create(system, memory_mb);
+    if (!rewind)
+    {
+        fprintf(stderr, "Failed to allocate %u MB for rewind.\n", memory_mb);
+        nes_system_destroy(system);
+        return -1;
+    }
+
+    for (int i = 0; i < warmup; ++i)
+        nes_system_frame(system);
+
+    uint64_t capture_ns = 0;
+
+    for (int i = 0; i < frames; ++i)
+    {
+        nes_system_frame(system);
+
+        uint64_t begin = time_ns();
+        nes_rewind_capture(rewind);
+        capture_ns += time_ns() - begin;
+    }
+
+    nes_rewind_stats stats = nes_rewind_get_stats(rewind);
+    uint64_t held = stats.frame - stats.first_frame;
+
+    uint64_t begin = time_ns();
+    int steps = 0;
+
+    while (nes_rewind_step_back(rewind))
+        ++steps;
+
+    uint64_t step_ns = time_ns() - begin;
+
+    nes_rewind_destroy(rewind);
+    nes_system_destroy(system);
+
+    double capture_us = capture_ns / 1e3 / frames;
+
+    printf("rewind:         %u MB, %llu frames held, %.0f bytes/frame\n", memory_mb, (unsigned long long)held, held ? (double)stats.memory_used / held : 0.0);
+    printf("capture:        %.2f us/frame (%.2f%% of a 60 Hz frame)\n", capture_us, capture_us / (1e6 / 60.0988) * 100.0);
+    printf("step back:      %.2f us/frame\n", steps ? step_ns / 1e3 / steps : 0.0);
+
+    return 0;
+}
+
+// Undone run-ahead frames must leave no trace in the audio, a clone run ahead has to output what a plain run does
+int check_run_ahead_audio(nes_config* config, int run_ahead_frames, int frames)
+{
+    uint64_t plain_hash = 14695981039346656037ull;
+    uint64_t run_ahead_hash = plain_hash;
+    uint64_t* hash = &plain_hash;
+    nes_config hash_config = *config;
+
+    hash_config.audio_callback = &on_nes_audio_hash;
+    hash_config.client_data = &hash;
+
+    nes_system* plain = nes_system_create(&hash_config);
+    nes_system* system = plain ? nes_system_clone(plain) : 0; // same RAM and CHR RAM to start from
+    if (!system)
+    {
+        fprintf(stderr, "Failed to initialized NES system.\n");
+        return -1;
+    }
+
+    size_t state_size = nes_system_get_state_size(system);
+    void* state = malloc(state_size);
+
+    for (int i = 0; i < frames; ++i)
+        nes_system_frame(plain);
+
+    hash = &run_ahead_hash;
+
+    for (int i = 0; i < frames; ++i)
+    {
+        nes_system_frame(system);
+        nes_system_save_state(system, state, state_size);
+        nes_system_set_audio_muted(system, 1);
+
+        for (int j = 0; j < run_ahead_frames; ++j)
+            nes_system_frame(system);
+
+        nes_system_set_audio_muted(system, 0);
+        nes_system_load_state(system, state, state_size);
+    }
+
+    nes_system_destroy(system);
+    nes_system_destroy(plain);
+    free(state);
+
+    printf("audio:          %s\n", run_ahead_hash == plain_hash ? "same as a plain run" : "differs from a plain run");
+
+    return run_ahead_hash == plain_hash ? 0 : -1;
+}
+
+// Host frames the way the frontend runs them ahead: one frame, a state save, N muted frames and a state load
+int run_run_ahead(nes_config* config, int run_ahead_frames, int frames, int warmup)
+{
+    nes_system* system = nes_system_create(config);
+    if (!system)
+    {
+        fprintf(stderr, "Failed to initialized NES system.\n");
+        return -1;
+    }
+
+    size_t state_size = nes_system_get_state_size(system);
+    void* state = malloc(state_size);
+
+    for (int i = 0; i < warmup; ++i)
+        nes_system_frame(system);
+
+    uint64_t state_ns = 0;
+    uint64_t begin = time_ns();
+
+    for (int i = 0; i < frames; ++i)
+    {
+        nes_system_frame(system);
+
+        uint64_t save_begin = time_ns();
+        nes_system_save_state(system, state, state_size);
+        state_ns += time_ns() - save_begin;
+
+        nes_system_set_audio_muted(system, 1);
+
+        for (int j = 0; j < run_ahead_frames; ++j)
+            nes_system_frame(system);
+
+        nes_system_set_audio_muted(system, 0);
+
+        uint64_t load_begin = time_ns();
+        nes_system_load_state(system, state, state_size);
+        state_ns += time_ns() - load_begin;
+    }
+
+    uint64_t elapsed_ns = time_ns() - begin;
+
+    nes_system_destroy(system);
+    free(state);
+
+    double frame_us = elapsed_ns / 1e3 / frames;
+
+    printf("run-ahead:      %d frames\n", run_ahead_frames);
+    printf("host frame:     %.2f us (%.2f%% of a 60 Hz frame)\n", frame_us, frame_us / (1e6 / 60.0988) * 100.0);
+    printf("save + load:    %.2f us\n", state_ns / 1e3 / frames);
+
+    return check_run_ahead_audio(config, run_ahead_frames, frames);
+}
+
+// Search shaped run: every frame branches into N clones that each run one frame and are dropped
+int run_clone(nes_config* config, int branches, int frames, int warmup)
+{
+    nes_system* system = nes_system_create(config);
+    if (!system)
+    {
+        fprintf(stderr, "Failed to initialized NES system.\n");
+        return -1;
+    }
+
+    for (int i = 0; i < warmup; ++i)
+        nes_system_frame(system);
+
+    uint64_t clone_ns = 0;
+    uint64_t branch_ns = 0;
+
+    for (int i = 0; i < frames; ++i)
+    {
+        for (int j = 0; j < branches; ++j)
+        {
+            uint64_t clone_begin = time_ns();
+            nes_system* clone = nes_system_clone(system);
+            clone_ns += time_ns() - clone_begin;
+
+            if (!clone)
+            {
+                fprintf(stderr, "Failed to clone NES system.\n");
+                nes_system_destroy(system);
+                return -1;
+            }
+
+            uint64_t branch_begin = time_ns();
+            nes_system_frame(clone);
+            branch_ns += time_ns() - branch_begin;
+
+            clone_begin = time_ns();
+            nes_system_destroy(clone);
+            clone_ns += time_ns() - clone_begin;
+        }
+
+        nes_system_frame(system);
+    }
+
+    nes_system_destroy(system);
+
+    uint64_t count = (uint64_t)frames * branches;
+
+    printf("branches:       %d per frame\n", branches);
+    printf("clone+destroy:  %.2f us\n", clone_ns / 1e3 / count);
+    printf("branch frame:   %.2f us\n", branch_ns / 1e3 / count);
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* rom_path = 0;
+    const char* json_path = 0;
+    int         frames = 3000;
+    int         warmup = 60;
+    int         instances = 0;
+    int         threads = 0;
+    int         lockstep = 0;
+    uint32_t    rewind_mb = 0;
+    int         run_ahead_frames = 0;
+    int         branches = 0;
+    uint32_t    config_rate = 0;
+    nes_config  config;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-frames") == 0 && ++i < argc)
+            frames = atoi(argv[i]);
+        else if (strcmp(argv[i], "-warmup") == 0 && ++i < argc)
+            warmup = atoi(argv[i]);
+        else if (strcmp(argv[i], "-json") == 0 && ++i < argc)
+            json_path = argv[i];
+        else if (strcmp(argv[i], "-rate") == 0 && ++i < argc)
+            config_rate = (uint32_t)atoi(argv[i]);
+        else if (strcmp(argv[i], "-instances") == 0 && ++i < argc)
+            instances = atoi(argv[i]);
+        else if (strcmp(argv[i], "-threads") == 0 && ++i < argc)
+            threads = atoi(argv[i]);
+        else if (strcmp(argv[i], "-lockstep") == 0)
+            lockstep = 1;
+        else if (strcmp(argv[i], "-rewind") == 0 && ++i < argc)
+            rewind_mb = (uint32_t)atoi(argv[i]);
+        else if (strcmp(argv[i], "-runahead") == 0 && ++i < argc)
+            run_ahead_frames = atoi(argv[i]);
+        else if (strcmp(argv[i], "-clone") == 0 && ++i < argc)
+            branches = atoi(argv[i]);
+        else
+            rom_path = argv[i];
+    }
+
+    if (!rom_path || frames <= 0)
+    {
+        print_usage();
+        return -1;
+    }
+
+    memset(&config, 0, sizeof(nes_config));
+    config.source_type = NES_SOURCE_FILE;
+    config.source.file_path = rom_path;
+    config.video_callback = &on_nes_video;
+    config.audio_callback = &on_nes_audio;
+    config.audio_sample_rate = config_rate;
+
+    // Instances run one copy of the ROM the way a fleet of them would
+    if (instances > 0)
+    {
+        nes_rom_image* rom_image = nes_rom_load_image(rom_path, 0);
+        if (!rom_image)
+        {
+            fprintf(stderr, "Failed to load %s.\n", rom_path);
+            return -1;
+        }
+
+        config.source_type = NES_SOURCE_ROM_IMAGE;
+        config.source.rom_image = rom_image;
+
+        int result = lockstep ? run_lockstep(&config, instances, frames, warmup) : run_batch(&config, instances, threads, frames, warmup);
+
+        nes_rom_image_release(rom_image);
+        return result;
+    }
+
+    if (rewind_mb > 0)
+        return run_rewind(&config, rewind_mb, frames, warmup);
+
+    if (run_ahead_frames > 0)
+        return run_run_ahead(&config, run_ahead_frames, frames, warmup);
+
+    if (branches > 0)
+        return run_clone(&config, branches, frames, warmup);
+
+    nes_system* system = nes_system_create(&config);
+    if (!system)
+    {
+        fprintf(stderr, "Failed to initialized NES system.\n");
+        return -1;
+    }
+
+    for (int i = 0; i < warmup; ++i)
+        nes_system_frame(system);
+
+    // Throughput pass, no instrumentation in the hot loop
+
+    uint64_t begin = time_ns();
+
+    for (int i = 0; i < frames; ++i)
+        nes_system_frame(system);
+
+    uint64_t elapsed_ns = time_ns() - begin;
+
+    // Profiling pass, timers around every subsystem inflate the total so only the split is reported
+
+    nes_system_profile profile;
+    memset(&profile, 0, sizeof(nes_system_profile));
+
+    nes_system_set_profile(system, &profile);
+
+    for (int i = 0; i < frames; ++i)
+        nes_system_frame(system);
+
+    nes_system_set_profile(system, 0);
+    nes_system_destroy(system);
+
+    double seconds = elapsed_ns / 1e9;
+    double cycles = (double)frames * NES_SYSTEM_CYCLES_PER_FRAME;
+    double fps = frames / seconds;
+    double cycles_per_sec = cycles / seconds;
+    double ns_per_cycle = elapsed_ns / cycles;
+
+    const char* names[4]    = { "cpu_tick", "ppu_tick", "apu_tick", "mapper_tick" };
+    uint64_t    split_ns[4] = { profile.cpu_ns, profile.ppu_ns, profile.apu_ns, profile.mapper_ns };
+    uint64_t    profiled_ns = 0;
+
+    for (int i = 0; i < 4; ++i)
+        profiled_ns += split_ns[i];
+
+    if (profiled_ns == 0)
+        profiled_ns = 1;
+
+    printf("rom:            %s\n", rom_path);
+    printf("frames:         %d (%.3f s)\n", frames, seconds);
+    printf("frames/sec:     %.2f (%.2fx realtime)\n", fps, fps / 60.0988);
+    printf("cpu cycles/sec: %.0f\n", cycles_per_sec);
+    printf("ns/cpu cycle:   %.2f\n", ns_per_cycle);
+
+    for (int i = 0; i < 4; ++i)
+        printf("  %-12s  %5.1f%%\n", names[i], 100.0 * split_ns[i] / profiled_ns);
+
+    if (json_path)
+    {
+        FILE* file = fopen(json_path, "w");
+        if (!file)
+        {
+            perror("Failed to write JSON report");
+            return -1;
+        }
+
+        fprintf(file, "{\n");
+        fprintf(file, "  \"rom\": \"");
+        for (const char* c = rom_path; *c; ++c)
+        {
+            if (*c == '"' || *c == '\\')
+                fputc('\\', file);
+            fputc(*c, file);
+        }
+        fprintf(file, "\",\n");
+        fprintf(file, "  \"frames\": %d,\n", frames);
+        fprintf(file, "  \"seconds\": %.6f,\n", seconds);
+        fprintf(file, "  \"frames_per_sec\": %.3f,\n", fps);
+        fprintf(file, "  \"cpu_cycles_per_sec\": %.0f,\n", cycles_per_sec);
+        fprintf(file, "  \"ns_per_cpu_cycle\": %.3f,\n", ns_per_cycle);
+        fprintf(file, "  \"split\": {\n");
+        for (int i = 0; i < 4; ++i)
+            fprintf(file, "    \"%s\": %.4f%s\n", names[i], (double)split_ns[i] / profiled_ns, i < 3 ? "," : "");
+        fprintf(file, "  }\n");
+        fprintf(file, "}\n");
+
+        fclose(file);
+    }
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "emu-utils/rom_library.h"
+
+uint64_t time_ns()
+{
+    struct timespec ts;
+#if _WIN32
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void print_usage()
+{
+    puts("usage: nesm_library [-threads N] [-list] index_file [dir ...]");
+}
+
+void print_entry(const rom_library_entry_t* entry)
+{
+    if (!(entry->flags & ROM_LIBRARY_ROM_VALID))
+    {
+        printf("%-16s %-24s %s\n", "-", "invalid", entry->path);
+        return;
+    }
+
+    printf("%016llx mapper %3u %4u/%3u KB %-11s %s\n", (unsigned long long)entry->hash, entry->mapper_id,
+        entry->prg_rom_size / 1024, entry->chr_rom_size / 1024,
+        (entry->flags & ROM_LIBRARY_ROM_SUPPORTED) ? "" : "unsupported", entry->path);
+}
+
+int main(int argc, char** argv)
+{
+    const char* index_path = 0;
+    uint32_t    thread_count = 0;
+    int         list = 0;
+    int         first_dir = argc;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-threads") == 0 && ++i < argc)
+            thread_count = (uint32_t)atoi(argv[i]);
+        else if (strcmp(argv[i], "-list") == 0)
+            list = 1;
+        else
+        {
+            index_path = argv[i];
+            first_dir = i + 1;
+            break;
+        }
+    }
+
+    if (!index_path)
+    {
+        print_usage();
+        return -1;
+    }
+
+    rom_library_t* library = rom_library_open(index_path);
+    if (!library)
+    {
+        fprintf(stderr, "Failed to open %s.\n", index_path);
+        return -1;
+    }
+
+    for (int i = first_dir; i < argc; ++i)
+    {
+        rom_library_scan_stats_t stats;
+        uint64_t begin = time_ns();
+
+        if (!rom_library_scan(library, argv[i], thread_count, &stats))
+        {
+            fprintf(stderr, "Failed to scan %s.\n", argv[i]);
+            continue;
+        }
+
+        printf("%s: %u ROMs, %u read, %u removed in %.1f ms\n", argv[i], stats.files, stats.parsed, stats.removed, (time_ns() - begin) / 1e6);
+    }
+
+    if (first_dir < argc && !rom_library_save(library))
+        fprintf(stderr, "Failed to save %s.\n", index_path);
+
+    if (list)
+    {
+        for (size_t i = 0; i < rom_library_count(library); ++i)
+            print_entry(rom_library_get(library, i));
+    }
+
+    rom_library_destroy(library);
+    return 0;
+}